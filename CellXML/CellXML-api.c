@@ -0,0 +1,446 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "CellXML-api.h"
+#include "CellXML-sequential.h"
+#pragma comment (lib, "offreg.lib")
+
+// ----------------------------------------------------------------------
+// State of an offreg.dll walk
+// One path buffer is shared by the whole walk: each key appends its
+// name, and each value appends its name after the key path
+// ----------------------------------------------------------------------
+typedef struct _OFFREGWALK {
+	PHIVEFILE pHive;				// Hive being walked (its cells are also mapped)
+	PCELLXMLVISITOR pVisitor;		// Visitor receiving keys and values
+	HIVEWALKGUARD Guard;			// Visited key cells and work budget
+	LPWSTR	szPath;					// Path of the current key or value
+	size_t	cchMaxPath;				// Size of szPath (in characters)
+	LPWSTR	szValueName;			// Scratch value name buffer for OREnumValue
+	LPBYTE	lpData;					// Value data buffer (reused for every value)
+	DWORD	cbMaxData;				// Size of lpData (in bytes)
+	LPBYTE	lpSecurity;				// Security descriptor buffer for ORGetKeySecurity
+	DWORD	cbMaxSecurity;			// Size of lpSecurity (in bytes)
+	CELLXMLPOSITION Position;		// Position of the current key
+	PCELLXMLPOSITION pResume;		// Key the walk resumes at (NULL once reached)
+	BOOL	bStopped;				// A visitor returned VISIT_STOP, or the work budget ran out
+} OFFREGWALK, *POFFREGWALK;
+
+// ----------------------------------------------------------------------
+// CellXML library internal functions
+// ----------------------------------------------------------------------
+VOID VisitKey(POFFREGWALK pWalk, ORHKEY OffKey, DWORD dwCellOffset, size_t cchPath, size_t cchName, DWORD nDepth);
+DWORD ReadOffregValueData(PCELLXMLVALUE pValue);
+LPBYTE ReadOffregKeySecurity(PCELLXMLKEY pKey, PDWORD lpcbDescriptor);
+
+//-----------------------------------------------------------------
+// Walk every key and value of an opened hive with a visitor
+// offreg.dll is used unless VISIT_HIVE_SEQUENTIAL is given or the
+// hive is only held in memory (stdin, disk image). A NULL root key
+// name uses the name stored in the hive root cell.
+//-----------------------------------------------------------------
+DWORD VisitHive(PHIVEFILE pHive, LPCWSTR szRootKeyName, PCELLXMLVISITOR pVisitor, DWORD dwFlags, QWORD qwMaxWork)
+{
+	return ResumeVisitHive(pHive, szRootKeyName, pVisitor, dwFlags, qwMaxWork, NULL);
+}
+
+//-----------------------------------------------------------------
+// Walk an opened hive from the position of a key (pResume, as seen
+// by an earlier walk with the same flags), or from the root key if
+// pResume is NULL. Keys before the position are walked without a
+// callback (and without reading their values), so they are marked as
+// visited and charged to qwMaxWork exactly as in the earlier walk.
+// Returns ERROR_NOT_FOUND if the hive has no key at the position.
+//-----------------------------------------------------------------
+DWORD ResumeVisitHive(PHIVEFILE pHive, LPCWSTR szRootKeyName, PCELLXMLVISITOR pVisitor, DWORD dwFlags, QWORD qwMaxWork,
+	PCELLXMLPOSITION pResume)
+{
+	OFFREGWALK Walk;
+	size_t cchRootKey;
+	DWORD dwError;
+
+	if (NULL == szRootKeyName) {
+		szRootKeyName = pHive->lpszRootKeyName;
+	}
+	if (NULL != pResume && pResume->nDepth > MAX_KEY_DEPTH) {
+		return ERROR_INVALID_PARAMETER;
+	}
+	if ((dwFlags & VISIT_HIVE_SEQUENTIAL) || NULL == pHive->OffHive) {
+		return EnumerateKeysSequential(pHive, szRootKeyName, pVisitor, qwMaxWork, pResume);
+	}
+
+	ZeroMemory(&Walk, sizeof(OFFREGWALK));
+	Walk.pHive = pHive;
+	Walk.pVisitor = pVisitor;
+	Walk.pResume = (NULL != pResume && pResume->nDepth > 0) ? pResume : NULL;
+	dwError = InitWalkGuard(pHive, qwMaxWork, &Walk.Guard);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+	cchRootKey = _tcslen(szRootKeyName);
+	Walk.cchMaxPath = cchRootKey + MAX_KEY_DEPTH * (MAX_KEY_NAME + 1) + MAX_VALUE_NAME + 2;
+	Walk.szPath = MYALLOC(Walk.cchMaxPath * sizeof(WCHAR));
+	Walk.szValueName = MYALLOC((MAX_VALUE_NAME + 1) * sizeof(WCHAR));
+	if (NULL == Walk.szPath || NULL == Walk.szValueName) {
+		if (NULL != Walk.szPath) {
+			MYFREE(Walk.szPath);
+		}
+		if (NULL != Walk.szValueName) {
+			MYFREE(Walk.szValueName);
+		}
+		FreeWalkGuard(&Walk.Guard);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	memcpy(Walk.szPath, szRootKeyName, (cchRootKey + 1) * sizeof(WCHAR));
+
+	VisitKey(&Walk, pHive->OffHive, pHive->dwRootCellOffset, cchRootKey, cchRootKey, 0);
+
+	dwError = ERROR_SUCCESS;
+	if (Walk.Guard.bExhausted) {
+		dwError = ERROR_NOT_ENOUGH_QUOTA;
+	}
+	else if (NULL != Walk.pResume) {
+		dwError = ERROR_NOT_FOUND;
+	}
+	else if (Walk.bStopped) {
+		dwError = ERROR_CANCELLED;
+	}
+	MYFREE(Walk.szPath);
+	MYFREE(Walk.szValueName);
+	if (NULL != Walk.lpData) {
+		MYFREE(Walk.lpData);
+	}
+	if (NULL != Walk.lpSecurity) {
+		MYFREE(Walk.lpSecurity);
+	}
+	FreeWalkGuard(&Walk.Guard);
+	return dwError;
+}
+
+//-----------------------------------------------------------------
+// Walk the subtree of a key: the key node cell dwCellOffset, with the
+// full path szKeyPath, at depth nDepth below the root key. The cells
+// are read from the mapped hive (never with offreg.dll), so keys
+// outside the subtree are not read. Keys have no position.
+//-----------------------------------------------------------------
+DWORD VisitHiveKey(PHIVEFILE pHive, LPCWSTR szKeyPath, DWORD nDepth, DWORD dwCellOffset, PCELLXMLVISITOR pVisitor,
+	QWORD qwMaxWork)
+{
+	size_t cchName;
+
+	if (nDepth > MAX_KEY_DEPTH) {
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	// Key names never hold a backslash, the root key name may
+	cchName = _tcslen(szKeyPath);
+	if (nDepth > 0) {
+		LPCWSTR lpszName = wcsrchr(szKeyPath, L'\\');
+		if (NULL != lpszName) {
+			cchName -= (lpszName + 1) - szKeyPath;
+		}
+	}
+	return EnumerateSubtreeCells(pHive, szKeyPath, cchName, nDepth, dwCellOffset, pVisitor, qwMaxWork);
+}
+
+//-----------------------------------------------------------------
+// Return the data of a visited value, reading it if needed
+// The data is owned by the walk and only valid during OnValue
+//-----------------------------------------------------------------
+LPBYTE GetVisitValueData(PCELLXMLVALUE pValue)
+{
+	if (NULL == pValue->lpData && pValue->cbData > 0 && NULL != pValue->pfnReadData) {
+		if (pValue->pfnReadData(pValue) != ERROR_SUCCESS) {
+			pValue->lpData = NULL;
+		}
+	}
+	return pValue->lpData;
+}
+
+//-----------------------------------------------------------------
+// Return the self-relative security descriptor of a visited key
+// The key security cell is read when known (it is shared by many
+// keys), else the walk asks offreg.dll. Only valid during OnKey.
+//-----------------------------------------------------------------
+PSECURITY_DESCRIPTOR GetVisitKeySecurity(PCELLXMLKEY pKey, PDWORD lpcbDescriptor)
+{
+	LPBYTE lpDescriptor;
+
+	lpDescriptor = NULL;
+	if (pKey->dwSecurityOffset != HIVE_NO_CELL && NULL != pKey->pHive) {
+		lpDescriptor = GetSecurityDescriptor(pKey->pHive, pKey->dwSecurityOffset, lpcbDescriptor);
+	}
+	if (NULL == lpDescriptor && NULL != pKey->pfnReadSecurity) {
+		lpDescriptor = pKey->pfnReadSecurity(pKey, lpcbDescriptor);
+	}
+	return (PSECURITY_DESCRIPTOR)lpDescriptor;
+}
+
+// ----------------------------------------------------------------------
+// Visit a key, its values and (recursively) its subkeys with offreg.dll
+// The key path (cchPath characters) is already in the path buffer.
+// offreg.dll does not expose cell offsets, so the key cell is followed
+// alongside (when it can be matched by name): it marks the key as
+// visited and caps the value and subkey counts at the real list sizes.
+// When resuming, keys are only marked and charged (without callbacks
+// and without their values) until the resumed key is reached.
+// ----------------------------------------------------------------------
+VOID VisitKey(POFFREGWALK pWalk, ORHKEY OffKey, DWORD dwCellOffset, size_t cchPath, size_t cchName, DWORD nDepth)
+{
+	CELLXMLKEY Key;
+	CELLXMLVALUE Value;
+	HIVEKEYNODE KeyNode;
+	ORHKEY OffKeyNext;
+	LPDWORD lpSubkeys;
+	LPDWORD lpValueList;
+	LPWSTR szName;
+	DWORD dwSubkeyOffset;
+	DWORD nListed;
+	DWORD nListedValues;
+	DWORD nSize;
+	DWORD dwType;
+	DWORD cbData;
+	DWORD dwError;
+	DWORD dwAction;
+	DWORD i;
+
+	if (!ChargeWalkWork(&pWalk->Guard)) {
+		pWalk->bStopped = TRUE;
+		return;
+	}
+	if (dwCellOffset != HIVE_NO_CELL && !MarkKeyVisited(&pWalk->Guard, dwCellOffset)) {
+		return;
+	}
+	pWalk->Position.nDepth = nDepth;
+	if (NULL != pWalk->pResume && nDepth == pWalk->pResume->nDepth &&
+		memcmp(&pWalk->Position.Indices[1], &pWalk->pResume->Indices[1], nDepth * sizeof(DWORD)) == 0)
+	{
+		pWalk->pResume = NULL;
+	}
+
+	// Query the key, determine the number of keys, values and the key's last write time
+	ZeroMemory(&Key, sizeof(CELLXMLKEY));
+	if (ORQueryInfoKey(OffKey, NULL, NULL, &Key.nSubkeys,
+		NULL, NULL, &Key.nValues, NULL,
+		NULL, NULL, &Key.ftLastWriteTime) != ERROR_SUCCESS)
+	{
+		return;
+	}
+	if (dwCellOffset != HIVE_NO_CELL && !ReadKeyNode(pWalk->pHive, dwCellOffset, &KeyNode)) {
+		dwCellOffset = HIVE_NO_CELL;
+	}
+	lpValueList = NULL;
+	nListedValues = 0;
+	if (dwCellOffset != HIVE_NO_CELL) {
+		lpValueList = GetValueList(pWalk->pHive, KeyNode.dwValueList, &Key.nValues);
+		nListedValues = (NULL != lpValueList) ? Key.nValues : 0;
+		Key.nSubkeys = GetSubkeyOffsets(pWalk->pHive, KeyNode.dwSubkeyList, NULL, Key.nSubkeys);
+	}
+	Key.lpszPath = pWalk->szPath;
+	Key.cchPath = cchPath;
+	Key.lpszName = pWalk->szPath + cchPath - cchName;
+	Key.cchName = cchName;
+	Key.nDepth = nDepth;
+	Key.dwSecurityOffset = (dwCellOffset != HIVE_NO_CELL) ? KeyNode.dwSecurity : HIVE_NO_CELL;
+	Key.pPosition = &pWalk->Position;
+	Key.pHive = pWalk->pHive;
+	Key.lpWalk = pWalk;
+	Key.lpKey = OffKey;
+	Key.pfnReadSecurity = ReadOffregKeySecurity;
+
+	dwAction = VISIT_CONTINUE;
+	if (NULL == pWalk->pResume && NULL != pWalk->pVisitor->OnKey) {
+		dwAction = pWalk->pVisitor->OnKey(pWalk->pVisitor->lpContext, &Key);
+	}
+	if (dwAction == VISIT_STOP) {
+		pWalk->bStopped = TRUE;
+	}
+	if (dwAction != VISIT_CONTINUE) {
+		return;
+	}
+
+	// Values: the name is written straight after the key path, and
+	// only the type and size are read until the visitor asks for data
+	szName = pWalk->szPath + cchPath + 1;
+	for (i = 0; i < Key.nValues && NULL != pWalk->pVisitor->OnValue; i++)
+	{
+		if (!ChargeWalkWork(&pWalk->Guard)) {
+			pWalk->bStopped = TRUE;
+			return;
+		}
+		if (NULL != pWalk->pResume) {
+			continue;
+		}
+		nSize = MAX_VALUE_NAME + 1;
+		dwType = 0;
+		cbData = 0;
+		dwError = OREnumValue(OffKey, i, szName, &nSize, &dwType, NULL, &cbData);
+		if (dwError == ERROR_NO_MORE_ITEMS) {
+			break;
+		}
+		if (dwError != ERROR_SUCCESS && dwError != ERROR_MORE_DATA) {
+			continue;
+		}
+
+		ZeroMemory(&Value, sizeof(CELLXMLVALUE));
+		pWalk->szPath[cchPath] = L'\\';
+		Value.lpszName = szName;
+		Value.cchName = nSize;
+		if (nSize == 0) {
+			memcpy(szName, TEXT("(Default)"), 10 * sizeof(WCHAR));
+			Value.lpszName = L"";
+			nSize = 9;
+		}
+		Value.lpszPath = pWalk->szPath;
+		Value.cchPath = cchPath + 1 + nSize;
+		Value.dwType = dwType;
+		Value.cbData = cbData;
+		Value.dwCellOffset = (i < nListedValues) ? lpValueList[i] : HIVE_NO_CELL;
+		Value.lpWalk = pWalk;
+		Value.lpKey = OffKey;
+		Value.dwIndex = i;
+		Value.pfnReadData = ReadOffregValueData;
+
+		dwAction = pWalk->pVisitor->OnValue(pWalk->pVisitor->lpContext, &Key, &Value);
+		pWalk->szPath[cchPath] = L'\0';
+		if (dwAction == VISIT_STOP) {
+			pWalk->bStopped = TRUE;
+			return;
+		}
+		if (dwAction == VISIT_SKIP) {
+			break;
+		}
+	}
+
+	// Subkeys: the name is written straight after the key path
+	if (nDepth >= MAX_KEY_DEPTH || Key.nSubkeys == 0) {
+		return;
+	}
+	lpSubkeys = NULL;
+	nListed = 0;
+	if (dwCellOffset != HIVE_NO_CELL) {
+		lpSubkeys = MYALLOC(Key.nSubkeys * sizeof(DWORD));
+		if (NULL != lpSubkeys) {
+			nListed = GetSubkeyOffsets(pWalk->pHive, KeyNode.dwSubkeyList, lpSubkeys, Key.nSubkeys);
+		}
+	}
+	for (i = 0; i < Key.nSubkeys && !pWalk->bStopped; i++)
+	{
+		nSize = MAX_KEY_NAME + 1;
+		pWalk->szPath[cchPath] = L'\\';
+		dwError = OREnumKey(OffKey, i, szName, &nSize, NULL, NULL, NULL);
+		if (dwError == ERROR_NO_MORE_ITEMS) {
+			break;
+		}
+		if (dwError != ERROR_SUCCESS) {
+			if (!ChargeWalkWork(&pWalk->Guard)) {
+				pWalk->bStopped = TRUE;
+			}
+			continue;
+		}
+
+		dwSubkeyOffset = MatchSubkeyCell(pWalk->pHive, lpSubkeys, nListed, i, szName, nSize);
+		pWalk->Position.Indices[nDepth + 1] = i;
+		if (OROpenKey(OffKey, szName, &OffKeyNext) == ERROR_SUCCESS) {
+			VisitKey(pWalk, OffKeyNext, dwSubkeyOffset, cchPath + 1 + nSize, nSize, nDepth + 1);
+			ORCloseKey(OffKeyNext);
+		}
+	}
+	pWalk->szPath[cchPath] = L'\0';
+	if (NULL != lpSubkeys) {
+		MYFREE(lpSubkeys);
+	}
+}
+
+// ----------------------------------------------------------------------
+// Read the data of a value found by VisitKey into the walk data buffer
+// ----------------------------------------------------------------------
+DWORD ReadOffregValueData(PCELLXMLVALUE pValue)
+{
+	POFFREGWALK pWalk;
+	DWORD nSize;
+	DWORD dwType;
+	DWORD cbData;
+	DWORD dwError;
+
+	pWalk = (POFFREGWALK)pValue->lpWalk;
+	if (pValue->cbData + 2 > pWalk->cbMaxData) {
+		if (NULL != pWalk->lpData) {
+			MYFREE(pWalk->lpData);
+		}
+		pWalk->cbMaxData = max(pValue->cbData + 2, 4096);
+		pWalk->lpData = MYALLOC(pWalk->cbMaxData);
+		if (NULL == pWalk->lpData) {
+			pWalk->cbMaxData = 0;
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+	}
+
+	nSize = MAX_VALUE_NAME + 1;
+	cbData = pValue->cbData;
+	dwError = OREnumValue((ORHKEY)pValue->lpKey, pValue->dwIndex, pWalk->szValueName, &nSize,
+		&dwType, pWalk->lpData, &cbData);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+
+	// Keep string data terminated, even if it is not in the hive
+	pWalk->lpData[cbData] = 0;
+	pWalk->lpData[cbData + 1] = 0;
+	pValue->lpData = pWalk->lpData;
+	pValue->cbData = cbData;
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Read the security descriptor of a key found by VisitKey with offreg.dll
+// The descriptor is kept in the walk security buffer
+// ----------------------------------------------------------------------
+LPBYTE ReadOffregKeySecurity(PCELLXMLKEY pKey, PDWORD lpcbDescriptor)
+{
+	POFFREGWALK pWalk;
+	DWORD cbDescriptor;
+	DWORD dwError;
+
+	pWalk = (POFFREGWALK)pKey->lpWalk;
+	cbDescriptor = pWalk->cbMaxSecurity;
+	dwError = ORGetKeySecurity((ORHKEY)pKey->lpKey, KEY_SECURITY_INFORMATION,
+		(PSECURITY_DESCRIPTOR)pWalk->lpSecurity, &cbDescriptor);
+	if (dwError == ERROR_INSUFFICIENT_BUFFER || (dwError == ERROR_SUCCESS && NULL == pWalk->lpSecurity)) {
+		if (NULL != pWalk->lpSecurity) {
+			MYFREE(pWalk->lpSecurity);
+		}
+		pWalk->cbMaxSecurity = max(cbDescriptor, 1024);
+		pWalk->lpSecurity = MYALLOC(pWalk->cbMaxSecurity);
+		if (NULL == pWalk->lpSecurity) {
+			pWalk->cbMaxSecurity = 0;
+			return NULL;
+		}
+		cbDescriptor = pWalk->cbMaxSecurity;
+		dwError = ORGetKeySecurity((ORHKEY)pKey->lpKey, KEY_SECURITY_INFORMATION,
+			(PSECURITY_DESCRIPTOR)pWalk->lpSecurity, &cbDescriptor);
+	}
+	if (dwError != ERROR_SUCCESS) {
+		return NULL;
+	}
+	*lpcbDescriptor = cbDescriptor;
+	return pWalk->lpSecurity;
+}
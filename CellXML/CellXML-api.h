@@ -0,0 +1,135 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#pragma once
+#ifndef __CELLXML_API_H__
+#define __CELLXML_API_H__
+
+// ----------------------------------------------------------------------
+// CellXML library interface
+// Open a hive with OpenHiveFile, OpenHiveStdin or OpenHiveImage, then
+// call VisitHive with a visitor. Keys and values are passed to the
+// visitor as non-owning views: nothing is formatted, and a view (with
+// its path, name and data) is only valid until the callback returns.
+// Keys reached twice (subkey list cycles) are only visited once, and
+// a walk doing more than qwMaxWork keys, values and list entries is
+// abandoned with ERROR_NOT_ENOUGH_QUOTA (0 does not limit the walk).
+// ResumeVisitHive starts a walk at the position of a key seen by an
+// earlier walk of the same hive: the keys before it are walked again
+// without callbacks, so cycles and the budget count as in one walk.
+// VisitHiveKey walks the subtree of one key cell (found by an earlier
+// walk or lookup), reading only the cells of that subtree.
+// ----------------------------------------------------------------------
+#include "CellXML-hive.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VISIT_CONTINUE			0			// Keep walking
+#define VISIT_SKIP				1			// OnKey: skip the key's values and subkeys, OnValue: skip the key's other values
+#define VISIT_STOP				2			// Stop the walk (VisitHive returns ERROR_CANCELLED)
+
+#define VISIT_HIVE_SEQUENTIAL	0x0001		// Read the hive cells in file offset order (see --sequential)
+
+#define KEY_SECURITY_INFORMATION	(OWNER_SECURITY_INFORMATION | GROUP_SECURITY_INFORMATION | \
+	DACL_SECURITY_INFORMATION | SACL_SECURITY_INFORMATION)	// Parts of a key security descriptor
+
+// ----------------------------------------------------------------------
+// Position of a key in a walk
+// The subkey index of the key and of each of its ancestors within its
+// parent (Indices[1] is the index of the subkey of the root key)
+// ----------------------------------------------------------------------
+typedef struct _CELLXMLPOSITION {
+	DWORD	nDepth;					// Depth of the key (root key is 0)
+	DWORD	Indices[MAX_KEY_DEPTH + 1];	// Subkey index at each depth (Indices[0] is unused)
+} CELLXMLPOSITION, *PCELLXMLPOSITION;
+
+// ----------------------------------------------------------------------
+// A Registry key passed to a visitor
+// The security descriptor is only read when GetVisitKeySecurity is called
+// ----------------------------------------------------------------------
+typedef struct _CELLXMLKEY {
+	LPCWSTR	lpszPath;				// Full key path (including the root key name)
+	size_t	cchPath;				// Length of lpszPath (in characters)
+	LPCWSTR	lpszName;				// Key name (the last element of lpszPath)
+	size_t	cchName;				// Length of lpszName (in characters)
+	FILETIME ftLastWriteTime;		// Key last write time
+	DWORD	nSubkeys;				// Number of subkeys
+	DWORD	nValues;				// Number of values
+	DWORD	nDepth;					// Depth in the key tree (root key is 0)
+	DWORD	dwSecurityOffset;		// Key security (sk) cell, shared by many keys (HIVE_NO_CELL if unknown)
+	PCELLXMLPOSITION pPosition;		// Position of the key in the walk (see ResumeVisitHive), NULL in VisitHiveKey
+	PHIVEFILE pHive;				// Hive of the key (internal)
+	LPVOID	lpWalk;					// Walk that produced the key (internal)
+	LPVOID	lpKey;					// Key handle of the walk (internal)
+	LPBYTE	(*pfnReadSecurity)(struct _CELLXMLKEY *pKey, PDWORD lpcbDescriptor);	// Reads the descriptor (internal)
+} CELLXMLKEY, *PCELLXMLKEY;
+
+// ----------------------------------------------------------------------
+// A Registry value passed to a visitor
+// The data is only read from the hive when GetVisitValueData is called
+// ----------------------------------------------------------------------
+typedef struct _CELLXMLVALUE {
+	LPCWSTR	lpszPath;				// Full value path ("(Default)" for the default value)
+	size_t	cchPath;				// Length of lpszPath (in characters)
+	LPCWSTR	lpszName;				// Value name (empty for the default value)
+	size_t	cchName;				// Length of lpszName (in characters)
+	DWORD	dwType;					// Value data type
+	DWORD	cbData;					// Value data size (in bytes)
+	LPBYTE	lpData;					// Value data, or NULL if not read yet
+	DWORD	dwCellOffset;			// Value key (vk) cell (HIVE_NO_CELL if unknown)
+	LPVOID	lpWalk;					// Walk that produced the value (internal)
+	LPVOID	lpKey;					// Key handle of the walk (internal)
+	DWORD	dwIndex;				// Value index in the key (internal)
+	DWORD	(*pfnReadData)(struct _CELLXMLVALUE *pValue);	// Reads lpData (internal)
+} CELLXMLVALUE, *PCELLXMLVALUE;
+
+// ----------------------------------------------------------------------
+// Visitor callbacks, each returns VISIT_CONTINUE, VISIT_SKIP or VISIT_STOP
+// A NULL callback is treated as returning VISIT_CONTINUE
+// ----------------------------------------------------------------------
+typedef DWORD (*VISITKEYPROC)(LPVOID lpContext, PCELLXMLKEY pKey);
+typedef DWORD (*VISITVALUEPROC)(LPVOID lpContext, PCELLXMLKEY pKey, PCELLXMLVALUE pValue);
+
+typedef struct _CELLXMLVISITOR {
+	VISITKEYPROC	OnKey;			// Called for each key, before its values and subkeys
+	VISITVALUEPROC	OnValue;		// Called for each value of a key
+	LPVOID			lpContext;		// Passed to the callbacks
+} CELLXMLVISITOR, *PCELLXMLVISITOR;
+
+// ----------------------------------------------------------------------
+// CellXML library functions
+// ----------------------------------------------------------------------
+DWORD VisitHive(PHIVEFILE pHive, LPCWSTR szRootKeyName, PCELLXMLVISITOR pVisitor, DWORD dwFlags, QWORD qwMaxWork);
+DWORD ResumeVisitHive(PHIVEFILE pHive, LPCWSTR szRootKeyName, PCELLXMLVISITOR pVisitor, DWORD dwFlags, QWORD qwMaxWork,
+	PCELLXMLPOSITION pResume);
+DWORD VisitHiveKey(PHIVEFILE pHive, LPCWSTR szKeyPath, DWORD nDepth, DWORD dwCellOffset, PCELLXMLVISITOR pVisitor,
+	QWORD qwMaxWork);
+LPBYTE GetVisitValueData(PCELLXMLVALUE pValue);
+PSECURITY_DESCRIPTOR GetVisitKeySecurity(PCELLXMLKEY pKey, PDWORD lpcbDescriptor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __CELLXML_API_H__
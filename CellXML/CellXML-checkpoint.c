@@ -0,0 +1,297 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include "CellXML-checkpoint.h"
+#include <io.h>
+
+// ----------------------------------------------------------------------
+// CellXML checkpoint internal functions
+// ----------------------------------------------------------------------
+DWORD SaveCheckpoint(PCHECKPOINTWRITER pCheckpoint, PCELLXMLKEY pKey);
+DWORD ReadCheckpointFile(PCHECKPOINTWRITER pCheckpoint);
+DWORD TruncateOutput(FILE *fp, QWORD qwOffset);
+
+//-----------------------------------------------------------------
+// Put a checkpoint writer in front of an XML writer
+// pVisitor must already be set up by InitXmlWriter, and the writer
+// output must be a file that can be cut back on resume. dwOptions
+// (CHECKPOINT_ flags) must be the same when the export is resumed.
+//-----------------------------------------------------------------
+DWORD InitCheckpointWriter(PCHECKPOINTWRITER pCheckpoint, PXMLWRITER pWriter, PCELLXMLVISITOR pVisitor,
+	LPCWSTR lpszFileName, PHIVEFILE pHive, DWORD dwOptions)
+{
+	size_t cchFileName;
+
+	ZeroMemory(pCheckpoint, sizeof(CHECKPOINTWRITER));
+	pCheckpoint->pWriter = pWriter;
+	pCheckpoint->Writer = *pVisitor;
+	pCheckpoint->lpszFileName = lpszFileName;
+
+	// The checkpoint is written next to its final name, then renamed
+	cchFileName = wcslen(lpszFileName);
+	pCheckpoint->lpszTempFileName = MYALLOC((cchFileName + 5) * sizeof(WCHAR));
+	if (NULL == pCheckpoint->lpszTempFileName) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	memcpy(pCheckpoint->lpszTempFileName, lpszFileName, cchFileName * sizeof(WCHAR));
+	memcpy(pCheckpoint->lpszTempFileName + cchFileName, L".tmp", 5 * sizeof(WCHAR));
+
+	// The hive is recognised by its base block
+	pCheckpoint->Header.dwSignature = CHECKPOINT_SIGNATURE;
+	pCheckpoint->Header.dwVersion = CHECKPOINT_VERSION;
+	pCheckpoint->Header.dwPrimarySequence = pHive->dwPrimarySequence;
+	pCheckpoint->Header.dwSecondarySequence = pHive->dwSecondarySequence;
+	pCheckpoint->Header.dwChecksum = *(LPDWORD)(pHive->lpBase + REGF_CHECKSUM);
+	pCheckpoint->Header.cbHiveBins = pHive->cbHiveBins;
+	pCheckpoint->Header.ftLastWritten = *(PFILETIME)(pHive->lpBase + REGF_LAST_WRITTEN);
+	pCheckpoint->Header.dwOptions = dwOptions;
+	pCheckpoint->qwNextCheckpoint = GetTickCount64() + CHECKPOINT_INTERVAL;
+
+	pVisitor->OnKey = CheckpointKeyXml;
+	pVisitor->OnValue = CheckpointValueXml;
+	pVisitor->lpContext = pCheckpoint;
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Load the checkpoint of an interrupted export of the same hive
+// The output is cut back to the checkpoint and the cellobject
+// counts are restored. The walk is then resumed at Position with
+// ResumeVisitHive. Returns ERROR_REVISION_MISMATCH if the hive
+// changed, ERROR_INVALID_PARAMETER if the options changed.
+//-----------------------------------------------------------------
+DWORD ResumeCheckpoint(PCHECKPOINTWRITER pCheckpoint)
+{
+	PXMLOUTPUT pOutput;
+	DWORD dwError;
+
+	dwError = ReadCheckpointFile(pCheckpoint);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+
+	pOutput = pCheckpoint->pWriter->pOutput;
+	dwError = TruncateOutput(pOutput->fp, pCheckpoint->Header.qwOutputOffset);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+	pOutput->nKeyObjects = pCheckpoint->Header.nKeyObjects;
+	pOutput->nValueObjects = pCheckpoint->Header.nValueObjects;
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Visitor callback: save a checkpoint before writing a key
+// The first key of a resumed walk must be the checkpoint key
+//-----------------------------------------------------------------
+DWORD CheckpointKeyXml(LPVOID lpContext, PCELLXMLKEY pKey)
+{
+	PCHECKPOINTWRITER pCheckpoint;
+
+	pCheckpoint = (PCHECKPOINTWRITER)lpContext;
+	if (NULL != pCheckpoint->lpszPath) {
+		if (pKey->cchPath != pCheckpoint->Header.cchPath ||
+			memcmp(pKey->lpszPath, pCheckpoint->lpszPath, pKey->cchPath * sizeof(WCHAR)) != 0)
+		{
+			pCheckpoint->dwError = ERROR_REVISION_MISMATCH;
+			return VISIT_STOP;
+		}
+		MYFREE(pCheckpoint->lpszPath);
+		pCheckpoint->lpszPath = NULL;
+		ResumeXmlWriter(pCheckpoint->pWriter, pKey);
+	}
+	else if (GetTickCount64() >= pCheckpoint->qwNextCheckpoint) {
+		pCheckpoint->dwError = SaveCheckpoint(pCheckpoint, pKey);
+		if (pCheckpoint->dwError != ERROR_SUCCESS) {
+			return VISIT_STOP;
+		}
+		pCheckpoint->qwNextCheckpoint = GetTickCount64() + CHECKPOINT_INTERVAL;
+	}
+	return pCheckpoint->Writer.OnKey(pCheckpoint->Writer.lpContext, pKey);
+}
+
+//-----------------------------------------------------------------
+// Visitor callback: values are written as they are
+//-----------------------------------------------------------------
+DWORD CheckpointValueXml(LPVOID lpContext, PCELLXMLKEY pKey, PCELLXMLVALUE pValue)
+{
+	PCHECKPOINTWRITER pCheckpoint;
+
+	pCheckpoint = (PCHECKPOINTWRITER)lpContext;
+	return pCheckpoint->Writer.OnValue(pCheckpoint->Writer.lpContext, pKey, pValue);
+}
+
+//-----------------------------------------------------------------
+// A complete export no longer needs its checkpoint
+//-----------------------------------------------------------------
+VOID FinishCheckpoint(PCHECKPOINTWRITER pCheckpoint, DWORD dwError)
+{
+	if (dwError == ERROR_SUCCESS) {
+		DeleteFile(pCheckpoint->lpszFileName);
+	}
+}
+
+//-----------------------------------------------------------------
+// Free the checkpoint writer
+//-----------------------------------------------------------------
+VOID FreeCheckpointWriter(PCHECKPOINTWRITER pCheckpoint)
+{
+	if (NULL != pCheckpoint->lpszTempFileName) {
+		MYFREE(pCheckpoint->lpszTempFileName);
+	}
+	if (NULL != pCheckpoint->lpszPath) {
+		MYFREE(pCheckpoint->lpszPath);
+	}
+	ZeroMemory(pCheckpoint, sizeof(CHECKPOINTWRITER));
+}
+
+// ----------------------------------------------------------------------
+// Save the position of a key (not yet written) and the output size
+// The output is on disk before the checkpoint naming its size, and
+// the checkpoint file is replaced in one rename, so an export killed
+// at any time leaves the previous or the new checkpoint intact
+// ----------------------------------------------------------------------
+DWORD SaveCheckpoint(PCHECKPOINTWRITER pCheckpoint, PCELLXMLKEY pKey)
+{
+	PXMLOUTPUT pOutput;
+	HANDLE hFile;
+	__int64 qwOffset;
+	DWORD cbWritten;
+	BOOL bWritten;
+	DWORD dwError;
+
+	if (NULL == pKey->pPosition || pKey->nDepth > MAX_KEY_DEPTH) {
+		return ERROR_SUCCESS;
+	}
+	pOutput = pCheckpoint->pWriter->pOutput;
+	if (fflush(pOutput->fp) != 0) {
+		return ERROR_WRITE_FAULT;
+	}
+	qwOffset = _ftelli64(pOutput->fp);
+	if (qwOffset < 0) {
+		return ERROR_WRITE_FAULT;
+	}
+	_commit(_fileno(pOutput->fp));
+
+	pCheckpoint->Header.nDepth = pKey->nDepth;
+	pCheckpoint->Header.cchPath = (DWORD)pKey->cchPath;
+	pCheckpoint->Header.nKeyObjects = pOutput->nKeyObjects;
+	pCheckpoint->Header.nValueObjects = pOutput->nValueObjects;
+	pCheckpoint->Header.qwOutputOffset = (QWORD)qwOffset;
+
+	hFile = CreateFile(pCheckpoint->lpszTempFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		return GetLastError();
+	}
+	bWritten = WriteFile(hFile, &pCheckpoint->Header, sizeof(CHECKPOINTHEADER), &cbWritten, NULL) &&
+		WriteFile(hFile, &pKey->pPosition->Indices[1], pKey->nDepth * sizeof(DWORD), &cbWritten, NULL) &&
+		WriteFile(hFile, pKey->lpszPath, (DWORD)(pKey->cchPath * sizeof(WCHAR)), &cbWritten, NULL) &&
+		FlushFileBuffers(hFile);
+	dwError = bWritten ? ERROR_SUCCESS : GetLastError();
+	CloseHandle(hFile);
+	if (dwError != ERROR_SUCCESS) {
+		DeleteFile(pCheckpoint->lpszTempFileName);
+		return dwError;
+	}
+	if (!MoveFileEx(pCheckpoint->lpszTempFileName, pCheckpoint->lpszFileName,
+		MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		return GetLastError();
+	}
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Read and check the checkpoint file against the opened hive
+// ----------------------------------------------------------------------
+DWORD ReadCheckpointFile(PCHECKPOINTWRITER pCheckpoint)
+{
+	CHECKPOINTHEADER Header;
+	HANDLE hFile;
+	DWORD cbRead;
+	DWORD cbIndices;
+	DWORD cbPath;
+	DWORD dwError;
+
+	hFile = CreateFile(pCheckpoint->lpszFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		return GetLastError();
+	}
+
+	dwError = ERROR_SUCCESS;
+	if (!ReadFile(hFile, &Header, sizeof(CHECKPOINTHEADER), &cbRead, NULL) || cbRead != sizeof(CHECKPOINTHEADER) ||
+		Header.dwSignature != CHECKPOINT_SIGNATURE || Header.dwVersion != CHECKPOINT_VERSION ||
+		Header.nDepth > MAX_KEY_DEPTH || Header.cchPath > MAX_KEY_DEPTH * (MAX_KEY_NAME + 1) + MAX_PATH)
+	{
+		dwError = ERROR_INVALID_DATA;
+	}
+	else if (Header.dwPrimarySequence != pCheckpoint->Header.dwPrimarySequence ||
+		Header.dwSecondarySequence != pCheckpoint->Header.dwSecondarySequence ||
+		Header.dwChecksum != pCheckpoint->Header.dwChecksum ||
+		Header.cbHiveBins != pCheckpoint->Header.cbHiveBins ||
+		CompareFileTime(&Header.ftLastWritten, &pCheckpoint->Header.ftLastWritten) != 0)
+	{
+		dwError = ERROR_REVISION_MISMATCH;
+	}
+	else if (Header.dwOptions != pCheckpoint->Header.dwOptions) {
+		dwError = ERROR_INVALID_PARAMETER;
+	}
+	if (dwError != ERROR_SUCCESS) {
+		CloseHandle(hFile);
+		return dwError;
+	}
+
+	// The subkey indices and the key path follow the header
+	ZeroMemory(&pCheckpoint->Position, sizeof(CELLXMLPOSITION));
+	pCheckpoint->Position.nDepth = Header.nDepth;
+	cbIndices = Header.nDepth * sizeof(DWORD);
+	cbPath = Header.cchPath * sizeof(WCHAR);
+	pCheckpoint->lpszPath = MYALLOC(cbPath + sizeof(WCHAR));
+	if (NULL == pCheckpoint->lpszPath) {
+		CloseHandle(hFile);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	if (!ReadFile(hFile, &pCheckpoint->Position.Indices[1], cbIndices, &cbRead, NULL) || cbRead != cbIndices ||
+		!ReadFile(hFile, pCheckpoint->lpszPath, cbPath, &cbRead, NULL) || cbRead != cbPath)
+	{
+		dwError = ERROR_INVALID_DATA;
+	}
+	CloseHandle(hFile);
+	pCheckpoint->lpszPath[Header.cchPath] = L'\0';
+	pCheckpoint->Header = Header;
+	return dwError;
+}
+
+// ----------------------------------------------------------------------
+// Cut the output back to the size saved in a checkpoint
+// ----------------------------------------------------------------------
+DWORD TruncateOutput(FILE *fp, QWORD qwOffset)
+{
+	if (_fseeki64(fp, 0, SEEK_END) != 0 || _ftelli64(fp) < (__int64)qwOffset) {
+		return ERROR_INVALID_DATA;
+	}
+	if (_chsize_s(_fileno(fp), qwOffset) != 0 || _fseeki64(fp, qwOffset, SEEK_SET) != 0) {
+		return ERROR_WRITE_FAULT;
+	}
+	return ERROR_SUCCESS;
+}
@@ -0,0 +1,90 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#pragma once
+#ifndef __CELLXML_CHECKPOINT_H__
+#define __CELLXML_CHECKPOINT_H__
+
+#include "CellXML-xml.h"
+
+#define CHECKPOINT_SIGNATURE	0x504B4843	// "CHKP"
+#define CHECKPOINT_VERSION		1			// Checkpoint file format version
+#define CHECKPOINT_INTERVAL		5000		// Time between checkpoints (in milliseconds)
+
+#define CHECKPOINT_SEQUENTIAL	0x0001		// Output options a resumed export must match
+#define CHECKPOINT_MATCH		0x0002
+#define CHECKPOINT_DEDUP		0x0004
+#define CHECKPOINT_SECURITY		0x0008
+
+// ----------------------------------------------------------------------
+// Checkpoint file header
+// Followed by the subkey indices of the position (Indices[1] up to
+// Indices[nDepth]) and the path of the key (cchPath characters)
+// ----------------------------------------------------------------------
+typedef struct _CHECKPOINTHEADER {
+	DWORD	dwSignature;			// CHECKPOINT_SIGNATURE
+	DWORD	dwVersion;				// CHECKPOINT_VERSION
+	DWORD	dwPrimarySequence;		// Hive base block primary sequence number
+	DWORD	dwSecondarySequence;	// Hive base block secondary sequence number
+	DWORD	dwChecksum;				// Hive base block checksum
+	DWORD	cbHiveBins;				// Size of the hive bins data (in bytes)
+	FILETIME ftLastWritten;			// Hive base block last written timestamp
+	DWORD	dwOptions;				// Output options (CHECKPOINT_ flags)
+	DWORD	nDepth;					// Depth of the key the export resumes at
+	DWORD	cchPath;				// Length of the key path (in characters)
+	DWORD	nKeyObjects;			// Key cellobjects written before the key
+	DWORD	nValueObjects;			// Value cellobjects written before the key
+	QWORD	qwOutputOffset;			// Output size before the key (in bytes)
+} CHECKPOINTHEADER, *PCHECKPOINTHEADER;
+
+// ----------------------------------------------------------------------
+// Checkpoint writer, used as a hive visitor in front of the XML writer
+// Every CHECKPOINT_INTERVAL, before a key is written, the output is
+// flushed and the position of the key is saved with the output size.
+// A resumed export checks the hive is unchanged, cuts the output back
+// to the saved size and walks on from the saved key.
+// ----------------------------------------------------------------------
+typedef struct _CHECKPOINTWRITER {
+	PXMLWRITER	pWriter;			// XML writer (its output must be a file)
+	CELLXMLVISITOR Writer;			// Visitor of the XML writer
+	LPCWSTR		lpszFileName;		// Checkpoint file name
+	LPWSTR		lpszTempFileName;	// Checkpoint written here, then renamed
+	CHECKPOINTHEADER Header;		// Last checkpoint saved or loaded
+	CELLXMLPOSITION Position;		// Position of the checkpoint key
+	LPWSTR		lpszPath;			// Path of the loaded checkpoint key (NULL once reached)
+	ULONGLONG	qwNextCheckpoint;	// Tick count of the next checkpoint
+	DWORD		dwError;			// First error saving a checkpoint
+} CHECKPOINTWRITER, *PCHECKPOINTWRITER;
+
+// ----------------------------------------------------------------------
+// CellXML checkpoint functions
+// ----------------------------------------------------------------------
+DWORD InitCheckpointWriter(PCHECKPOINTWRITER pCheckpoint, PXMLWRITER pWriter, PCELLXMLVISITOR pVisitor,
+	LPCWSTR lpszFileName, PHIVEFILE pHive, DWORD dwOptions);
+DWORD ResumeCheckpoint(PCHECKPOINTWRITER pCheckpoint);
+DWORD CheckpointKeyXml(LPVOID lpContext, PCELLXMLKEY pKey);
+DWORD CheckpointValueXml(LPVOID lpContext, PCELLXMLKEY pKey, PCELLXMLVALUE pValue);
+VOID FinishCheckpoint(PCHECKPOINTWRITER pCheckpoint, DWORD dwError);
+VOID FreeCheckpointWriter(PCHECKPOINTWRITER pCheckpoint);
+
+#endif // __CELLXML_CHECKPOINT_H__
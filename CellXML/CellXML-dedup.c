@@ -0,0 +1,188 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "CellXML-dedup.h"
+
+// ----------------------------------------------------------------------
+// CellXML value data deduplication internal functions
+// ----------------------------------------------------------------------
+LPBYTE FindHiveData(PDATADEDUP pDedup, LPBYTE lpData, DWORD cbData, DWORD dwValueCell);
+
+//-----------------------------------------------------------------
+// Allocate an empty data table for the values of an opened hive
+//-----------------------------------------------------------------
+DWORD InitDataDedup(PDATADEDUP pDedup, PHIVEFILE pHive)
+{
+	ZeroMemory(pDedup, sizeof(DATADEDUP));
+	pDedup->pHive = pHive;
+	pDedup->lpEntries = MYALLOC0(DEDUP_TABLE_ENTRIES * sizeof(DEDUPENTRY));
+	if (NULL == pDedup->lpEntries) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Free the data table
+//-----------------------------------------------------------------
+VOID FreeDataDedup(PDATADEDUP pDedup)
+{
+	if (NULL != pDedup->lpEntries) {
+		MYFREE(pDedup->lpEntries);
+	}
+	ZeroMemory(pDedup, sizeof(DATADEDUP));
+}
+
+//-----------------------------------------------------------------
+// Look up value data written earlier
+// Returns the number of the value cellobject that first held the
+// same data (and type) in the same output document, or 0 if the
+// data has to be written in full: it is then recorded as belonging
+// to value cellobject nValue of document nDocument. Data that cannot
+// be found in the hive (value key dwValueCell) is never recorded.
+//-----------------------------------------------------------------
+DWORD FindOrAddData(PDATADEDUP pDedup, LPBYTE lpData, DWORD cbData, DWORD dwType, DWORD dwValueCell,
+	DWORD nDocument, DWORD nValue)
+{
+	PDEDUPENTRY pEntry;
+	PDEDUPENTRY pVictim;
+	LPBYTE lpHiveData;
+	QWORD qwHash;
+	DWORD iSlot;
+	DWORD i;
+
+	if (cbData < DEDUP_MIN_DATA) {
+		return 0;
+	}
+	pDedup->nLookups++;
+	qwHash = HashData(lpData, cbData);
+
+	// Linear probing from the home slot, a free slot ends the search
+	pVictim = NULL;
+	iSlot = (DWORD)qwHash & (DEDUP_TABLE_ENTRIES - 1);
+	for (i = 0; i < DEDUP_MAX_PROBES; i++)
+	{
+		pEntry = &pDedup->lpEntries[(iSlot + i) & (DEDUP_TABLE_ENTRIES - 1)];
+		if (pEntry->nFirstValue == 0) {
+			pVictim = pEntry;
+			break;
+		}
+		if (pEntry->qwHash == qwHash && pEntry->cbData == cbData && pEntry->dwType == dwType &&
+			pEntry->nDocument == nDocument && memcmp(pEntry->lpData, lpData, cbData) == 0)
+		{
+			pDedup->nRepeats++;
+			pDedup->cbSaved += cbData;
+			return pEntry->nFirstValue;
+		}
+		if (NULL == pVictim || pEntry->nFirstValue < pVictim->nFirstValue) {
+			pVictim = pEntry;
+		}
+	}
+
+	// Only data that can be compared again later is recorded
+	lpHiveData = FindHiveData(pDedup, lpData, cbData, dwValueCell);
+	if (NULL == lpHiveData) {
+		return 0;
+	}
+	pVictim->qwHash = qwHash;
+	pVictim->cbData = cbData;
+	pVictim->dwType = dwType;
+	pVictim->nDocument = nDocument;
+	pVictim->nFirstValue = nValue;
+	pVictim->lpData = lpHiveData;
+	return 0;
+}
+
+// ----------------------------------------------------------------------
+// Find value data in the hive, where it stays until the hive is closed
+// Data read from the hive cells is already there, data read through
+// offreg.dll is looked up in its value key cell. Big data is only
+// held in a heap copy, so it is not found (and never deduplicated).
+// ----------------------------------------------------------------------
+LPBYTE FindHiveData(PDATADEDUP pDedup, LPBYTE lpData, DWORD cbData, DWORD dwValueCell)
+{
+	PHIVEFILE pHive;
+	HIVEVALUEKEY ValueKey;
+	LPBYTE lpHiveData;
+	DWORD cbHiveData;
+	BOOL bAllocated;
+
+	pHive = pDedup->pHive;
+	if (lpData >= pHive->lpBase && cbData <= pHive->cbFile && (QWORD)(lpData - pHive->lpBase) <= pHive->cbFile - cbData) {
+		return lpData;
+	}
+	if (dwValueCell == HIVE_NO_CELL || !ReadValueKey(pHive, dwValueCell, &ValueKey)) {
+		return NULL;
+	}
+	lpHiveData = GetValueData(pHive, &ValueKey, &cbHiveData, &bAllocated);
+	if (bAllocated) {
+		if (NULL != lpHiveData) {
+			MYFREE(lpHiveData);
+		}
+		return NULL;
+	}
+	if (NULL == lpHiveData || cbHiveData != cbData || memcmp(lpHiveData, lpData, cbData) != 0) {
+		return NULL;
+	}
+	return lpHiveData;
+}
+
+// ----------------------------------------------------------------------
+// 64 bit hash of a data blob (MurmurHash64A, by Austin Appleby)
+// Reads 8 bytes per step, the data does not have to be aligned
+// ----------------------------------------------------------------------
+QWORD HashData(LPBYTE lpData, DWORD cbData)
+{
+	const QWORD m = 0xC6A4A7935BD1E995ULL;
+	const int r = 47;
+	QWORD h;
+	QWORD k;
+	LPBYTE lpEnd;
+
+	h = 0x5BD1E995ULL ^ (cbData * m);
+	lpEnd = lpData + (cbData & ~7);
+	for (; lpData < lpEnd; lpData += 8)
+	{
+		memcpy(&k, lpData, sizeof(QWORD));
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+
+	switch (cbData & 7) {
+	case 7: h ^= (QWORD)lpData[6] << 48;
+	case 6: h ^= (QWORD)lpData[5] << 40;
+	case 5: h ^= (QWORD)lpData[4] << 32;
+	case 4: h ^= (QWORD)lpData[3] << 24;
+	case 3: h ^= (QWORD)lpData[2] << 16;
+	case 2: h ^= (QWORD)lpData[1] << 8;
+	case 1: h ^= (QWORD)lpData[0];
+		h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
@@ -0,0 +1,69 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#pragma once
+#ifndef __CELLXML_DEDUP_H__
+#define __CELLXML_DEDUP_H__
+
+#include "CellXML-hive.h"
+
+#define DEDUP_TABLE_ENTRIES		65536		// Size of the data table (a power of 2)
+#define DEDUP_MAX_PROBES		8			// Slots searched before an entry is replaced
+#define DEDUP_MIN_DATA			16			// Smaller data is always written in full
+
+// ----------------------------------------------------------------------
+// A value data blob seen earlier in the output
+// ----------------------------------------------------------------------
+typedef struct _DEDUPENTRY {
+	QWORD	qwHash;					// Hash of the data bytes
+	DWORD	cbData;					// Data size (in bytes)
+	DWORD	dwType;					// Value data type
+	DWORD	nDocument;				// Output document holding the data
+	DWORD	nFirstValue;			// Value cellobject that holds the data (0 = free slot)
+	LPBYTE	lpData;					// The same data in the hive (mapped view or heap copy)
+} DEDUPENTRY, *PDEDUPENTRY;
+
+// ----------------------------------------------------------------------
+// Content addressed table of value data written to the output
+// The table has a fixed size: when all probed slots are taken the
+// oldest candidate is replaced, so memory use never grows and only
+// some repeats are written in full again. Entries point at their data
+// in the hive, so a hash match is always confirmed byte by byte.
+// ----------------------------------------------------------------------
+typedef struct _DATADEDUP {
+	PDEDUPENTRY	lpEntries;			// DEDUP_TABLE_ENTRIES slots
+	PHIVEFILE	pHive;				// Hive holding the data of the entries
+	QWORD	nLookups;				// Data blobs looked up
+	QWORD	nRepeats;				// Data blobs found in the table
+	QWORD	cbSaved;				// Data bytes not written again
+} DATADEDUP, *PDATADEDUP;
+
+// ----------------------------------------------------------------------
+// CellXML value data deduplication functions
+// ----------------------------------------------------------------------
+DWORD InitDataDedup(PDATADEDUP pDedup, PHIVEFILE pHive);
+VOID FreeDataDedup(PDATADEDUP pDedup);
+DWORD FindOrAddData(PDATADEDUP pDedup, LPBYTE lpData, DWORD cbData, DWORD dwType, DWORD dwValueCell,
+	DWORD nDocument, DWORD nValue);
+QWORD HashData(LPBYTE lpData, DWORD cbData);
+
+#endif // __CELLXML_DEDUP_H__
@@ -0,0 +1,938 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "CellXML-hive.h"
+
+// ----------------------------------------------------------------------
+// CellXML hive file internal functions
+// ----------------------------------------------------------------------
+DWORD MapHiveRange(PHIVEFILE pHive, QWORD qwOffset, QWORD cbLength);
+DWORD LoadHiveBaseBlock(PHIVEFILE pHive);
+DWORD CalculateBaseBlockChecksum(LPBYTE lpBaseBlock);
+DWORD ValidateBaseBlock(PHIVEFILE pHive);
+DWORD ResolveRootKeyName(PHIVEFILE pHive);
+
+// ----------------------------------------------------------------------
+// CellXML library global variables
+// ----------------------------------------------------------------------
+HANDLE hHeap;					// CellXML heap (set when a hive is first opened)
+
+//-----------------------------------------------------------------
+// Open, map and validate a Registry hive file
+// The hive file is only opened once: the base block and root key
+// are read from the mapped view, then the same file handle is
+// passed to offreg.dll using OROpenHiveByHandle
+//-----------------------------------------------------------------
+DWORD OpenHiveFile(LPCWSTR lpszHiveFileName, PHIVEFILE pHive)
+{
+	LARGE_INTEGER liFileSize;
+	DWORD dwError;
+
+	if (NULL == hHeap) {
+		hHeap = GetProcessHeap();
+	}
+	ZeroMemory(pHive, sizeof(HIVEFILE));
+
+	// Open the hive file based on user passed file name
+	pHive->hFile = CreateFile(lpszHiveFileName,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+	if (pHive->hFile == INVALID_HANDLE_VALUE) {
+		pHive->hFile = NULL;
+		return GetLastError();
+	}
+
+	// Map a read-only view of the entire hive file
+	if (!GetFileSizeEx(pHive->hFile, &liFileSize)) {
+		dwError = GetLastError();
+		CloseHiveFile(pHive);
+		return dwError;
+	}
+	dwError = MapHiveRange(pHive, 0, (QWORD)liFileSize.QuadPart);
+	if (dwError == ERROR_SUCCESS) {
+		dwError = LoadHiveBaseBlock(pHive);
+	}
+	if (dwError != ERROR_SUCCESS) {
+		CloseHiveFile(pHive);
+		return dwError;
+	}
+
+	// Give the already opened file handle to offreg.dll
+	dwError = OROpenHiveByHandle(pHive->hFile, &pHive->OffHive);
+	if (dwError != ERROR_SUCCESS) {
+		pHive->OffHive = NULL;
+		CloseHiveFile(pHive);
+		return dwError;
+	}
+
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Open a Registry hive stored at a byte range of a raw disk image
+// The range is mapped directly (no copy, no temporary file). When
+// cbLength is 0 the length is taken from the hive base block.
+// offreg.dll cannot open a hive in memory, so OffHive stays NULL.
+//-----------------------------------------------------------------
+DWORD OpenHiveImage(LPCWSTR lpszImageFileName, QWORD qwOffset, QWORD cbLength, PHIVEFILE pHive)
+{
+	LARGE_INTEGER liFileSize;
+	DWORD dwError;
+
+	if (NULL == hHeap) {
+		hHeap = GetProcessHeap();
+	}
+	ZeroMemory(pHive, sizeof(HIVEFILE));
+
+	pHive->hFile = CreateFile(lpszImageFileName,
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+	if (pHive->hFile == INVALID_HANDLE_VALUE) {
+		pHive->hFile = NULL;
+		return GetLastError();
+	}
+	if (!GetFileSizeEx(pHive->hFile, &liFileSize)) {
+		dwError = GetLastError();
+		CloseHiveFile(pHive);
+		return dwError;
+	}
+	if (qwOffset >= (QWORD)liFileSize.QuadPart) {
+		CloseHiveFile(pHive);
+		return ERROR_HANDLE_EOF;
+	}
+
+	// Without a length, map the base block to read the hive bins size
+	if (cbLength == 0) {
+		dwError = MapHiveRange(pHive, qwOffset, HIVE_BASE_BLOCK_SIZE);
+		if (dwError == ERROR_SUCCESS) {
+			cbLength = (QWORD)HIVE_BASE_BLOCK_SIZE + *(LPDWORD)(pHive->lpBase + REGF_HIVE_BINS_SIZE);
+			UnmapViewOfFile(pHive->lpView);
+			CloseHandle(pHive->hMapping);
+			pHive->lpView = NULL;
+			pHive->lpBase = NULL;
+			pHive->hMapping = NULL;
+		}
+		else {
+			CloseHiveFile(pHive);
+			return dwError;
+		}
+	}
+	if (cbLength > (QWORD)liFileSize.QuadPart - qwOffset) {
+		cbLength = (QWORD)liFileSize.QuadPart - qwOffset;
+	}
+
+	dwError = MapHiveRange(pHive, qwOffset, cbLength);
+	if (dwError == ERROR_SUCCESS) {
+		dwError = LoadHiveBaseBlock(pHive);
+	}
+	if (dwError != ERROR_SUCCESS) {
+		CloseHiveFile(pHive);
+		return dwError;
+	}
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Open a Registry hive from standard input
+// Redirected files are mapped, pipes are read once into memory.
+// offreg.dll cannot open a hive in memory, so OffHive stays NULL.
+//-----------------------------------------------------------------
+DWORD OpenHiveStdin(PHIVEFILE pHive)
+{
+	HANDLE hStdin;
+	LARGE_INTEGER liFileSize;
+	SIZE_T cbBuffer;
+	SIZE_T cbUsed;
+	DWORD cbRead;
+	DWORD dwError;
+
+	if (NULL == hHeap) {
+		hHeap = GetProcessHeap();
+	}
+	ZeroMemory(pHive, sizeof(HIVEFILE));
+
+	hStdin = GetStdHandle(STD_INPUT_HANDLE);
+	if (NULL == hStdin || hStdin == INVALID_HANDLE_VALUE) {
+		return ERROR_INVALID_HANDLE;
+	}
+
+	// A file redirected to stdin can be mapped like a named hive file
+	// (the handle belongs to the process, so it is not closed here)
+	if (GetFileType(hStdin) == FILE_TYPE_DISK && GetFileSizeEx(hStdin, &liFileSize)) {
+		pHive->hFile = hStdin;
+		dwError = MapHiveRange(pHive, 0, (QWORD)liFileSize.QuadPart);
+		pHive->hFile = NULL;
+		if (dwError == ERROR_SUCCESS) {
+			dwError = LoadHiveBaseBlock(pHive);
+		}
+		if (dwError != ERROR_SUCCESS) {
+			CloseHiveFile(pHive);
+		}
+		return dwError;
+	}
+
+	// Read a pipe to the end, growing the buffer as needed
+	cbBuffer = 4 * 1024 * 1024;
+	cbUsed = 0;
+	pHive->lpBuffer = MYALLOC(cbBuffer);
+	if (NULL == pHive->lpBuffer) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	for (;;) {
+		if (cbUsed == cbBuffer) {
+			LPBYTE lpBuffer;
+			if (cbBuffer > ((SIZE_T)-1) / 2) {
+				CloseHiveFile(pHive);
+				return ERROR_NOT_ENOUGH_MEMORY;
+			}
+			lpBuffer = MYREALLOC(pHive->lpBuffer, cbBuffer * 2);
+			if (NULL == lpBuffer) {
+				CloseHiveFile(pHive);
+				return ERROR_NOT_ENOUGH_MEMORY;
+			}
+			pHive->lpBuffer = lpBuffer;
+			cbBuffer *= 2;
+		}
+		if (!ReadFile(hStdin, pHive->lpBuffer + cbUsed,
+			(DWORD)min(cbBuffer - cbUsed, 0x40000000), &cbRead, NULL))
+		{
+			dwError = GetLastError();
+			if (dwError == ERROR_BROKEN_PIPE || dwError == ERROR_HANDLE_EOF) {
+				break;
+			}
+			CloseHiveFile(pHive);
+			return dwError;
+		}
+		if (cbRead == 0) {
+			break;
+		}
+		cbUsed += cbRead;
+	}
+
+	pHive->lpBase = pHive->lpBuffer;
+	pHive->cbFile = cbUsed;
+	dwError = LoadHiveBaseBlock(pHive);
+	if (dwError != ERROR_SUCCESS) {
+		CloseHiveFile(pHive);
+	}
+	return dwError;
+}
+
+//-----------------------------------------------------------------
+// Close the offreg.dll hive, unmap the view and close the file
+//-----------------------------------------------------------------
+VOID CloseHiveFile(PHIVEFILE pHive)
+{
+	if (NULL != pHive->OffHive) {
+		ORCloseHive(pHive->OffHive);
+		pHive->OffHive = NULL;
+	}
+	if (NULL != pHive->lpView) {
+		UnmapViewOfFile(pHive->lpView);
+		pHive->lpView = NULL;
+	}
+	if (NULL != pHive->lpBuffer) {
+		MYFREE(pHive->lpBuffer);
+		pHive->lpBuffer = NULL;
+	}
+	pHive->lpBase = NULL;
+	if (NULL != pHive->hMapping) {
+		CloseHandle(pHive->hMapping);
+		pHive->hMapping = NULL;
+	}
+	if (NULL != pHive->hFile) {
+		CloseHandle(pHive->hFile);
+		pHive->hFile = NULL;
+	}
+	if (NULL != pHive->lpszRootKeyName) {
+		MYFREE(pHive->lpszRootKeyName);
+		pHive->lpszRootKeyName = NULL;
+	}
+}
+
+// ----------------------------------------------------------------------
+// Map a read-only view of a byte range of pHive->hFile
+// Views must start on the allocation granularity, so the view may
+// start before qwOffset: lpBase always points at qwOffset itself
+// ----------------------------------------------------------------------
+DWORD MapHiveRange(PHIVEFILE pHive, QWORD qwOffset, QWORD cbLength)
+{
+	SYSTEM_INFO si;
+	QWORD qwViewOffset;
+	QWORD cbView;
+
+	if (cbLength < HIVE_BASE_BLOCK_SIZE) {
+		return ERROR_BADDB;
+	}
+
+	GetSystemInfo(&si);
+	qwViewOffset = qwOffset - (qwOffset % si.dwAllocationGranularity);
+	cbView = cbLength + (qwOffset - qwViewOffset);
+	if ((QWORD)(SIZE_T)cbView != cbView) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	pHive->hMapping = CreateFileMapping(pHive->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (NULL == pHive->hMapping) {
+		return GetLastError();
+	}
+	pHive->lpView = MapViewOfFile(pHive->hMapping, FILE_MAP_READ,
+		(DWORD)(qwViewOffset >> 32), (DWORD)qwViewOffset, (SIZE_T)cbView);
+	if (NULL == pHive->lpView) {
+		return GetLastError();
+	}
+
+	pHive->lpBase = (LPBYTE)pHive->lpView + (qwOffset - qwViewOffset);
+	pHive->cbFile = cbLength;
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Make the hive writable in memory (never on disk)
+// A mapped hive is mapped again as copy-on-write, so only the pages
+// that are written get a private copy. When the hive must grow past
+// the end of the file (cbFile), it is copied once to the heap.
+// ----------------------------------------------------------------------
+DWORD MakeHiveWritable(PHIVEFILE pHive, QWORD cbFile)
+{
+	LPVOID lpView;
+	LPBYTE lpBuffer;
+
+	if ((QWORD)(SIZE_T)cbFile != cbFile) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	// A hive read from a pipe is already a private heap copy
+	if (NULL != pHive->lpBuffer) {
+		if (cbFile > pHive->cbFile) {
+			lpBuffer = MYREALLOC(pHive->lpBuffer, (SIZE_T)cbFile);
+			if (NULL == lpBuffer) {
+				return ERROR_NOT_ENOUGH_MEMORY;
+			}
+			ZeroMemory(lpBuffer + pHive->cbFile, (SIZE_T)(cbFile - pHive->cbFile));
+			pHive->lpBuffer = lpBuffer;
+			pHive->lpBase = lpBuffer;
+			pHive->cbFile = cbFile;
+		}
+		return ERROR_SUCCESS;
+	}
+
+	// Only a view of a whole hive file can be mapped again
+	if (NULL == pHive->hMapping || pHive->lpBase != (LPBYTE)pHive->lpView) {
+		return ERROR_NOT_SUPPORTED;
+	}
+
+	if (cbFile <= pHive->cbFile) {
+		lpView = MapViewOfFile(pHive->hMapping, FILE_MAP_COPY, 0, 0, (SIZE_T)pHive->cbFile);
+		if (NULL == lpView) {
+			return GetLastError();
+		}
+		UnmapViewOfFile(pHive->lpView);
+		pHive->lpView = lpView;
+		pHive->lpBase = (LPBYTE)lpView;
+		return ERROR_SUCCESS;
+	}
+
+	lpBuffer = MYALLOC0((SIZE_T)cbFile);
+	if (NULL == lpBuffer) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	CopyMemory(lpBuffer, pHive->lpBase, (SIZE_T)pHive->cbFile);
+	UnmapViewOfFile(pHive->lpView);
+	pHive->lpView = NULL;
+	pHive->lpBuffer = lpBuffer;
+	pHive->lpBase = lpBuffer;
+	pHive->cbFile = cbFile;
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Rewrite the base block of a writable hive (see MakeHiveWritable)
+// Both sequence numbers and the hive bins size are set, the checksum
+// is updated and the base block and root key name are loaded again
+// ----------------------------------------------------------------------
+DWORD UpdateHiveBaseBlock(PHIVEFILE pHive, DWORD dwSequence, DWORD cbHiveBins)
+{
+	LPBYTE lpBaseBlock;
+
+	lpBaseBlock = pHive->lpBase;
+	*(LPDWORD)(lpBaseBlock + REGF_PRIMARY_SEQUENCE) = dwSequence;
+	*(LPDWORD)(lpBaseBlock + REGF_SECONDARY_SEQUENCE) = dwSequence;
+	*(LPDWORD)(lpBaseBlock + REGF_HIVE_BINS_SIZE) = cbHiveBins;
+	*(LPDWORD)(lpBaseBlock + REGF_CHECKSUM) = CalculateBaseBlockChecksum(lpBaseBlock);
+
+	if (NULL != pHive->lpszRootKeyName) {
+		MYFREE(pHive->lpszRootKeyName);
+		pHive->lpszRootKeyName = NULL;
+	}
+	return LoadHiveBaseBlock(pHive);
+}
+
+// ----------------------------------------------------------------------
+// Check the base block and fetch the root key name from the root cell
+// ----------------------------------------------------------------------
+DWORD LoadHiveBaseBlock(PHIVEFILE pHive)
+{
+	DWORD dwError;
+
+	// The hive must at least contain a base block and one hbin header
+	if (pHive->cbFile < HIVE_BASE_BLOCK_SIZE + HBIN_HEADER_SIZE) {
+		return ERROR_BADDB;
+	}
+	dwError = ValidateBaseBlock(pHive);
+	if (dwError == ERROR_SUCCESS) {
+		dwError = ResolveRootKeyName(pHive);
+	}
+	return dwError;
+}
+
+//-----------------------------------------------------------------
+// Return a pointer to the data of an allocated cell
+// The cell offset is relative to the start of the hive bins,
+// lpcbCell (optional) receives the size of the cell data
+//-----------------------------------------------------------------
+LPBYTE GetHiveCell(PHIVEFILE pHive, DWORD dwCellOffset, PDWORD lpcbCell)
+{
+	QWORD qwFileOffset;
+	LONG nCellSize;
+	DWORD cbCell;
+
+	qwFileOffset = (QWORD)HIVE_BASE_BLOCK_SIZE + dwCellOffset;
+	if (qwFileOffset + sizeof(LONG) > pHive->cbFile) {
+		return NULL;
+	}
+
+	// Allocated cells have a negative size (including the size field)
+	nCellSize = *(LONG *)(pHive->lpBase + qwFileOffset);
+	if (nCellSize >= 0) {
+		return NULL;
+	}
+	cbCell = 0 - (DWORD)nCellSize;
+	if (cbCell < sizeof(LONG) || qwFileOffset + cbCell > pHive->cbFile) {
+		return NULL;
+	}
+
+	if (NULL != lpcbCell) {
+		*lpcbCell = cbCell - sizeof(LONG);
+	}
+	return pHive->lpBase + qwFileOffset + sizeof(LONG);
+}
+
+// ----------------------------------------------------------------------
+// Calculate the base block checksum
+// XOR of the first 127 DWORDs, 0 and -1 are never used as a checksum
+// ----------------------------------------------------------------------
+DWORD CalculateBaseBlockChecksum(LPBYTE lpBaseBlock)
+{
+	DWORD dwChecksum;
+	DWORD i;
+
+	dwChecksum = 0;
+	for (i = 0; i < REGF_CHECKSUM; i += sizeof(DWORD)) {
+		dwChecksum ^= *(LPDWORD)(lpBaseBlock + i);
+	}
+
+	if (dwChecksum == 0xFFFFFFFF) {
+		dwChecksum = 0xFFFFFFFE;
+	}
+	else if (dwChecksum == 0) {
+		dwChecksum = 1;
+	}
+	return dwChecksum;
+}
+
+// ----------------------------------------------------------------------
+// Validate the base block (magic numbers, checksum, sequence numbers)
+// A checksum or sequence number mismatch is recorded, not fatal, as
+// offreg.dll may still be able to parse the hive
+// ----------------------------------------------------------------------
+DWORD ValidateBaseBlock(PHIVEFILE pHive)
+{
+	LPBYTE lpBaseBlock;
+
+	lpBaseBlock = pHive->lpBase;
+
+	// Get the Hive file magic number: "regf"
+	if (*(LPDWORD)lpBaseBlock != HIVE_REGF_SIGNATURE) {
+		return ERROR_BADDB;
+	}
+
+	// Get the first hbin magic number: "hbin"
+	if (*(LPDWORD)(lpBaseBlock + HIVE_BASE_BLOCK_SIZE) != HIVE_HBIN_SIGNATURE) {
+		return ERROR_BADDB;
+	}
+
+	pHive->dwPrimarySequence = *(LPDWORD)(lpBaseBlock + REGF_PRIMARY_SEQUENCE);
+	pHive->dwSecondarySequence = *(LPDWORD)(lpBaseBlock + REGF_SECONDARY_SEQUENCE);
+	pHive->dwMajorVersion = *(LPDWORD)(lpBaseBlock + REGF_MAJOR_VERSION);
+	pHive->dwMinorVersion = *(LPDWORD)(lpBaseBlock + REGF_MINOR_VERSION);
+	pHive->dwRootCellOffset = *(LPDWORD)(lpBaseBlock + REGF_ROOT_CELL);
+	pHive->cbHiveBins = *(LPDWORD)(lpBaseBlock + REGF_HIVE_BINS_SIZE);
+
+	pHive->bChecksumValid = (CalculateBaseBlockChecksum(lpBaseBlock) ==
+		*(LPDWORD)(lpBaseBlock + REGF_CHECKSUM));
+	pHive->bSequenceValid = (pHive->dwPrimarySequence == pHive->dwSecondarySequence);
+
+	// The root cell must be inside the hive bins
+	if (pHive->dwRootCellOffset >= pHive->cbHiveBins) {
+		return ERROR_REGISTRY_CORRUPT;
+	}
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Determine the Registry hive root key name
+// Read from the key node at the root cell offset in the base block
+// ----------------------------------------------------------------------
+DWORD ResolveRootKeyName(PHIVEFILE pHive)
+{
+	HIVEKEYNODE KeyNode;
+	DWORD cchName;
+
+	if (!ReadKeyNode(pHive, pHive->dwRootCellOffset, &KeyNode)) {
+		return ERROR_REGISTRY_CORRUPT;
+	}
+
+	// Key names are either ASCII (compressed) or UTF-16LE
+	cchName = KeyNode.cbName + 1;
+	pHive->lpszRootKeyName = MYALLOC0(cchName * sizeof(WCHAR));
+	if (NULL == pHive->lpszRootKeyName) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	CopyHiveName(KeyNode.lpName, KeyNode.cbName, KeyNode.wFlags & NK_KEY_COMP_NAME,
+		pHive->lpszRootKeyName, cchName);
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Hint that a range of the mapped hive will be read soon
+// Uses PrefetchVirtualMemory when available (Windows 8 and later),
+// on older systems this does nothing and normal paging is used
+//-----------------------------------------------------------------
+typedef BOOL(WINAPI *PFNPREFETCHVIRTUALMEMORY)(HANDLE, ULONG_PTR, PWIN32_MEMORY_RANGE_ENTRY, ULONG);
+
+VOID PrefetchHiveRange(PHIVEFILE pHive, QWORD qwFileOffset, QWORD cbRange)
+{
+	static PFNPREFETCHVIRTUALMEMORY pfnPrefetchVirtualMemory = NULL;
+	static BOOL bResolved = FALSE;
+	WIN32_MEMORY_RANGE_ENTRY Range;
+
+	if (!bResolved) {
+		pfnPrefetchVirtualMemory = (PFNPREFETCHVIRTUALMEMORY)GetProcAddress(
+			GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory");
+		bResolved = TRUE;
+	}
+	if (NULL == pfnPrefetchVirtualMemory || qwFileOffset >= pHive->cbFile) {
+		return;
+	}
+	if (cbRange > pHive->cbFile - qwFileOffset) {
+		cbRange = pHive->cbFile - qwFileOffset;
+	}
+
+	Range.VirtualAddress = pHive->lpBase + qwFileOffset;
+	Range.NumberOfBytes = (SIZE_T)cbRange;
+	pfnPrefetchVirtualMemory(GetCurrentProcess(), 1, &Range, 0);
+}
+
+//-----------------------------------------------------------------
+// Parse a key node (nk) cell
+//-----------------------------------------------------------------
+BOOL ParseKeyNode(LPBYTE lpCell, DWORD cbCell, DWORD dwCellOffset, PHIVEKEYNODE pKeyNode)
+{
+	if (cbCell < NK_NAME || *(LPWORD)lpCell != HIVE_NK_SIGNATURE) {
+		return FALSE;
+	}
+
+	pKeyNode->dwOffset = dwCellOffset;
+	pKeyNode->wFlags = *(LPWORD)(lpCell + NK_FLAGS);
+	pKeyNode->cbName = *(LPWORD)(lpCell + NK_NAME_LENGTH);
+	pKeyNode->ftLastWriteTime = *(PFILETIME)(lpCell + NK_LAST_WRITTEN);
+	pKeyNode->dwParent = *(LPDWORD)(lpCell + NK_PARENT);
+	pKeyNode->nSubkeys = *(LPDWORD)(lpCell + NK_SUBKEY_COUNT);
+	pKeyNode->dwSubkeyList = *(LPDWORD)(lpCell + NK_SUBKEY_LIST);
+	pKeyNode->nValues = *(LPDWORD)(lpCell + NK_VALUE_COUNT);
+	pKeyNode->dwValueList = *(LPDWORD)(lpCell + NK_VALUE_LIST);
+	pKeyNode->dwSecurity = *(LPDWORD)(lpCell + NK_SECURITY);
+	pKeyNode->lpName = lpCell + NK_NAME;
+
+	// The key name must fit inside the cell
+	return (pKeyNode->cbName <= cbCell - NK_NAME);
+}
+
+//-----------------------------------------------------------------
+// Parse a value key (vk) cell
+//-----------------------------------------------------------------
+BOOL ParseValueKey(LPBYTE lpCell, DWORD cbCell, DWORD dwCellOffset, PHIVEVALUEKEY pValueKey)
+{
+	if (cbCell < VK_NAME || *(LPWORD)lpCell != HIVE_VK_SIGNATURE) {
+		return FALSE;
+	}
+
+	pValueKey->dwOffset = dwCellOffset;
+	pValueKey->cbName = *(LPWORD)(lpCell + VK_NAME_LENGTH);
+	pValueKey->dwDataSize = *(LPDWORD)(lpCell + VK_DATA_SIZE);
+	pValueKey->dwDataOffset = *(LPDWORD)(lpCell + VK_DATA_OFFSET);
+	pValueKey->dwType = *(LPDWORD)(lpCell + VK_DATA_TYPE);
+	pValueKey->wFlags = *(LPWORD)(lpCell + VK_FLAGS);
+	pValueKey->lpCell = lpCell;
+	pValueKey->lpName = lpCell + VK_NAME;
+
+	// The value name must fit inside the cell
+	return (pValueKey->cbName <= cbCell - VK_NAME);
+}
+
+//-----------------------------------------------------------------
+// Read the key node (nk) cell at a cell offset
+//-----------------------------------------------------------------
+BOOL ReadKeyNode(PHIVEFILE pHive, DWORD dwCellOffset, PHIVEKEYNODE pKeyNode)
+{
+	LPBYTE lpCell;
+	DWORD cbCell;
+
+	lpCell = GetHiveCell(pHive, dwCellOffset, &cbCell);
+	if (NULL == lpCell) {
+		return FALSE;
+	}
+	return ParseKeyNode(lpCell, cbCell, dwCellOffset, pKeyNode);
+}
+
+//-----------------------------------------------------------------
+// Read the value key (vk) cell at a cell offset
+//-----------------------------------------------------------------
+BOOL ReadValueKey(PHIVEFILE pHive, DWORD dwCellOffset, PHIVEVALUEKEY pValueKey)
+{
+	LPBYTE lpCell;
+	DWORD cbCell;
+
+	lpCell = GetHiveCell(pHive, dwCellOffset, &cbCell);
+	if (NULL == lpCell) {
+		return FALSE;
+	}
+	return ParseValueKey(lpCell, cbCell, dwCellOffset, pValueKey);
+}
+
+//-----------------------------------------------------------------
+// Fetch the key node offsets from a subkey list
+// Handles lf, lh and li lists, and ri lists of those lists.
+// Offsets are returned in list order (the order offreg.dll uses),
+// the return value is the number of offsets stored in lpOffsets.
+// With a NULL lpOffsets the list entries are only counted.
+//-----------------------------------------------------------------
+DWORD GetSubkeyOffsets(PHIVEFILE pHive, DWORD dwListOffset, LPDWORD lpOffsets, DWORD nMaxOffsets)
+{
+	LPBYTE lpList;
+	DWORD cbList;
+	DWORD nElements;
+	DWORD nOffsets;
+	DWORD cbElement;
+	DWORD i;
+
+	lpList = GetHiveCell(pHive, dwListOffset, &cbList);
+	if (NULL == lpList || cbList < LIST_ELEMENTS) {
+		return 0;
+	}
+
+	nElements = *(LPWORD)(lpList + LIST_COUNT);
+	nOffsets = 0;
+	switch (*(LPWORD)lpList) {
+	case HIVE_LF_SIGNATURE:
+	case HIVE_LH_SIGNATURE:
+	case HIVE_LI_SIGNATURE:
+		// lf and lh elements are followed by a name hint or hash
+		cbElement = (*(LPWORD)lpList == HIVE_LI_SIGNATURE) ? sizeof(DWORD) : 2 * sizeof(DWORD);
+		for (i = 0; i < nElements && nOffsets < nMaxOffsets; i++) {
+			if (LIST_ELEMENTS + (i + 1) * cbElement > cbList) {
+				break;
+			}
+			if (NULL != lpOffsets) {
+				lpOffsets[nOffsets] = *(LPDWORD)(lpList + LIST_ELEMENTS + i * cbElement);
+			}
+			nOffsets++;
+		}
+		break;
+
+	case HIVE_RI_SIGNATURE:
+		// An index root only references leaf lists (never another ri)
+		for (i = 0; i < nElements && nOffsets < nMaxOffsets; i++) {
+			LPBYTE lpLeaf;
+			DWORD dwLeafOffset;
+			if (LIST_ELEMENTS + (i + 1) * sizeof(DWORD) > cbList) {
+				break;
+			}
+			dwLeafOffset = *(LPDWORD)(lpList + LIST_ELEMENTS + i * sizeof(DWORD));
+			lpLeaf = GetHiveCell(pHive, dwLeafOffset, NULL);
+			if (NULL == lpLeaf || *(LPWORD)lpLeaf == HIVE_RI_SIGNATURE) {
+				continue;
+			}
+			nOffsets += GetSubkeyOffsets(pHive, dwLeafOffset,
+				(NULL == lpOffsets) ? NULL : lpOffsets + nOffsets, nMaxOffsets - nOffsets);
+		}
+		break;
+	}
+	return nOffsets;
+}
+
+//-----------------------------------------------------------------
+// Return the value key offsets of a value list
+// The value list is a plain array of cell offsets, lpnValues is
+// lowered to the number of offsets that really fit in the list cell
+//-----------------------------------------------------------------
+LPDWORD GetValueList(PHIVEFILE pHive, DWORD dwListOffset, LPDWORD lpnValues)
+{
+	LPBYTE lpList;
+	DWORD cbList;
+
+	lpList = GetHiveCell(pHive, dwListOffset, &cbList);
+	if (NULL == lpList) {
+		*lpnValues = 0;
+		return NULL;
+	}
+	if (cbList / sizeof(DWORD) < *lpnValues) {
+		*lpnValues = cbList / sizeof(DWORD);
+	}
+	return (LPDWORD)lpList;
+}
+
+//-----------------------------------------------------------------
+// Return the data of a value key
+// Small data is stored in the value key itself, normal data in one
+// cell and big data (hive version 1.4+) in segments. Big data is
+// copied into a buffer, pbAllocated is set when it must be freed.
+//-----------------------------------------------------------------
+LPBYTE GetValueData(PHIVEFILE pHive, PHIVEVALUEKEY pValueKey, PDWORD lpcbData, PBOOL pbAllocated)
+{
+	LPBYTE lpCell;
+	DWORD cbCell;
+	DWORD cbData;
+
+	*pbAllocated = FALSE;
+	*lpcbData = 0;
+
+	// Data of 4 bytes or less is stored in the data offset field
+	if (pValueKey->dwDataSize & VK_DATA_INLINE) {
+		cbData = pValueKey->dwDataSize & ~VK_DATA_INLINE;
+		*lpcbData = (cbData > sizeof(DWORD)) ? sizeof(DWORD) : cbData;
+		return pValueKey->lpCell + VK_DATA_OFFSET;
+	}
+
+	cbData = pValueKey->dwDataSize;
+	if (cbData == 0) {
+		return NULL;
+	}
+	lpCell = GetHiveCell(pHive, pValueKey->dwDataOffset, &cbCell);
+	if (NULL == lpCell) {
+		return NULL;
+	}
+
+	// Assemble big data from its segments
+	if (cbData > DB_SEGMENT_SIZE && pHive->dwMinorVersion >= 4 &&
+		cbCell >= DB_SEGMENT_LIST + sizeof(DWORD) &&
+		*(LPWORD)lpCell == HIVE_DB_SIGNATURE)
+	{
+		LPDWORD lpSegments;
+		LPBYTE lpBuffer;
+		DWORD nSegments;
+		DWORD cbCopied;
+		DWORD i;
+
+		nSegments = *(LPWORD)(lpCell + DB_SEGMENT_COUNT);
+		lpSegments = GetValueList(pHive, *(LPDWORD)(lpCell + DB_SEGMENT_LIST), &nSegments);
+		if (NULL == lpSegments) {
+			return NULL;
+		}
+		lpBuffer = MYALLOC0(cbData);
+		if (NULL == lpBuffer) {
+			return NULL;
+		}
+		cbCopied = 0;
+		for (i = 0; i < nSegments && cbCopied < cbData; i++) {
+			LPBYTE lpSegment;
+			DWORD cbSegment;
+			lpSegment = GetHiveCell(pHive, lpSegments[i], &cbSegment);
+			if (NULL == lpSegment) {
+				break;
+			}
+			cbSegment = min(cbSegment, DB_SEGMENT_SIZE);
+			cbSegment = min(cbSegment, cbData - cbCopied);
+			memcpy(lpBuffer + cbCopied, lpSegment, cbSegment);
+			cbCopied += cbSegment;
+		}
+		*pbAllocated = TRUE;
+		*lpcbData = cbCopied;
+		return lpBuffer;
+	}
+
+	// Normal data, never read past the end of the cell
+	*lpcbData = (cbData > cbCell) ? cbCell : cbData;
+	return lpCell;
+}
+
+//-----------------------------------------------------------------
+// Return the security descriptor of a key security (sk) cell
+// Many keys share one sk cell, the descriptor is self-relative and
+// stays in the mapped hive
+//-----------------------------------------------------------------
+LPBYTE GetSecurityDescriptor(PHIVEFILE pHive, DWORD dwSecurityOffset, PDWORD lpcbDescriptor)
+{
+	LPBYTE lpCell;
+	DWORD cbCell;
+	DWORD cbDescriptor;
+
+	lpCell = GetHiveCell(pHive, dwSecurityOffset, &cbCell);
+	if (NULL == lpCell || cbCell < SK_DESCRIPTOR || *(LPWORD)lpCell != HIVE_SK_SIGNATURE) {
+		return NULL;
+	}
+	cbDescriptor = *(LPDWORD)(lpCell + SK_DESCRIPTOR_SIZE);
+	if (cbDescriptor == 0 || cbDescriptor > cbCell - SK_DESCRIPTOR) {
+		return NULL;
+	}
+	*lpcbDescriptor = cbDescriptor;
+	return lpCell + SK_DESCRIPTOR;
+}
+
+//-----------------------------------------------------------------
+// Copy a key or value name to a NULL terminated wide string
+// Compressed names are stored as one byte per character
+// Returns the number of characters copied (without the NULL)
+//-----------------------------------------------------------------
+DWORD CopyHiveName(LPBYTE lpName, WORD cbName, BOOL bCompressed, LPWSTR szBuffer, DWORD cchBuffer)
+{
+	DWORD cchName;
+	DWORD i;
+
+	if (cchBuffer == 0) {
+		return 0;
+	}
+	cchName = bCompressed ? cbName : cbName / sizeof(WCHAR);
+	if (cchName > cchBuffer - 1) {
+		cchName = cchBuffer - 1;
+	}
+
+	if (bCompressed) {
+		for (i = 0; i < cchName; i++) {
+			szBuffer[i] = (WCHAR)lpName[i];
+		}
+	}
+	else {
+		memcpy(szBuffer, lpName, cchName * sizeof(WCHAR));
+	}
+	szBuffer[cchName] = L'\0';
+	return cchName;
+}
+
+//-----------------------------------------------------------------
+// Find the key cell of a subkey enumerated by offreg.dll
+// offreg.dll enumerates subkeys in list order, so the cell is the
+// same entry of the subkey list, checked against the key name.
+// Returns HIVE_NO_CELL if the list entry is not the named key.
+//-----------------------------------------------------------------
+DWORD MatchSubkeyCell(PHIVEFILE pHive, LPDWORD lpSubkeys, DWORD nSubkeys, DWORD iSubkey, LPCWSTR szName, DWORD cchName)
+{
+	HIVEKEYNODE Subkey;
+	WCHAR szCellName[MAX_KEY_NAME + 1];
+
+	if (NULL == lpSubkeys || iSubkey >= nSubkeys || !ReadKeyNode(pHive, lpSubkeys[iSubkey], &Subkey)) {
+		return HIVE_NO_CELL;
+	}
+	if (CopyHiveName(Subkey.lpName, Subkey.cbName, Subkey.wFlags & NK_KEY_COMP_NAME,
+		szCellName, MAX_KEY_NAME + 1) != cchName ||
+		_wcsnicmp(szCellName, szName, cchName) != 0)
+	{
+		return HIVE_NO_CELL;
+	}
+	return lpSubkeys[iSubkey];
+}
+
+//-----------------------------------------------------------------
+// Prepare a walk guard for a hive
+// The bitmap has one bit for every 8 byte aligned cell offset in
+// the hive bins, a qwMaxWork of 0 means the walk is not limited
+//-----------------------------------------------------------------
+DWORD InitWalkGuard(PHIVEFILE pHive, QWORD qwMaxWork, PHIVEWALKGUARD pGuard)
+{
+	QWORD cbHiveBins;
+
+	ZeroMemory(pGuard, sizeof(HIVEWALKGUARD));
+	cbHiveBins = min((QWORD)pHive->cbHiveBins, pHive->cbFile - HIVE_BASE_BLOCK_SIZE);
+	pGuard->cbVisited = (DWORD)(cbHiveBins / (8 * CELL_ALIGNMENT)) + 1;
+	pGuard->lpVisited = MYALLOC0(pGuard->cbVisited);
+	if (NULL == pGuard->lpVisited) {
+		pGuard->cbVisited = 0;
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	pGuard->qwMaxWork = qwMaxWork;
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Mark a key cell as visited
+// Returns FALSE if the key was already visited (a cycle or a key
+// listed twice) or the offset is not a cell in the hive bins
+//-----------------------------------------------------------------
+BOOL MarkKeyVisited(PHIVEWALKGUARD pGuard, DWORD dwCellOffset)
+{
+	DWORD iSlot;
+	BYTE bMask;
+
+	iSlot = dwCellOffset / CELL_ALIGNMENT;
+	bMask = (BYTE)(1 << (iSlot % 8));
+	if (dwCellOffset % CELL_ALIGNMENT != 0 || iSlot / 8 >= pGuard->cbVisited ||
+		(pGuard->lpVisited[iSlot / 8] & bMask))
+	{
+		pGuard->nRevisitedKeys++;
+		return FALSE;
+	}
+	pGuard->lpVisited[iSlot / 8] |= bMask;
+	return TRUE;
+}
+
+//-----------------------------------------------------------------
+// Charge one unit of work (a key, a value or a list entry)
+// Returns FALSE once the work budget is used up
+//-----------------------------------------------------------------
+BOOL ChargeWalkWork(PHIVEWALKGUARD pGuard)
+{
+	pGuard->qwWork++;
+	if (pGuard->qwMaxWork > 0 && pGuard->qwWork > pGuard->qwMaxWork) {
+		pGuard->bExhausted = TRUE;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+//-----------------------------------------------------------------
+// Free the visited key bitmap of a walk guard
+//-----------------------------------------------------------------
+VOID FreeWalkGuard(PHIVEWALKGUARD pGuard)
+{
+	if (NULL != pGuard->lpVisited) {
+		MYFREE(pGuard->lpVisited);
+	}
+	ZeroMemory(pGuard, sizeof(HIVEWALKGUARD));
+}
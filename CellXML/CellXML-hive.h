@@ -0,0 +1,207 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#ifndef __CELLXML_HIVE_H__
+#define __CELLXML_HIVE_H__
+
+#include "CellXML.h"
+
+// ----------------------------------------------------------------------
+// Registry hive file structure definitions
+// All offsets are in bytes, hive bins offsets are relative to the
+// first hbin (which starts directly after the base block)
+// ----------------------------------------------------------------------
+#define HIVE_BASE_BLOCK_SIZE	4096		// Size of the regf base block
+#define HIVE_REGF_SIGNATURE		0x66676572	// "regf"
+#define HIVE_HBIN_SIGNATURE		0x6E696268	// "hbin"
+#define HIVE_NK_SIGNATURE		0x6B6E		// "nk"
+#define HIVE_VK_SIGNATURE		0x6B76		// "vk"
+#define HIVE_LF_SIGNATURE		0x666C		// "lf" (subkey list with name hints)
+#define HIVE_LH_SIGNATURE		0x686C		// "lh" (subkey list with name hashes)
+#define HIVE_LI_SIGNATURE		0x696C		// "li" (subkey list)
+#define HIVE_RI_SIGNATURE		0x6972		// "ri" (list of subkey lists)
+#define HIVE_DB_SIGNATURE		0x6264		// "db" (big data)
+#define HIVE_SK_SIGNATURE		0x6B73		// "sk" (key security)
+
+#define REGF_PRIMARY_SEQUENCE	0x04		// Primary sequence number
+#define REGF_SECONDARY_SEQUENCE	0x08		// Secondary sequence number
+#define REGF_LAST_WRITTEN		0x0C		// Last written timestamp (FILETIME)
+#define REGF_MAJOR_VERSION		0x14		// Hive format major version
+#define REGF_MINOR_VERSION		0x18		// Hive format minor version
+#define REGF_ROOT_CELL			0x24		// Root key cell offset
+#define REGF_HIVE_BINS_SIZE		0x28		// Total size of all hive bins
+#define REGF_CHECKSUM			0x1FC		// XOR checksum of the first 508 bytes
+
+#define HBIN_SIZE				0x08		// Size of the hive bin (in bytes)
+#define HBIN_HEADER_SIZE		0x20		// Cells start after the hbin header
+
+#define NK_FLAGS				0x02		// Key node flags
+#define NK_LAST_WRITTEN			0x04		// Last written timestamp (FILETIME)
+#define NK_PARENT				0x10		// Parent key cell offset
+#define NK_SUBKEY_COUNT			0x14		// Number of (stable) subkeys
+#define NK_SUBKEY_LIST			0x1C		// Subkey list cell offset
+#define NK_VALUE_COUNT			0x24		// Number of values
+#define NK_VALUE_LIST			0x28		// Value list cell offset
+#define NK_SECURITY				0x2C		// Key security (sk) cell offset
+#define NK_NAME_LENGTH			0x48		// Key name length (in bytes)
+#define NK_NAME					0x4C		// Key name string
+#define NK_KEY_COMP_NAME		0x0020		// Key name is stored as ASCII
+
+#define VK_NAME_LENGTH			0x02		// Value name length (in bytes)
+#define VK_DATA_SIZE			0x04		// Value data size (in bytes)
+#define VK_DATA_OFFSET			0x08		// Value data cell offset (or inline data)
+#define VK_DATA_TYPE			0x0C		// Value data type
+#define VK_FLAGS				0x10		// Value flags
+#define VK_NAME					0x14		// Value name string
+#define VK_VALUE_COMP_NAME		0x0001		// Value name is stored as ASCII
+#define VK_DATA_INLINE			0x80000000	// Data (4 bytes or less) is stored in VK_DATA_OFFSET
+
+#define LIST_COUNT				0x02		// Number of elements in a subkey list
+#define LIST_ELEMENTS			0x04		// First element of a subkey list
+#define DB_SEGMENT_COUNT		0x02		// Number of big data segments
+#define DB_SEGMENT_LIST			0x04		// Big data segment list cell offset
+#define DB_SEGMENT_SIZE			16344		// Maximum data in one big data segment
+
+#define SK_REFERENCE_COUNT		0x0C		// Number of key nodes using the sk cell
+#define SK_DESCRIPTOR_SIZE		0x10		// Security descriptor size (in bytes)
+#define SK_DESCRIPTOR			0x14		// Self-relative security descriptor
+
+#define MAX_KEY_DEPTH			512			// Maximum depth of the Registry key tree
+#define CELL_ALIGNMENT			8			// Cells start on 8 byte boundaries
+#define HIVE_NO_CELL			0xFFFFFFFF	// Cell offset is unknown (or not used)
+
+// ----------------------------------------------------------------------
+// An opened Registry hive file
+// The file is opened and mapped once, the base block is validated,
+// and the same file handle is given to offreg.dll for enumeration.
+// Hives read from stdin or from inside a disk image are only available
+// in memory (OffHive is NULL) and are enumerated from the cells.
+// ----------------------------------------------------------------------
+typedef struct _HIVEFILE {
+	HANDLE	hFile;					// Handle to the hive (or disk image) file
+	HANDLE	hMapping;				// File mapping object for the hive file
+	LPVOID	lpView;					// Mapped view (may start before lpBase)
+	LPBYTE	lpBuffer;				// Heap copy of a hive read from a pipe
+	LPBYTE	lpBase;					// Start of the hive (base block)
+	QWORD	cbFile;					// Size of the hive (in bytes)
+	DWORD	dwPrimarySequence;		// Base block primary sequence number
+	DWORD	dwSecondarySequence;	// Base block secondary sequence number
+	DWORD	dwMajorVersion;			// Hive format major version
+	DWORD	dwMinorVersion;			// Hive format minor version
+	DWORD	dwRootCellOffset;		// Offset of the root key cell
+	DWORD	cbHiveBins;				// Size of hive bins data (in bytes)
+	BOOL	bChecksumValid;			// Base block checksum matched
+	BOOL	bSequenceValid;			// Primary and secondary sequence numbers matched
+	LPWSTR	lpszRootKeyName;		// Root key name resolved from the root cell
+	ORHKEY	OffHive;				// offreg.dll handle to the hive root key
+} HIVEFILE, *PHIVEFILE;
+
+// ----------------------------------------------------------------------
+// A key node (nk) cell read directly from the mapped hive
+// ----------------------------------------------------------------------
+typedef struct _HIVEKEYNODE {
+	DWORD	dwOffset;				// Cell offset of the key node
+	WORD	wFlags;					// Key node flags
+	WORD	cbName;					// Key name length (in bytes)
+	FILETIME ftLastWriteTime;		// Key last write time
+	DWORD	dwParent;				// Parent key cell offset
+	DWORD	nSubkeys;				// Number of subkeys
+	DWORD	dwSubkeyList;			// Subkey list cell offset
+	DWORD	nValues;				// Number of values
+	DWORD	dwValueList;			// Value list cell offset
+	DWORD	dwSecurity;				// Key security cell offset
+	LPBYTE	lpName;					// Key name (in the mapped hive)
+} HIVEKEYNODE, *PHIVEKEYNODE;
+
+// ----------------------------------------------------------------------
+// A value key (vk) cell read directly from the mapped hive
+// ----------------------------------------------------------------------
+typedef struct _HIVEVALUEKEY {
+	DWORD	dwOffset;				// Cell offset of the value key
+	WORD	wFlags;					// Value flags
+	WORD	cbName;					// Value name length (in bytes)
+	DWORD	dwType;					// Value data type
+	DWORD	dwDataSize;				// Value data size (including VK_DATA_INLINE)
+	DWORD	dwDataOffset;			// Value data cell offset
+	LPBYTE	lpCell;					// Value key cell (in the mapped hive)
+	LPBYTE	lpName;					// Value name (in the mapped hive)
+} HIVEVALUEKEY, *PHIVEVALUEKEY;
+
+// ----------------------------------------------------------------------
+// Guard against corrupt or malicious hives during a walk
+// Key cells are marked in a bitmap, so a subkey list pointing back at
+// an ancestor (or at a key already seen) is never followed twice.
+// Every key, value and list entry costs one unit of work, and a walk
+// is abandoned once its work budget is used up.
+// ----------------------------------------------------------------------
+typedef struct _HIVEWALKGUARD {
+	LPBYTE	lpVisited;				// Visited key cells (one bit per cell slot)
+	DWORD	cbVisited;				// Size of lpVisited (in bytes)
+	DWORD	nRevisitedKeys;			// Keys skipped because they were already visited
+	QWORD	qwWork;					// Work done so far
+	QWORD	qwMaxWork;				// Work budget (0 = unlimited)
+	BOOL	bExhausted;				// The work budget is used up
+} HIVEWALKGUARD, *PHIVEWALKGUARD;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ----------------------------------------------------------------------
+// CellXML hive file functions
+// ----------------------------------------------------------------------
+DWORD OpenHiveFile(LPCWSTR lpszHiveFileName, PHIVEFILE pHive);
+DWORD OpenHiveImage(LPCWSTR lpszImageFileName, QWORD qwOffset, QWORD cbLength, PHIVEFILE pHive);
+DWORD OpenHiveStdin(PHIVEFILE pHive);
+VOID CloseHiveFile(PHIVEFILE pHive);
+LPBYTE GetHiveCell(PHIVEFILE pHive, DWORD dwCellOffset, PDWORD lpcbCell);
+VOID PrefetchHiveRange(PHIVEFILE pHive, QWORD qwFileOffset, QWORD cbRange);
+DWORD MakeHiveWritable(PHIVEFILE pHive, QWORD cbFile);
+DWORD UpdateHiveBaseBlock(PHIVEFILE pHive, DWORD dwSequence, DWORD cbHiveBins);
+
+// ----------------------------------------------------------------------
+// CellXML hive cell functions
+// ----------------------------------------------------------------------
+BOOL ParseKeyNode(LPBYTE lpCell, DWORD cbCell, DWORD dwCellOffset, PHIVEKEYNODE pKeyNode);
+BOOL ParseValueKey(LPBYTE lpCell, DWORD cbCell, DWORD dwCellOffset, PHIVEVALUEKEY pValueKey);
+BOOL ReadKeyNode(PHIVEFILE pHive, DWORD dwCellOffset, PHIVEKEYNODE pKeyNode);
+BOOL ReadValueKey(PHIVEFILE pHive, DWORD dwCellOffset, PHIVEVALUEKEY pValueKey);
+DWORD GetSubkeyOffsets(PHIVEFILE pHive, DWORD dwListOffset, LPDWORD lpOffsets, DWORD nMaxOffsets);
+LPDWORD GetValueList(PHIVEFILE pHive, DWORD dwListOffset, LPDWORD lpnValues);
+LPBYTE GetValueData(PHIVEFILE pHive, PHIVEVALUEKEY pValueKey, PDWORD lpcbData, PBOOL pbAllocated);
+LPBYTE GetSecurityDescriptor(PHIVEFILE pHive, DWORD dwSecurityOffset, PDWORD lpcbDescriptor);
+DWORD CopyHiveName(LPBYTE lpName, WORD cbName, BOOL bCompressed, LPWSTR szBuffer, DWORD cchBuffer);
+
+// ----------------------------------------------------------------------
+// CellXML walk guard functions
+// ----------------------------------------------------------------------
+DWORD MatchSubkeyCell(PHIVEFILE pHive, LPDWORD lpSubkeys, DWORD nSubkeys, DWORD iSubkey, LPCWSTR szName, DWORD cchName);
+DWORD InitWalkGuard(PHIVEFILE pHive, QWORD qwMaxWork, PHIVEWALKGUARD pGuard);
+BOOL MarkKeyVisited(PHIVEWALKGUARD pGuard, DWORD dwCellOffset);
+BOOL ChargeWalkWork(PHIVEWALKGUARD pGuard);
+VOID FreeWalkGuard(PHIVEWALKGUARD pGuard);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __CELLXML_HIVE_H__
@@ -0,0 +1,422 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <wctype.h>
+#include "CellXML-ioc.h"
+
+// ----------------------------------------------------------------------
+// CellXML IOC matcher internal functions
+// ----------------------------------------------------------------------
+DWORD ReadIocFile(LPCWSTR lpszIocFileName, LPWSTR *lpszText, size_t *lpcchText);
+DWORD SplitIndicators(PIOCMATCHER pMatcher, LPWSTR lpszText, size_t cchText);
+DWORD BuildIocAutomaton(PIOCMATCHER pMatcher);
+
+//-----------------------------------------------------------------
+// Load an indicator file and compile it to an automaton
+// The file holds one indicator per line (UTF-8 or UTF-16LE with BOM),
+// empty lines and lines starting with '#' are ignored.
+// Indicators are matched case insensitively as substrings.
+//-----------------------------------------------------------------
+DWORD LoadIocMatcher(LPCWSTR lpszIocFileName, PIOCMATCHER pMatcher)
+{
+	LPWSTR lpszText;
+	size_t cchText;
+	DWORD dwError;
+
+	ZeroMemory(pMatcher, sizeof(IOCMATCHER));
+
+	dwError = ReadIocFile(lpszIocFileName, &lpszText, &cchText);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+
+	dwError = SplitIndicators(pMatcher, lpszText, cchText);
+	MYFREE(lpszText);
+	if (dwError == ERROR_SUCCESS && pMatcher->nIndicators == 0) {
+		dwError = ERROR_INVALID_DATA;
+	}
+
+	if (dwError == ERROR_SUCCESS) {
+		dwError = BuildIocAutomaton(pMatcher);
+	}
+	if (dwError != ERROR_SUCCESS) {
+		FreeIocMatcher(pMatcher);
+	}
+	return dwError;
+}
+
+//-----------------------------------------------------------------
+// Free all memory used by an IOC matcher
+//-----------------------------------------------------------------
+VOID FreeIocMatcher(PIOCMATCHER pMatcher)
+{
+	DWORD i;
+
+	if (NULL != pMatcher->lpszIndicators) {
+		for (i = 0; i < pMatcher->nIndicators; i++) {
+			MYFREE(pMatcher->lpszIndicators[i]);
+		}
+		MYFREE(pMatcher->lpszIndicators);
+	}
+	if (NULL != pMatcher->lpCharClass) {
+		MYFREE(pMatcher->lpCharClass);
+	}
+	if (NULL != pMatcher->lpTransitions) {
+		MYFREE(pMatcher->lpTransitions);
+	}
+	if (NULL != pMatcher->lpOutput) {
+		MYFREE(pMatcher->lpOutput);
+	}
+	ZeroMemory(pMatcher, sizeof(IOCMATCHER));
+}
+
+//-----------------------------------------------------------------
+// Continue a scan with more text
+// One table lookup per character, no formatting or allocation.
+// The first match is sticky: once found, further text is not scanned.
+//-----------------------------------------------------------------
+IOCSTATE ScanIocMatcher(PIOCMATCHER pMatcher, IOCSTATE State, LPCWSTR lpszText, size_t cchText)
+{
+	LPDWORD lpTransitions;
+	LPWORD lpCharClass;
+	LONG *lpOutput;
+	SIZE_T nClasses;
+	DWORD dwState;
+	size_t i;
+
+	if (State.nMatch != IOC_NO_MATCH) {
+		return State;
+	}
+
+	lpTransitions = pMatcher->lpTransitions;
+	lpCharClass = pMatcher->lpCharClass;
+	lpOutput = pMatcher->lpOutput;
+	nClasses = pMatcher->nClasses;
+	dwState = State.dwState;
+
+	for (i = 0; i < cchText; i++) {
+		dwState = lpTransitions[dwState * nClasses + lpCharClass[(WORD)lpszText[i]]];
+		if (lpOutput[dwState] != IOC_NO_MATCH) {
+			State.nMatch = lpOutput[dwState];
+			break;
+		}
+	}
+
+	State.dwState = dwState;
+	return State;
+}
+
+// ----------------------------------------------------------------------
+// Read the indicator file and convert it to a wide string
+// ----------------------------------------------------------------------
+DWORD ReadIocFile(LPCWSTR lpszIocFileName, LPWSTR *lpszText, size_t *lpcchText)
+{
+	HANDLE hFile;
+	LARGE_INTEGER liFileSize;
+	LPBYTE lpBuffer;
+	DWORD cbBuffer;
+	DWORD cbRead;
+	DWORD dwError;
+	int cchText;
+
+	*lpszText = NULL;
+	*lpcchText = 0;
+
+	hFile = CreateFile(lpszIocFileName,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		return GetLastError();
+	}
+	if (!GetFileSizeEx(hFile, &liFileSize)) {
+		dwError = GetLastError();
+		CloseHandle(hFile);
+		return dwError;
+	}
+	if (liFileSize.QuadPart > 0x7FFFFFF0) {
+		CloseHandle(hFile);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	cbBuffer = (DWORD)liFileSize.QuadPart;
+	lpBuffer = MYALLOC0(cbBuffer + sizeof(WCHAR));
+	if (NULL == lpBuffer) {
+		CloseHandle(hFile);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	if (!ReadFile(hFile, lpBuffer, cbBuffer, &cbRead, NULL) || cbRead != cbBuffer) {
+		dwError = GetLastError();
+		MYFREE(lpBuffer);
+		CloseHandle(hFile);
+		return (dwError != ERROR_SUCCESS) ? dwError : ERROR_HANDLE_EOF;
+	}
+	CloseHandle(hFile);
+
+	// UTF-16LE (with BOM) is used as is, anything else is read as UTF-8
+	if (cbBuffer >= 2 && lpBuffer[0] == 0xFF && lpBuffer[1] == 0xFE) {
+		*lpcchText = (cbBuffer - 2) / sizeof(WCHAR);
+		*lpszText = MYALLOC0((*lpcchText + 1) * sizeof(WCHAR));
+		if (NULL == *lpszText) {
+			MYFREE(lpBuffer);
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+		memcpy(*lpszText, lpBuffer + 2, *lpcchText * sizeof(WCHAR));
+		MYFREE(lpBuffer);
+		return ERROR_SUCCESS;
+	}
+
+	if (cbBuffer >= 3 && lpBuffer[0] == 0xEF && lpBuffer[1] == 0xBB && lpBuffer[2] == 0xBF) {
+		memmove(lpBuffer, lpBuffer + 3, cbBuffer - 3);
+		cbBuffer -= 3;
+	}
+	cchText = 0;
+	if (cbBuffer > 0) {
+		cchText = MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)lpBuffer, cbBuffer, NULL, 0);
+		if (cchText == 0) {
+			MYFREE(lpBuffer);
+			return ERROR_INVALID_DATA;
+		}
+	}
+	*lpszText = MYALLOC0((cchText + 1) * sizeof(WCHAR));
+	if (NULL == *lpszText) {
+		MYFREE(lpBuffer);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	if (cbBuffer > 0) {
+		MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)lpBuffer, cbBuffer, *lpszText, cchText);
+	}
+	*lpcchText = cchText;
+	MYFREE(lpBuffer);
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Split the indicator file text into trimmed indicator strings
+// ----------------------------------------------------------------------
+DWORD SplitIndicators(PIOCMATCHER pMatcher, LPWSTR lpszText, size_t cchText)
+{
+	size_t nLines;
+	size_t iStart;
+	size_t iEnd;
+	size_t i;
+
+	// Count lines to size the indicator array
+	nLines = 1;
+	for (i = 0; i < cchText; i++) {
+		if (lpszText[i] == L'\n') {
+			nLines++;
+		}
+	}
+	pMatcher->lpszIndicators = MYALLOC0(nLines * sizeof(LPWSTR));
+	if (NULL == pMatcher->lpszIndicators) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	iStart = 0;
+	while (iStart < cchText) {
+		// Find the end of the line
+		iEnd = iStart;
+		while (iEnd < cchText && lpszText[iEnd] != L'\n') {
+			iEnd++;
+		}
+		i = iEnd;
+
+		// Trim surrounding white space (including a trailing '\r')
+		while (iStart < iEnd && iswspace(lpszText[iStart])) {
+			iStart++;
+		}
+		while (iEnd > iStart && iswspace(lpszText[iEnd - 1])) {
+			iEnd--;
+		}
+
+		// Keep non-empty lines that are not comments
+		if (iEnd > iStart && lpszText[iStart] != L'#') {
+			LPWSTR lpszIndicator;
+			lpszIndicator = MYALLOC0((iEnd - iStart + 1) * sizeof(WCHAR));
+			if (NULL == lpszIndicator) {
+				return ERROR_NOT_ENOUGH_MEMORY;
+			}
+			memcpy(lpszIndicator, lpszText + iStart, (iEnd - iStart) * sizeof(WCHAR));
+			pMatcher->lpszIndicators[pMatcher->nIndicators++] = lpszIndicator;
+		}
+		iStart = i + 1;
+	}
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Compile the indicators to a DFA
+// Build the trie, then complete every state's transitions in breadth
+// first order using the failure links (standard Aho-Corasick)
+// ----------------------------------------------------------------------
+DWORD BuildIocAutomaton(PIOCMATCHER pMatcher)
+{
+	LPWSTR lpFold;
+	LPWSTR lpLower;
+	LPWORD lpFoldedClass;
+	LPDWORD lpTransitions;
+	LPDWORD lpFail;
+	LPDWORD lpQueue;
+	LONG *lpOutput;
+	SIZE_T nClasses;
+	SIZE_T nStatesMax;
+	DWORD nStates;
+	DWORD dwState;
+	DWORD dwNext;
+	DWORD iHead;
+	DWORD iTail;
+	DWORD i;
+	SIZE_T c;
+	LPWSTR lpszIndicator;
+
+	// Lower case every UTF-16 code unit as Windows does (towlower only
+	// folds ASCII letters in the "C" locale of the C runtime)
+	lpFold = MYALLOC(2 * 0x10000 * sizeof(WCHAR));
+	if (NULL == lpFold) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	lpLower = lpFold + 0x10000;
+	for (c = 0; c < 0x10000; c++) {
+		lpFold[c] = (WCHAR)c;
+	}
+	if (LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_LOWERCASE, lpFold, 0x10000, lpLower, 0x10000, NULL, NULL, 0) != 0x10000) {
+		MYFREE(lpFold);
+		return GetLastError();
+	}
+
+	// Give each case folded character used by an indicator its own class
+	lpFoldedClass = MYALLOC0(0x10000 * sizeof(WORD));
+	if (NULL == lpFoldedClass) {
+		MYFREE(lpFold);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	nClasses = 1;
+	nStatesMax = 1;
+	for (i = 0; i < pMatcher->nIndicators; i++) {
+		for (lpszIndicator = pMatcher->lpszIndicators[i]; *lpszIndicator; lpszIndicator++) {
+			WORD wFolded = (WORD)lpLower[*lpszIndicator];
+			if (lpFoldedClass[wFolded] == 0) {
+				if (nClasses == 0xFFFF) {
+					MYFREE(lpFoldedClass);
+					MYFREE(lpFold);
+					return ERROR_INVALID_DATA;
+				}
+				lpFoldedClass[wFolded] = (WORD)nClasses++;
+			}
+			nStatesMax++;
+		}
+	}
+
+	pMatcher->lpCharClass = MYALLOC(0x10000 * sizeof(WORD));
+	if (NULL == pMatcher->lpCharClass) {
+		MYFREE(lpFoldedClass);
+		MYFREE(lpFold);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	for (c = 0; c < 0x10000; c++) {
+		pMatcher->lpCharClass[c] = lpFoldedClass[(WORD)lpLower[c]];
+	}
+	MYFREE(lpFold);
+	MYFREE(lpFoldedClass);
+	pMatcher->nClasses = (DWORD)nClasses;
+
+	// Allocate the worst case number of states (one per indicator character)
+	if (nStatesMax > ((SIZE_T)-1) / sizeof(DWORD) / nClasses) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	lpTransitions = MYALLOC0(nStatesMax * nClasses * sizeof(DWORD));
+	lpOutput = MYALLOC(nStatesMax * sizeof(LONG));
+	lpFail = MYALLOC0(nStatesMax * sizeof(DWORD));
+	lpQueue = MYALLOC(nStatesMax * sizeof(DWORD));
+	pMatcher->lpTransitions = lpTransitions;
+	pMatcher->lpOutput = lpOutput;
+	if (NULL == lpTransitions || NULL == lpOutput || NULL == lpFail || NULL == lpQueue) {
+		if (NULL != lpFail) {
+			MYFREE(lpFail);
+		}
+		if (NULL != lpQueue) {
+			MYFREE(lpQueue);
+		}
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	for (c = 0; c < nStatesMax; c++) {
+		lpOutput[c] = IOC_NO_MATCH;
+	}
+
+	// Insert every indicator into the trie
+	// A transition of 0 means "no edge" as no edge leads back to the root
+	nStates = 1;
+	for (i = 0; i < pMatcher->nIndicators; i++) {
+		dwState = IOC_ROOT_STATE;
+		for (lpszIndicator = pMatcher->lpszIndicators[i]; *lpszIndicator; lpszIndicator++) {
+			c = pMatcher->lpCharClass[(WORD)*lpszIndicator];
+			dwNext = lpTransitions[dwState * nClasses + c];
+			if (dwNext == 0) {
+				dwNext = nStates++;
+				lpTransitions[dwState * nClasses + c] = dwNext;
+			}
+			dwState = dwNext;
+		}
+		if (lpOutput[dwState] == IOC_NO_MATCH) {
+			lpOutput[dwState] = (LONG)i;
+		}
+	}
+	pMatcher->nStates = nStates;
+
+	// Breadth first: root children fail back to the root
+	iHead = 0;
+	iTail = 0;
+	for (c = 0; c < nClasses; c++) {
+		dwNext = lpTransitions[c];
+		if (dwNext != 0) {
+			lpFail[dwNext] = IOC_ROOT_STATE;
+			lpQueue[iTail++] = dwNext;
+		}
+	}
+
+	while (iHead < iTail) {
+		dwState = lpQueue[iHead++];
+
+		// Inherit a match from the longest proper suffix state
+		if (lpOutput[dwState] == IOC_NO_MATCH) {
+			lpOutput[dwState] = lpOutput[lpFail[dwState]];
+		}
+
+		for (c = 0; c < nClasses; c++) {
+			dwNext = lpTransitions[dwState * nClasses + c];
+			if (dwNext != 0) {
+				lpFail[dwNext] = lpTransitions[lpFail[dwState] * nClasses + c];
+				lpQueue[iTail++] = dwNext;
+			}
+			else {
+				lpTransitions[dwState * nClasses + c] = lpTransitions[lpFail[dwState] * nClasses + c];
+			}
+		}
+	}
+
+	MYFREE(lpFail);
+	MYFREE(lpQueue);
+	return ERROR_SUCCESS;
+}
@@ -0,0 +1,64 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#ifndef __CELLXML_IOC_H__
+#define __CELLXML_IOC_H__
+
+#include "CellXML.h"
+
+#define IOC_ROOT_STATE	0		// Automaton start state
+#define IOC_NO_MATCH	-1		// No indicator matched (yet)
+
+// ----------------------------------------------------------------------
+// Indicator of compromise (IOC) matcher
+// An Aho-Corasick automaton compiled to a dense DFA over character
+// classes: only (case folded) characters used by an indicator get their
+// own class, every other character shares class 0
+// ----------------------------------------------------------------------
+typedef struct _IOCMATCHER {
+	LPWORD	lpCharClass;		// WCHAR to character class (65536 entries)
+	DWORD	nClasses;			// Number of character classes
+	LPDWORD	lpTransitions;		// DFA transitions (nStates * nClasses)
+	LONG	*lpOutput;			// Indicator matched on entering a state, or IOC_NO_MATCH
+	DWORD	nStates;			// Number of automaton states
+	LPWSTR	*lpszIndicators;	// Indicator strings loaded from file
+	DWORD	nIndicators;		// Number of indicators
+} IOCMATCHER, *PIOCMATCHER;
+
+// ----------------------------------------------------------------------
+// Position of a scan in the automaton
+// Scans can be resumed, so a key path is scanned once and each value
+// name or subkey name continues from the saved state of its parent
+// ----------------------------------------------------------------------
+typedef struct _IOCSTATE {
+	DWORD	dwState;			// Current automaton state
+	LONG	nMatch;				// First indicator matched, or IOC_NO_MATCH
+} IOCSTATE, *PIOCSTATE;
+
+// ----------------------------------------------------------------------
+// CellXML IOC matcher functions
+// ----------------------------------------------------------------------
+DWORD LoadIocMatcher(LPCWSTR lpszIocFileName, PIOCMATCHER pMatcher);
+VOID FreeIocMatcher(PIOCMATCHER pMatcher);
+IOCSTATE ScanIocMatcher(PIOCMATCHER pMatcher, IOCSTATE State, LPCWSTR lpszText, size_t cchText);
+
+#endif // __CELLXML_IOC_H__
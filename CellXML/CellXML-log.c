@@ -0,0 +1,430 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include "CellXML-log.h"
+
+// ----------------------------------------------------------------------
+// CellXML transaction log internal functions
+// ----------------------------------------------------------------------
+DWORD OpenHiveLog(LPCWSTR lpszLogFileName, PHIVELOG pLog);
+VOID CloseHiveLog(PHIVELOG pLog);
+DWORD ReadLogEntries(PHIVELOG pLog, PHIVELOGENTRY *ppEntries, LPDWORD lpnEntries, LPDWORD lpnMaxEntries);
+BOOL ValidateLogEntry(LPBYTE lpEntry, QWORD cbAvailable);
+BOOL CheckLogEntryPages(PHIVELOGENTRY pEntry, QWORD cbFile);
+VOID ApplyLogEntry(PHIVEFILE pHive, PHIVELOGENTRY pEntry);
+QWORD Marvin32(LPBYTE lpData, DWORD cbData, QWORD qwSeed);
+
+//-----------------------------------------------------------------
+// Replay the transaction logs of a dirty hive in memory
+// Valid log entries are read from <hive>.LOG1 and <hive>.LOG2,
+// and the entries written after the last complete hive write
+// are applied in sequence order. The hive file is never written:
+// the dirty pages are copied over a copy-on-write view of the hive
+// (see MakeHiveWritable), so clean pages stay shared with the file.
+// offreg.dll only sees the hive file, so it is closed afterwards
+// and the hive is enumerated from the cells (OffHive is NULL).
+// The hive is either replayed in full or left as found: on an error
+// with no entry applied (pReplay->nEntries is 0), offreg.dll is still
+// open and the hive can be used as found. A hive with entries applied
+// must not be used if the base block could not be updated after them.
+//-----------------------------------------------------------------
+DWORD ReplayHiveLogs(PHIVEFILE pHive, LPCWSTR lpszHiveFileName, PHIVELOGREPLAY pReplay)
+{
+	HIVELOG Logs[LOG_MAX_FILES];
+	PHIVELOGENTRY lpEntries;
+	LPDWORD lpChain;
+	LPWSTR lpszLogFileName;
+	size_t cchHiveFileName;
+	DWORD nEntries;
+	DWORD nMaxEntries;
+	DWORD nChain;
+	DWORD dwSequence;
+	QWORD cbOverlay;
+	QWORD cbEntryFile;
+	DWORD dwError;
+	DWORD iLog;
+	DWORD i;
+
+	ZeroMemory(pReplay, sizeof(HIVELOGREPLAY));
+	ZeroMemory(Logs, sizeof(Logs));
+	if (pHive->bSequenceValid) {
+		return ERROR_SUCCESS;
+	}
+
+	cchHiveFileName = wcslen(lpszHiveFileName);
+	lpszLogFileName = MYALLOC((cchHiveFileName + 6) * sizeof(WCHAR));
+	if (NULL == lpszLogFileName) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	// Collect the valid entries of both log files
+	lpEntries = NULL;
+	lpChain = NULL;
+	nEntries = 0;
+	nMaxEntries = 0;
+	dwError = ERROR_SUCCESS;
+	for (iLog = 0; iLog < LOG_MAX_FILES && dwError == ERROR_SUCCESS; iLog++)
+	{
+		memcpy(lpszLogFileName, lpszHiveFileName, cchHiveFileName * sizeof(WCHAR));
+		memcpy(lpszLogFileName + cchHiveFileName, (iLog == 0) ? L".LOG1" : L".LOG2", 6 * sizeof(WCHAR));
+
+		// A missing or empty log file is normal (nothing was logged)
+		if (OpenHiveLog(lpszLogFileName, &Logs[iLog]) != ERROR_SUCCESS) {
+			continue;
+		}
+		pReplay->nLogFiles++;
+		dwError = ReadLogEntries(&Logs[iLog], &lpEntries, &nEntries, &nMaxEntries);
+	}
+	MYFREE(lpszLogFileName);
+
+	// Chain the entries from the oldest write that did not complete,
+	// the sequence numbers continue from one log file to the other
+	nChain = 0;
+	if (dwError == ERROR_SUCCESS && nEntries > 0) {
+		lpChain = MYALLOC(nEntries * sizeof(DWORD));
+		if (NULL == lpChain) {
+			dwError = ERROR_NOT_ENOUGH_MEMORY;
+		}
+	}
+	if (NULL != lpChain) {
+		for (i = 0; i < nEntries; i++) {
+			if (lpEntries[i].dwSequence >= pHive->dwSecondarySequence &&
+				(nChain == 0 || lpEntries[i].dwSequence < lpEntries[lpChain[0]].dwSequence))
+			{
+				lpChain[0] = i;
+				nChain = 1;
+			}
+		}
+		while (nChain > 0 && nChain < nEntries)
+		{
+			dwSequence = lpEntries[lpChain[nChain - 1]].dwSequence + 1;
+			for (i = 0; i < nEntries; i++) {
+				if (lpEntries[i].dwSequence == dwSequence) {
+					break;
+				}
+			}
+			if (i == nEntries) {
+				break;
+			}
+			lpChain[nChain++] = i;
+		}
+	}
+
+	// Like a corrupt entry, an entry with a page past the end of the
+	// hive ends the chain, so applying the entries cannot fail halfway
+	cbOverlay = pHive->cbFile;
+	for (i = 0; i < nChain; i++) {
+		cbEntryFile = max(cbOverlay, (QWORD)HIVE_BASE_BLOCK_SIZE + lpEntries[lpChain[i]].cbHiveBins);
+		if (!CheckLogEntryPages(&lpEntries[lpChain[i]], cbEntryFile)) {
+			break;
+		}
+		cbOverlay = cbEntryFile;
+	}
+	nChain = i;
+
+	// Make room for the largest hive bins size, then apply the entries
+	// (if the hive cannot be made writable, it is left as found)
+	if (dwError == ERROR_SUCCESS && nChain > 0) {
+		dwError = MakeHiveWritable(pHive, cbOverlay);
+	}
+	if (dwError == ERROR_SUCCESS && nChain > 0) {
+		for (i = 0; i < nChain; i++) {
+			ApplyLogEntry(pHive, &lpEntries[lpChain[i]]);
+			pReplay->nEntries++;
+			pReplay->nDirtyPages += lpEntries[lpChain[i]].nDirtyPages;
+		}
+		pReplay->dwFirstSequence = lpEntries[lpChain[0]].dwSequence;
+		pReplay->dwLastSequence = lpEntries[lpChain[nChain - 1]].dwSequence;
+		dwError = UpdateHiveBaseBlock(pHive, pReplay->dwLastSequence,
+			lpEntries[lpChain[nChain - 1]].cbHiveBins);
+		if (NULL != pHive->OffHive) {
+			ORCloseHive(pHive->OffHive);
+			pHive->OffHive = NULL;
+		}
+	}
+
+	if (NULL != lpChain) {
+		MYFREE(lpChain);
+	}
+	if (NULL != lpEntries) {
+		MYFREE(lpEntries);
+	}
+	for (iLog = 0; iLog < LOG_MAX_FILES; iLog++) {
+		CloseHiveLog(&Logs[iLog]);
+	}
+	return dwError;
+}
+
+//-----------------------------------------------------------------
+// Open and map a transaction log file (read-only)
+//-----------------------------------------------------------------
+DWORD OpenHiveLog(LPCWSTR lpszLogFileName, PHIVELOG pLog)
+{
+	LARGE_INTEGER liFileSize;
+	DWORD dwError;
+
+	ZeroMemory(pLog, sizeof(HIVELOG));
+	pLog->hFile = CreateFile(lpszLogFileName,
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+	if (pLog->hFile == INVALID_HANDLE_VALUE) {
+		pLog->hFile = NULL;
+		return GetLastError();
+	}
+	if (!GetFileSizeEx(pLog->hFile, &liFileSize)) {
+		dwError = GetLastError();
+		CloseHiveLog(pLog);
+		return dwError;
+	}
+	if ((QWORD)liFileSize.QuadPart < LOG_BASE_BLOCK_SIZE ||
+		(QWORD)(SIZE_T)liFileSize.QuadPart != (QWORD)liFileSize.QuadPart)
+	{
+		CloseHiveLog(pLog);
+		return ERROR_HANDLE_EOF;
+	}
+
+	pLog->hMapping = CreateFileMapping(pLog->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (NULL == pLog->hMapping) {
+		dwError = GetLastError();
+		CloseHiveLog(pLog);
+		return dwError;
+	}
+	pLog->lpBase = MapViewOfFile(pLog->hMapping, FILE_MAP_READ, 0, 0, (SIZE_T)liFileSize.QuadPart);
+	if (NULL == pLog->lpBase) {
+		dwError = GetLastError();
+		CloseHiveLog(pLog);
+		return dwError;
+	}
+	pLog->cbFile = (QWORD)liFileSize.QuadPart;
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Unmap and close a transaction log file
+//-----------------------------------------------------------------
+VOID CloseHiveLog(PHIVELOG pLog)
+{
+	if (NULL != pLog->lpBase) {
+		UnmapViewOfFile(pLog->lpBase);
+		pLog->lpBase = NULL;
+	}
+	if (NULL != pLog->hMapping) {
+		CloseHandle(pLog->hMapping);
+		pLog->hMapping = NULL;
+	}
+	if (NULL != pLog->hFile) {
+		CloseHandle(pLog->hFile);
+		pLog->hFile = NULL;
+	}
+}
+
+//-----------------------------------------------------------------
+// Append the valid entries of a log file to lpEntries
+// Entries are read until the first one that fails validation or
+// breaks the sequence (the rest of the log is stale data).
+// Old format logs (a dirty vector, before Windows 8.1) are not
+// supported and return ERROR_NOT_SUPPORTED.
+//-----------------------------------------------------------------
+DWORD ReadLogEntries(PHIVELOG pLog, PHIVELOGENTRY *ppEntries, LPDWORD lpnEntries, LPDWORD lpnMaxEntries)
+{
+	PHIVELOGENTRY lpEntries;
+	LPBYTE lpEntry;
+	QWORD qwOffset;
+	DWORD dwSequence;
+	DWORD nLogEntries;
+
+	if (*(LPDWORD)pLog->lpBase != HIVE_REGF_SIGNATURE) {
+		return ERROR_SUCCESS;
+	}
+	if (pLog->cbFile >= LOG_BASE_BLOCK_SIZE + sizeof(DWORD) &&
+		*(LPDWORD)(pLog->lpBase + LOG_BASE_BLOCK_SIZE) == LOG_DIRT_SIGNATURE)
+	{
+		return ERROR_NOT_SUPPORTED;
+	}
+
+	nLogEntries = 0;
+	dwSequence = 0;
+	for (qwOffset = LOG_BASE_BLOCK_SIZE; qwOffset + HVLE_DIRTY_PAGES <= pLog->cbFile; )
+	{
+		lpEntry = pLog->lpBase + qwOffset;
+		if (!ValidateLogEntry(lpEntry, pLog->cbFile - qwOffset)) {
+			break;
+		}
+		if (nLogEntries > 0 && *(LPDWORD)(lpEntry + HVLE_SEQUENCE) != dwSequence + 1) {
+			break;
+		}
+		dwSequence = *(LPDWORD)(lpEntry + HVLE_SEQUENCE);
+
+		if (*lpnEntries == *lpnMaxEntries) {
+			*lpnMaxEntries = (*lpnMaxEntries == 0) ? 64 : *lpnMaxEntries * 2;
+			if (NULL == *ppEntries) {
+				lpEntries = MYALLOC(*lpnMaxEntries * sizeof(HIVELOGENTRY));
+			}
+			else {
+				lpEntries = MYREALLOC(*ppEntries, *lpnMaxEntries * sizeof(HIVELOGENTRY));
+			}
+			if (NULL == lpEntries) {
+				return ERROR_NOT_ENOUGH_MEMORY;
+			}
+			*ppEntries = lpEntries;
+		}
+		lpEntries = *ppEntries;
+		lpEntries[*lpnEntries].lpEntry = lpEntry;
+		lpEntries[*lpnEntries].dwSequence = dwSequence;
+		lpEntries[*lpnEntries].cbHiveBins = *(LPDWORD)(lpEntry + HVLE_HIVE_BINS_SIZE);
+		lpEntries[*lpnEntries].nDirtyPages = *(LPDWORD)(lpEntry + HVLE_DIRTY_PAGE_COUNT);
+		(*lpnEntries)++;
+		nLogEntries++;
+		qwOffset += *(LPDWORD)(lpEntry + HVLE_SIZE);
+	}
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Check a log entry: signature, size, both hashes, and that every
+// dirty page is inside the entry and inside the hive bins
+//-----------------------------------------------------------------
+BOOL ValidateLogEntry(LPBYTE lpEntry, QWORD cbAvailable)
+{
+	LPBYTE lpReference;
+	DWORD cbEntry;
+	DWORD cbHiveBins;
+	DWORD nDirtyPages;
+	DWORD dwPageOffset;
+	DWORD cbPage;
+	QWORD cbPages;
+	DWORD i;
+
+	if (*(LPDWORD)lpEntry != LOG_HVLE_SIGNATURE) {
+		return FALSE;
+	}
+	cbEntry = *(LPDWORD)(lpEntry + HVLE_SIZE);
+	cbHiveBins = *(LPDWORD)(lpEntry + HVLE_HIVE_BINS_SIZE);
+	nDirtyPages = *(LPDWORD)(lpEntry + HVLE_DIRTY_PAGE_COUNT);
+	if (cbEntry < HVLE_DIRTY_PAGES || cbEntry % LOG_ENTRY_ALIGNMENT != 0 || cbEntry > cbAvailable) {
+		return FALSE;
+	}
+	if ((QWORD)nDirtyPages * HVLE_PAGE_REFERENCE_SIZE > cbEntry - HVLE_DIRTY_PAGES) {
+		return FALSE;
+	}
+
+	// Hash 2 protects the header, hash 1 the references and page data
+	if (Marvin32(lpEntry, HVLE_HASH2, LOG_MARVIN32_SEED) != *(PQWORD)(lpEntry + HVLE_HASH2) ||
+		Marvin32(lpEntry + HVLE_DIRTY_PAGES, cbEntry - HVLE_DIRTY_PAGES, LOG_MARVIN32_SEED) != *(PQWORD)(lpEntry + HVLE_HASH1))
+	{
+		return FALSE;
+	}
+
+	cbPages = (QWORD)nDirtyPages * HVLE_PAGE_REFERENCE_SIZE;
+	for (i = 0; i < nDirtyPages; i++) {
+		lpReference = lpEntry + HVLE_DIRTY_PAGES + i * HVLE_PAGE_REFERENCE_SIZE;
+		dwPageOffset = *(LPDWORD)lpReference;
+		cbPage = *(LPDWORD)(lpReference + sizeof(DWORD));
+		if ((QWORD)dwPageOffset + cbPage > cbHiveBins) {
+			return FALSE;
+		}
+		cbPages += cbPage;
+	}
+	return (cbPages <= cbEntry - HVLE_DIRTY_PAGES);
+}
+
+//-----------------------------------------------------------------
+// Check that the dirty pages of a (validated) log entry all end
+// within a hive of cbFile bytes
+//-----------------------------------------------------------------
+BOOL CheckLogEntryPages(PHIVELOGENTRY pEntry, QWORD cbFile)
+{
+	LPBYTE lpReference;
+	DWORD i;
+
+	for (i = 0; i < pEntry->nDirtyPages; i++)
+	{
+		lpReference = pEntry->lpEntry + HVLE_DIRTY_PAGES + i * HVLE_PAGE_REFERENCE_SIZE;
+		if ((QWORD)HIVE_BASE_BLOCK_SIZE + *(LPDWORD)lpReference + *(LPDWORD)(lpReference + sizeof(DWORD)) > cbFile) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+//-----------------------------------------------------------------
+// Copy the dirty pages of a checked log entry over the hive
+//-----------------------------------------------------------------
+VOID ApplyLogEntry(PHIVEFILE pHive, PHIVELOGENTRY pEntry)
+{
+	LPBYTE lpReference;
+	LPBYTE lpPage;
+	QWORD qwFileOffset;
+	DWORD cbPage;
+	DWORD i;
+
+	lpPage = pEntry->lpEntry + HVLE_DIRTY_PAGES + pEntry->nDirtyPages * HVLE_PAGE_REFERENCE_SIZE;
+	for (i = 0; i < pEntry->nDirtyPages; i++)
+	{
+		lpReference = pEntry->lpEntry + HVLE_DIRTY_PAGES + i * HVLE_PAGE_REFERENCE_SIZE;
+		qwFileOffset = (QWORD)HIVE_BASE_BLOCK_SIZE + *(LPDWORD)lpReference;
+		cbPage = *(LPDWORD)(lpReference + sizeof(DWORD));
+		memcpy(pHive->lpBase + qwFileOffset, lpPage, cbPage);
+		lpPage += cbPage;
+	}
+}
+
+//-----------------------------------------------------------------
+// Marvin32 hash, as used by the kernel for log entries
+// Returns the two 32 bit state words (high word last)
+//-----------------------------------------------------------------
+#define MARVIN32_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define MARVIN32_BLOCK(p0, p1) \
+	p1 ^= p0; p0 = MARVIN32_ROTL(p0, 20); \
+	p0 += p1; p1 = MARVIN32_ROTL(p1, 9); \
+	p1 ^= p0; p0 = MARVIN32_ROTL(p0, 27); \
+	p0 += p1; p1 = MARVIN32_ROTL(p1, 19);
+
+QWORD Marvin32(LPBYTE lpData, DWORD cbData, QWORD qwSeed)
+{
+	DWORD p0;
+	DWORD p1;
+	DWORD dwFinal;
+
+	p0 = (DWORD)qwSeed;
+	p1 = (DWORD)(qwSeed >> 32);
+	for (; cbData >= sizeof(DWORD); cbData -= sizeof(DWORD), lpData += sizeof(DWORD)) {
+		p0 += *(LPDWORD)lpData;
+		MARVIN32_BLOCK(p0, p1);
+	}
+
+	// The last 0 to 3 bytes are padded with a single 0x80 byte
+	dwFinal = 0x80;
+	while (cbData > 0) {
+		cbData--;
+		dwFinal = (dwFinal << 8) | lpData[cbData];
+	}
+	p0 += dwFinal;
+	MARVIN32_BLOCK(p0, p1);
+	MARVIN32_BLOCK(p0, p1);
+	return ((QWORD)p1 << 32) | p0;
+}
@@ -0,0 +1,90 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#pragma once
+#ifndef __CELLXML_LOG_H__
+#define __CELLXML_LOG_H__
+
+#include "CellXML-hive.h"
+
+// ----------------------------------------------------------------------
+// Transaction log file structure definitions (Windows 8.1 and later)
+// A log file starts with a copy of the hive base block (512 bytes),
+// followed by log entries. Each entry holds the dirty pages of one
+// hive write: a list of page references, then the page data itself.
+// Page offsets are relative to the first hbin, like cell offsets.
+// ----------------------------------------------------------------------
+#define LOG_BASE_BLOCK_SIZE		512			// Size of the log file base block
+#define LOG_ENTRY_ALIGNMENT		512			// Log entries are a multiple of 512 bytes
+#define LOG_HVLE_SIGNATURE		0x454C7648	// "HvLE" (log entry)
+#define LOG_DIRT_SIGNATURE		0x54524944	// "DIRT" (old format dirty vector)
+#define LOG_MARVIN32_SEED		0x82EF4D887A4E55C5ULL	// Seed of the log entry hashes
+
+#define HVLE_SIZE				0x04		// Size of the log entry (in bytes)
+#define HVLE_FLAGS				0x08		// Log entry flags
+#define HVLE_SEQUENCE			0x0C		// Sequence number of the hive write
+#define HVLE_HIVE_BINS_SIZE		0x10		// Hive bins size after the write
+#define HVLE_DIRTY_PAGE_COUNT	0x14		// Number of dirty pages
+#define HVLE_HASH1				0x18		// Marvin32 hash of the entry data (from 0x28)
+#define HVLE_HASH2				0x20		// Marvin32 hash of the first 32 bytes
+#define HVLE_DIRTY_PAGES		0x28		// First dirty page reference (offset, size)
+#define HVLE_PAGE_REFERENCE_SIZE 8			// Size of one dirty page reference
+
+#define LOG_MAX_FILES			2			// .LOG1 and .LOG2
+
+// ----------------------------------------------------------------------
+// A transaction log file, mapped read-only
+// ----------------------------------------------------------------------
+typedef struct _HIVELOG {
+	HANDLE	hFile;					// Handle to the log file
+	HANDLE	hMapping;				// File mapping object for the log file
+	LPBYTE	lpBase;					// Mapped view of the whole log file
+	QWORD	cbFile;					// Size of the log file (in bytes)
+} HIVELOG, *PHIVELOG;
+
+// ----------------------------------------------------------------------
+// A log entry that passed validation (the data stays in the log view)
+// ----------------------------------------------------------------------
+typedef struct _HIVELOGENTRY {
+	LPBYTE	lpEntry;				// Log entry (in the mapped log)
+	DWORD	dwSequence;				// Sequence number of the hive write
+	DWORD	cbHiveBins;				// Hive bins size after the write
+	DWORD	nDirtyPages;			// Number of dirty pages
+} HIVELOGENTRY, *PHIVELOGENTRY;
+
+// ----------------------------------------------------------------------
+// Summary of a transaction log replay
+// ----------------------------------------------------------------------
+typedef struct _HIVELOGREPLAY {
+	DWORD	nLogFiles;				// Log files found (and not empty)
+	DWORD	nEntries;				// Log entries applied (0 if the hive was left as found)
+	DWORD	nDirtyPages;			// Dirty pages applied
+	DWORD	dwFirstSequence;		// Sequence number of the first entry applied
+	DWORD	dwLastSequence;			// Sequence number of the last entry applied
+} HIVELOGREPLAY, *PHIVELOGREPLAY;
+
+// ----------------------------------------------------------------------
+// CellXML transaction log functions
+// ----------------------------------------------------------------------
+DWORD ReplayHiveLogs(PHIVEFILE pHive, LPCWSTR lpszHiveFileName, PHIVELOGREPLAY pReplay);
+
+#endif // __CELLXML_LOG_H__
@@ -19,54 +19,20 @@ along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
 
 */
 
-#include <windows.h>
-#include <stdio.h>
-#include <tchar.h>
-#include "offreg.h"
-#pragma comment (lib, "offreg.lib")
-
-// ----------------------------------------------------------------------
-// Definition for QWORD (not yet defined globally in WinDef.h)
-// ----------------------------------------------------------------------
-#ifndef QWORD
-typedef unsigned __int64 QWORD, NEAR *PQWORD, FAR *LPQWORD;
-#endif
-
-// ----------------------------------------------------------------------
-// Set up program heap
-// ----------------------------------------------------------------------
-#define USEHEAPALLOC_DANGER
-#ifdef USEHEAPALLOC_DANGER
-HANDLE hHeap;
-#define MYALLOC(x)  HeapAlloc(hHeap,0,x)
-#define MYALLOC0(x) HeapAlloc(hHeap,8,x)
-#define MYFREE(x)   HeapFree(hHeap,0,x)
-#else
-#define MYALLOC(x)  GlobalAlloc(GMEM_FIXED,x)
-#define MYALLOC0(x) GlobalAlloc(GPTR,x)
-#define MYFREE(x)   GlobalFree(x)
-#endif
+#include "CellXML.h"
+#include "CellXML-api.h"
+#include "CellXML-xml.h"
+#include "CellXML-shard.h"
+#include "CellXML-checkpoint.h"
+#include "CellXML-serve.h"
+#include "CellXML-summary.h"
+#include "CellXML-log.h"
+#include "CellXML-store.h"
 
 // ----------------------------------------------------------------------
 // WinHiveXML functions
 // ----------------------------------------------------------------------
 VOID printHelpMenu();
-int EnumerateKeys(ORHKEY OffKey, LPWSTR szKeyName);
-LPTSTR GetValueDataType(DWORD nTypeCode);
-LPTSTR ParseValueData(LPBYTE lpData, PDWORD lpcbData, DWORD nTypeCode);
-LPTSTR TransformValueData(LPBYTE lpData, PDWORD lpcbData, DWORD nConversionType);
-size_t AdjustBuffer(LPVOID *lpBuffer, size_t nCurrentSize, size_t nWantedSize, size_t nAlign);
-LPTSTR determineRootKey(LPTSTR lpszHiveFileName);
-
-// ----------------------------------------------------------------------
-// WinHiveXML global variables
-// ----------------------------------------------------------------------
-#define MAX_KEY_NAME 255		// Maximum length for Registry key name
-#define MAX_VALUE_NAME 16383	// Maximum length for Registry value name
-#define MAX_DATA 1024000		// Maximum length for Registry value data
-HANDLE hHeap;					// HiveXML heap
-LPTSTR lpStringBuffer;
-size_t nStringBufferSize;
 
 //-----------------------------------------------------------------
 // CellXML wmain function
@@ -74,11 +40,44 @@ size_t nStringBufferSize;
 int wmain(DWORD argc, TCHAR *argv[])
 {
 	hHeap = GetProcessHeap();
-	ORHKEY OffHive;
-	LPTSTR HiveFileName;
+	HIVEFILE Hive;
+	DWORD dwError;
+	LPTSTR HiveFileName = NULL;
 	LPTSTR HiveRootKey;
+	LPTSTR lpszImageFileName = NULL;
+	QWORD qwImageOffset = 0;
+	QWORD cbImageLength = 0;
+	QWORD qwMaxWork = 0;
+	LPTSTR lpszUserRootKey = NULL;
+	LPTSTR lpszIocFileName = NULL;
+	IOCMATCHER IocMatcher;
+	PIOCMATCHER pIocMatcher = NULL;
+	DATADEDUP DataDedup;
+	PDATADEDUP pDataDedup = NULL;
+	SECURITYCACHE SecurityCache;
+	PSECURITYCACHE pSecurityCache = NULL;
+	CELLXMLVISITOR Visitor;
+	XMLWRITER Writer;
+	SHARDWRITER Shards;
+	LPTSTR lpszShardPrefix = _T("shard");
+	DWORD nShardGroups = 0;
+	DWORD nShardDepth = 1;
+	CHECKPOINTWRITER Checkpoint;
+	LPTSTR lpszCheckpointFileName = NULL;
+	LPTSTR lpszOutputFileName = NULL;
+	FILE *fpOutput = stdout;
+	DWORD dwOptions;
 	BOOL tryGetRootKey = FALSE;
 	BOOL userSuppliedRootKey = FALSE;
+	BOOL useSequentialOrder = FALSE;
+	BOOL printSummary = FALSE;
+	BOOL useDataDedup = FALSE;
+	BOOL printSecurity = FALSE;
+	BOOL useShards = FALSE;
+	BOOL resumeExport = FALSE;
+	BOOL replayLogs = TRUE;
+	HIVESUMMARY Summary;
+	HIVELOGREPLAY LogReplay;
 
 	//-----------------------------------------------------------------
 	// Parse command line arguments
@@ -95,6 +94,87 @@ int wmain(DWORD argc, TCHAR *argv[])
 			return 0;
 		}
 
+		// Keep hives open and answer queries on a Unix domain socket
+		if (_tcscmp(argv[1], _T("serve")) == 0 && argc == 3)
+		{
+			dwError = RunCellXmlServer(argv[2]);
+			if (dwError != ERROR_SUCCESS) {
+				printf("\n>>> ERROR: Query server failed...\n");
+				printf("  > System error code: %d\n", dwError);
+				return -1;
+			}
+			return 0;
+		}
+
+		// Send one query to a running server (the hive file name is
+		// made absolute, the server may run in another directory)
+		if (_tcscmp(argv[1], _T("query")) == 0 && argc >= 5 && argc <= 7)
+		{
+			WCHAR szFullName[MAX_PATH];
+			DWORD cchFullName;
+			cchFullName = GetFullPathNameW(argv[4], MAX_PATH, szFullName, NULL);
+			if (cchFullName > 0 && cchFullName < MAX_PATH) {
+				argv[4] = szFullName;
+			}
+			dwError = RunCellXmlClient(argv[2], &argv[3], argc - 3);
+			if (dwError != ERROR_SUCCESS) {
+				fprintf(stderr, ">>> ERROR: Query failed, system error code: %d\n", dwError);
+				return -1;
+			}
+			return 0;
+		}
+
+		// Convert an existing CellXML document to an indexed store file
+		if (_tcscmp(argv[1], _T("ingest")) == 0 && argc == 4)
+		{
+			STOREHEADER StoreHeader;
+			dwError = IngestCellXml(argv[2], argv[3], &StoreHeader);
+			if (dwError != ERROR_SUCCESS) {
+				printf("\n>>> ERROR: Cannot convert CellXML document to a store...\n");
+				printf("  > System error code: %d\n", dwError);
+				return -1;
+			}
+			if (StoreHeader.cbPartial > 0) {
+				fprintf(stderr, ">>> WARNING: The CellXML document is a partial export.\n");
+			}
+			return 0;
+		}
+
+		// Print the cellobjects of a cellpath (or below a cellpath prefix)
+		if (_tcscmp(argv[1], _T("lookup")) == 0 && (argc == 4 || (argc == 5 && _tcscmp(argv[3], _T("--prefix")) == 0)))
+		{
+			CELLXMLSTORE Store;
+			XMLOUTPUT StoreOutput;
+			LPSTR lpszPath;
+			int cbPath;
+			// The path is converted exactly as cellpaths are written (%ws
+			// through the C runtime, in the "C" locale: one byte per
+			// character up to U+00FF), so it matches the stored bytes
+			cbPath = _scprintf("%ws", argv[argc - 1]);
+			if (cbPath < 0) {
+				fprintf(stderr, ">>> ERROR: Cellpath cannot be written by CellXML, it is never stored.\n");
+				return -1;
+			}
+			lpszPath = MYALLOC0(cbPath + 1);
+			if (NULL == lpszPath) {
+				return -1;
+			}
+			sprintf_s(lpszPath, cbPath + 1, "%ws", argv[argc - 1]);
+			dwError = OpenCellXmlStore(argv[2], &Store);
+			if (dwError == ERROR_SUCCESS) {
+				ZeroMemory(&StoreOutput, sizeof(XMLOUTPUT));
+				StoreOutput.fp = stdout;
+				dwError = LookupCellXmlStore(&Store, &StoreOutput, lpszPath, argc == 5);
+				CloseCellXmlStore(&Store);
+			}
+			MYFREE(lpszPath);
+			if (dwError != ERROR_SUCCESS) {
+				fprintf(stderr, ">>> ERROR: Lookup failed, system error code: %d\n", dwError);
+				return -1;
+			}
+			return 0;
+		}
+
 		// Scan the command line arguments and set booleans
 		for (DWORD i = 0; i < argc; i++)
 		{
@@ -102,8 +182,73 @@ int wmain(DWORD argc, TCHAR *argv[])
 			if (_tcscmp(argv[i], _T("-a")) == 0) {
 				tryGetRootKey = TRUE;
 			}
-			if (_tcscmp(argv[i], _T("-r")) == 0) {
+			if (_tcscmp(argv[i], _T("-r")) == 0 && i + 1 < argc) {
 				userSuppliedRootKey = TRUE;
+				lpszUserRootKey = argv[i + 1];
+			}
+			// Read cells in file offset order (for cold storage)
+			if (_tcscmp(argv[i], _T("--sequential")) == 0) {
+				useSequentialOrder = TRUE;
+			}
+			// Only print triage statistics (no value data is read)
+			if (_tcscmp(argv[i], _T("--summary")) == 0) {
+				printSummary = TRUE;
+			}
+			// Reference repeated value data instead of writing it again
+			if (_tcscmp(argv[i], _T("--dedup")) == 0) {
+				useDataDedup = TRUE;
+			}
+			// Add the key security descriptors (as SDDL)
+			if (_tcscmp(argv[i], _T("--security")) == 0) {
+				printSecurity = TRUE;
+			}
+			// Split the output into shard files, with a manifest on stdout
+			if (_tcscmp(argv[i], _T("--shard")) == 0 && i + 1 < argc) {
+				useShards = TRUE;
+				nShardGroups = _tcstoul(argv[i + 1], NULL, 0);
+				if (nShardGroups == 0) {
+					nShardGroups = 1;
+				}
+			}
+			if (_tcscmp(argv[i], _T("--shard-by-depth")) == 0 && i + 1 < argc) {
+				useShards = TRUE;
+				nShardDepth = _tcstoul(argv[i + 1], NULL, 0);
+			}
+			if (_tcscmp(argv[i], _T("--shard-prefix")) == 0 && i + 1 < argc) {
+				lpszShardPrefix = argv[i + 1];
+			}
+			// Write the XML output to a file (instead of stdout)
+			if (_tcscmp(argv[i], _T("--output")) == 0 && i + 1 < argc) {
+				lpszOutputFileName = argv[i + 1];
+			}
+			// Save the export position, to resume an interrupted export
+			if (_tcscmp(argv[i], _T("--checkpoint")) == 0 && i + 1 < argc) {
+				lpszCheckpointFileName = argv[i + 1];
+			}
+			if (_tcscmp(argv[i], _T("--resume")) == 0) {
+				resumeExport = TRUE;
+			}
+			// Only output cells matching an indicator file
+			if (_tcscmp(argv[i], _T("--match")) == 0 && i + 1 < argc) {
+				lpszIocFileName = argv[i + 1];
+			}
+			// Read the hive from a byte range inside a raw disk image
+			if (_tcscmp(argv[i], _T("--image")) == 0 && i + 1 < argc) {
+				lpszImageFileName = argv[i + 1];
+			}
+			if (_tcscmp(argv[i], _T("--offset")) == 0 && i + 1 < argc) {
+				qwImageOffset = _tcstoui64(argv[i + 1], NULL, 0);
+			}
+			if (_tcscmp(argv[i], _T("--length")) == 0 && i + 1 < argc) {
+				cbImageLength = _tcstoui64(argv[i + 1], NULL, 0);
+			}
+			// Export a dirty hive as found, without its transaction logs
+			if (_tcscmp(argv[i], _T("--no-log-replay")) == 0) {
+				replayLogs = FALSE;
+			}
+			// Abandon corrupt hives after a number of keys, values and list entries
+			if (_tcscmp(argv[i], _T("--max-work")) == 0 && i + 1 < argc) {
+				qwMaxWork = _tcstoui64(argv[i + 1], NULL, 0);
 			}
 		}
 	}
@@ -116,36 +261,99 @@ int wmain(DWORD argc, TCHAR *argv[])
 
 	// PROCESSING STARTS HERE
 
+	// A checkpoint names a position in one output file, which is cut
+	// back on resume (standard output and shards cannot be)
+	if ((NULL != lpszCheckpointFileName && (NULL == lpszOutputFileName || useShards)) ||
+		(resumeExport && NULL == lpszCheckpointFileName))
+	{
+		printf("\n>>> ERROR: --checkpoint needs --output (without shards), --resume needs --checkpoint...\n");
+		return -1;
+	}
+
 	// Find the Registry hive file (should be the last argument)
-	HiveFileName = MYALLOC0(100 * sizeof(TCHAR));
-	_tcscat_s(HiveFileName, 100, argv[argc - 1]);
+	// A hive inside a disk image (--image) does not need a file name
+	if (NULL == lpszImageFileName) {
+		HiveFileName = argv[argc - 1];
+	}
+
+	// Compile the indicators before touching the hive
+	// (a summary counts every cell, so --match is ignored)
+	if (NULL != lpszIocFileName && !printSummary) {
+		dwError = LoadIocMatcher(lpszIocFileName, &IocMatcher);
+		if (dwError != ERROR_SUCCESS) {
+			printf("\n>>> ERROR: Cannot load indicator file...\n");
+			printf("  > System error code: %d\n", dwError);
+			return -1;
+		}
+		pIocMatcher = &IocMatcher;
+	}
 
-	// Check if the user supplied Registry hive file exists
-	if (GetFileAttributesW(HiveFileName) == INVALID_FILE_ATTRIBUTES) {
+	// Open, map and validate the Registry hive file in a single pass
+	// The same file handle is used for enumeration by offreg.dll
+	// Hives from stdin ("-") or a disk image are read from memory
+	if (NULL != lpszImageFileName) {
+		dwError = OpenHiveImage(lpszImageFileName, qwImageOffset, cbImageLength, &Hive);
+	}
+	else if (_tcscmp(HiveFileName, _T("-")) == 0) {
+		dwError = OpenHiveStdin(&Hive);
+	}
+	else {
+		dwError = OpenHiveFile(HiveFileName, &Hive);
+	}
+	if (dwError == ERROR_FILE_NOT_FOUND) {
 		printf("\n>>> ERROR: File appears to not exist. Check file input...\n");
-		printf("  > System error code: %d\n", GetLastError());
+		printf("  > System error code: %d\n", dwError);
 		return -1;
 	}
-
-	// Check if we have a valid Registry hive file
-	// Use OROpenHive to check, then close hive if no errors
-	if (OROpenHive(HiveFileName, &OffHive) != ERROR_SUCCESS) {
+	else if (dwError != ERROR_SUCCESS) {
 		printf("\n>>> ERROR: Cannot open or validate Registry hive...\n");
-		printf("  > System error code: %d\n", GetLastError());
+		printf("  > System error code: %d\n", dwError);
 		return -1;
 	}
-	else {
-		ORCloseHive(OffHive);
+
+	// Warn (without stopping) if the base block looks inconsistent
+	if (!Hive.bChecksumValid) {
+		fprintf(stderr, ">>> WARNING: Registry hive base block checksum mismatch.\n");
+	}
+	if (!Hive.bSequenceValid) {
+		fprintf(stderr, ">>> WARNING: Registry hive sequence numbers do not match (%u, %u).\n",
+			Hive.dwPrimarySequence, Hive.dwSecondarySequence);
+
+		// Apply the transaction logs next to a dirty hive file in memory
+		ZeroMemory(&LogReplay, sizeof(HIVELOGREPLAY));
+		dwError = ERROR_SUCCESS;
+		if (replayLogs && NULL != Hive.OffHive) {
+			dwError = ReplayHiveLogs(&Hive, HiveFileName, &LogReplay);
+		}
+		if (dwError != ERROR_SUCCESS && LogReplay.nEntries > 0) {
+			// Log entries were applied, but the hive cannot be read with them
+			printf("\n>>> ERROR: Cannot replay transaction logs...\n");
+			printf("  > System error code: %d\n", dwError);
+			CloseHiveFile(&Hive);
+			return -1;
+		}
+		if (dwError != ERROR_SUCCESS) {
+			fprintf(stderr, "  >          Cannot replay transaction logs, system error code: %d\n", dwError);
+			fprintf(stderr, "  >          Exporting the hive as found, without the changes in its logs.\n");
+		}
+		else if (LogReplay.nEntries > 0) {
+			fprintf(stderr, "  >          Applied %u transaction log entries (%u dirty pages, sequence %u to %u) in memory.\n",
+				LogReplay.nEntries, LogReplay.nDirtyPages, LogReplay.dwFirstSequence, LogReplay.dwLastSequence);
+		}
+		else {
+			fprintf(stderr, "  >          Hive is dirty, recent changes may be in transaction logs.\n");
+		}
 	}
 
 	// Determine how we are going to get the rootkey
-	if (tryGetRootKey) {
-		// Try an automatically determine the hive root key
-		HiveRootKey = determineRootKey(HiveFileName);
+	// Without a hive file name, fall back to the root cell name
+	if (tryGetRootKey || (!userSuppliedRootKey && (NULL != lpszImageFileName || _tcscmp(HiveFileName, _T("-")) == 0))) {
+		// Use the root key name read from the hive root cell
+		HiveRootKey = Hive.lpszRootKeyName;
 	}
 	else if (userSuppliedRootKey) {
 		// The root key has been specified by "-r"
-		HiveRootKey = argv[2];
+		HiveRootKey = lpszUserRootKey;
 	}
 	else
 	{
@@ -164,23 +372,160 @@ int wmain(DWORD argc, TCHAR *argv[])
 		_tcscat_s(HiveRootKey, MAX_PATH, lpszFileExt);
 	}
 
-	// Open the offline Registry hive file
-	// No error check needed, it has already been validated
-	OROpenHive(HiveFileName, &OffHive);
+	// Triage statistics replace the full export
+	if (printSummary) {
+		dwError = SummarizeHive(&Hive, HiveRootKey, useSequentialOrder ? VISIT_HIVE_SEQUENTIAL : 0, qwMaxWork, &Summary);
+		if (dwError == ERROR_SUCCESS || dwError == ERROR_NOT_ENOUGH_QUOTA) {
+			if (dwError == ERROR_NOT_ENOUGH_QUOTA) {
+				fprintf(stderr, ">>> WARNING: Work budget of %llu exhausted, summary is partial.\n", qwMaxWork);
+			}
+			PrintHiveSummary(&Summary, dwError);
+			FreeHiveSummary(&Summary);
+		}
+		else {
+			fprintf(stderr, ">>> ERROR: Summary failed, system error code: %d\n", dwError);
+		}
+		CloseHiveFile(&Hive);
+		return (dwError == ERROR_SUCCESS) ? 0 : -1;
+	}
+
+	// The value data table has a fixed size, set up once per hive
+	// Security descriptors are cached, each sk cell is converted once
+	if (useDataDedup) {
+		dwError = InitDataDedup(&DataDedup, &Hive);
+		if (dwError != ERROR_SUCCESS) {
+			printf("\n>>> ERROR: Cannot allocate value data table...\n");
+			printf("  > System error code: %d\n", dwError);
+			CloseHiveFile(&Hive);
+			return -1;
+		}
+		pDataDedup = &DataDedup;
+	}
+	if (printSecurity) {
+		dwError = InitSecurityCache(&SecurityCache);
+		if (dwError != ERROR_SUCCESS) {
+			printf("\n>>> ERROR: Cannot allocate security descriptor cache...\n");
+			printf("  > System error code: %d\n", dwError);
+			CloseHiveFile(&Hive);
+			return -1;
+		}
+		pSecurityCache = &SecurityCache;
+	}
+
+	// A resumed export continues its existing output file
+	if (NULL != lpszOutputFileName) {
+		if (_tfopen_s(&fpOutput, lpszOutputFileName, resumeExport ? _T("r+") : _T("w")) != 0) {
+			printf("\n>>> ERROR: Cannot open output file...\n");
+			CloseHiveFile(&Hive);
+			return -1;
+		}
+	}
+
+	// Walk every key and value, with the XML writer as the visitor
+	// offreg.dll can only open named hive files, so hives held in
+	// memory are always read from the cells in file order
+	InitXmlWriter(&Writer, &Visitor, pIocMatcher, pDataDedup, pSecurityCache);
+	Writer.Output.fp = fpOutput;
+
+	// With a checkpoint, the export position is saved as it goes, and
+	// a resumed export checks the hive and cuts its output back
+	if (NULL != lpszCheckpointFileName) {
+		dwOptions = (useSequentialOrder ? CHECKPOINT_SEQUENTIAL : 0) | (NULL != pIocMatcher ? CHECKPOINT_MATCH : 0) |
+			(useDataDedup ? CHECKPOINT_DEDUP : 0) | (printSecurity ? CHECKPOINT_SECURITY : 0);
+		dwError = InitCheckpointWriter(&Checkpoint, &Writer, &Visitor, lpszCheckpointFileName, &Hive, dwOptions);
+		if (dwError == ERROR_SUCCESS && resumeExport) {
+			dwError = ResumeCheckpoint(&Checkpoint);
+		}
+		if (dwError != ERROR_SUCCESS) {
+			if (dwError == ERROR_REVISION_MISMATCH) {
+				printf("\n>>> ERROR: Registry hive changed since the checkpoint...\n");
+			}
+			else {
+				printf("\n>>> ERROR: Cannot use checkpoint file...\n");
+			}
+			printf("  > System error code: %d\n", dwError);
+			FreeCheckpointWriter(&Checkpoint);
+			FreeXmlWriter(&Writer);
+			fclose(fpOutput);
+			CloseHiveFile(&Hive);
+			return -1;
+		}
+	}
 
-	// Print CellXML header
-	printf("<?xml version = '1.0' encoding = 'UTF-8'?>\n");
-	printf("<hive>\n");
+	// With shards, every subtree goes to a shard file instead, and the
+	// output gets the manifest (balanced shards are planned by a first
+	// walk over the keys)
+	if (useShards) {
+		dwError = InitShardWriter(&Shards, &Writer, &Visitor, lpszShardPrefix, nShardDepth, nShardGroups);
+		if (dwError == ERROR_SUCCESS) {
+			dwError = PlanShards(&Shards, &Hive, HiveRootKey, useSequentialOrder ? VISIT_HIVE_SEQUENTIAL : 0, qwMaxWork);
+		}
+		if (dwError != ERROR_SUCCESS) {
+			printf("\n>>> ERROR: Cannot create shard files...\n");
+			printf("  > System error code: %d\n", dwError);
+			FreeShardWriter(&Shards);
+			FreeXmlWriter(&Writer);
+			if (fpOutput != stdout) {
+				fclose(fpOutput);
+			}
+			CloseHiveFile(&Hive);
+			return -1;
+		}
+	}
+	else if (!resumeExport) {
+		PrintHiveHeader(&Writer.Output);
+	}
 
-	// Start enumerating the first Registry root key
-	// This function is recursive and will enumerate all subkeys and values
-	EnumerateKeys(OffHive, HiveRootKey);
+	dwError = ResumeVisitHive(&Hive, HiveRootKey, &Visitor, useSequentialOrder ? VISIT_HIVE_SEQUENTIAL : 0, qwMaxWork,
+		resumeExport ? &Checkpoint.Position : NULL);
+	if (useShards && Shards.dwError != ERROR_SUCCESS) {
+		dwError = Shards.dwError;
+	}
+	if (NULL != lpszCheckpointFileName && Checkpoint.dwError != ERROR_SUCCESS) {
+		dwError = Checkpoint.dwError;
+	}
+	FreeXmlWriter(&Writer);
 
-	// Close hive XML element
-	printf("</hive>\n");
+	// An unfinished walk still closes the document, with a marker so
+	// a partial export is never mistaken for a complete one
+	if (dwError == ERROR_NOT_ENOUGH_QUOTA) {
+		fprintf(stderr, ">>> WARNING: Work budget of %llu exhausted, output is partial.\n", qwMaxWork);
+	}
+	else if (dwError != ERROR_SUCCESS) {
+		fprintf(stderr, ">>> ERROR: Enumeration failed, system error code: %d\n", dwError);
+	}
 
-	// All done! Exit.
-	return 0;
+	// Close hive XML element (of every shard, then print the manifest)
+	if (useShards) {
+		CloseShardFiles(&Shards, dwError);
+		PrintShardManifest(&Shards, fpOutput, dwError);
+		FreeShardWriter(&Shards);
+	}
+	else {
+		PrintHiveFooter(&Writer.Output, dwError);
+	}
+	if (NULL != lpszCheckpointFileName) {
+		FinishCheckpoint(&Checkpoint, dwError);
+		FreeCheckpointWriter(&Checkpoint);
+	}
+	if (fpOutput != stdout) {
+		fclose(fpOutput);
+	}
+
+	// Close the hive and release the file mapping
+	CloseHiveFile(&Hive);
+	if (NULL != pIocMatcher) {
+		FreeIocMatcher(pIocMatcher);
+	}
+	if (NULL != pDataDedup) {
+		FreeDataDedup(pDataDedup);
+	}
+	if (NULL != pSecurityCache) {
+		FreeSecurityCache(pSecurityCache);
+	}
+
+	// All done! Exit (with an error if the output is partial)
+	return (dwError == ERROR_SUCCESS) ? 0 : -1;
 }
 
 
@@ -212,7 +557,11 @@ VOID printHelpMenu()
 	printf("Description: CellXML.exe is a program which parses a Windows Registry hive\n");
 	printf("             file and converts the data to XML format. The XML structure \n");
 	printf("             is modelled after the RegXML project.\n\n");
-	printf("      Usage: CellXML.exe [options] hive-file\n\n");
+	printf("      Usage: CellXML.exe [options] hive-file\n");
+	printf("             CellXML.exe serve socket-file\n");
+	printf("             CellXML.exe query socket-file request hive-file [key-path [value-name]]\n");
+	printf("             CellXML.exe ingest xml-file store-file\n");
+	printf("             CellXML.exe lookup store-file [--prefix] cellpath\n\n");
 	printf("   Examples: 1) Print Registry hive file to standard output (stdout):\n");
 	printf("                 CellXML.exe hive-file\n");
 	printf("             2) Manually specify the hive root key:\n");
@@ -220,548 +569,34 @@ VOID printHelpMenu()
 	printf("             3) Automatically determine hive root key:\n");
 	printf("                 CellXML.exe -a hive-file\n");
 	printf("             4) Direct standard output to an XML file:\n");
-	printf("                 CellXML.exe hive-file > output.xml\n\n");
-}
-
-
-//-----------------------------------------------------------------
-// Enumerate Keys function to iterate over every Registry key
-// in a offline Registry hive file
-//-----------------------------------------------------------------
-int EnumerateKeys(ORHKEY OffKey, LPWSTR szKeyName)
-{
-	DWORD	nSubkeys;
-	DWORD	nValues;
-	DWORD	nSize;
-	DWORD	dwType;
-	DWORD	cbData;
-	ORHKEY	OffKeyNext;
-	WCHAR	szValue[MAX_VALUE_NAME];
-	WCHAR	szSubKey[MAX_KEY_NAME];
-	WCHAR	szNextKey[MAX_KEY_NAME];
-	WCHAR	szAll[MAX_KEY_NAME + MAX_VALUE_NAME];
-	DWORD	i;
-	PFILETIME lpftLastWriteTime;
-
-	// Allocated space for the Registry key last write time
-	lpftLastWriteTime = MYALLOC(sizeof(FILETIME));
-
-	// Query the key, determine the number of keys, values and the key's last write time
-	if (ORQueryInfoKey(OffKey, NULL, NULL, &nSubkeys,
-		NULL, NULL, &nValues, NULL,
-		NULL, NULL, lpftLastWriteTime) != ERROR_SUCCESS)
-	{
-		return 0;
-	}
-
-	// Convert the key's last write time to a SYSTEMTIME (for printing purposes)
-	SYSTEMTIME st;
-	LPTSTR lpszModifiedTime;
-	FileTimeToSystemTime(lpftLastWriteTime, &st);
-	lpszModifiedTime = MYALLOC0(21 * sizeof(TCHAR));
-	_sntprintf_s(lpszModifiedTime, 21 + 1 * sizeof(TCHAR), 21, TEXT("%i-%02i-%02iT%02i:%02i:%02iZ"),
-		st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
-
-	// We have all the Registry key details, write out using DFXML/RegXML syntax
-	printf("  <cellobject>\n");
-	printf("    <cellpath>%ws</cellpath>\n", szKeyName);
-	printf("    <name_type>k</name_type>\n");
-	printf("    <mtime>%ws</mtime>\n", lpszModifiedTime);
-	printf("    <alloc>1</alloc>\n");
-	printf("  </cellobject>\n");
-
-	// Free allocated memory for last write time
-	//MYFREE(lpszModifiedTime);
-
-	// Loop through each of the Registry key's values
-	for (i = 0; i < nValues; i++)
-	{
-		memset(szValue, 0, sizeof(szValue));
-		nSize = MAX_VALUE_NAME;
-		dwType = 0;
-		cbData = 0;
-
-		// Enumerate the Registry Valye, get the name and data size
-		if (OREnumValue(OffKey, i, szValue, &nSize,
-			&dwType, NULL, &cbData) != ERROR_MORE_DATA)
-		{
-			continue;
-		}
-
-		// Allocate some memory to store the Registry value name
-		LPBYTE pData;
-		pData = MYALLOC0(cbData + 2);
-		if (!pData) {
-			continue;
-		}
-		memset(pData, 0, cbData + 2);
-
-		// Fetch the Registry value name, data type and data 
-		if (OREnumValue(OffKey,
-			i,
-			szValue,
-			&nSize,
-			&dwType,
-			pData,
-			&cbData) != ERROR_SUCCESS)
-		{
-			MYFREE(pData);
-			continue;
-		}
-
-		// Determine Registry value name including parent key
-		if (nSize == 0) {
-			swprintf(szAll, MAX_KEY_NAME + MAX_VALUE_NAME, L"%s\\%s", szKeyName, TEXT("(Default)"));
-		}
-		else {
-			swprintf(szAll, MAX_KEY_NAME + MAX_VALUE_NAME, L"%s\\%s", szKeyName, szValue);
-		}
-
-		// Determine Registry value data type
-		LPTSTR lpszDataType;
-		lpszDataType = GetValueDataType(dwType);
-
-		// Determine Registry value data
-		LPTSTR lpszValueData;
-		lpszValueData = ParseValueData(pData, &cbData, dwType);
-
-		LPTSTR lpszRawValueData;
-		lpszRawValueData = ParseValueData(pData, &cbData, REG_BINARY);
-
-		// We have all the Registry value details, write out using DFXML/RegXML syntax
-		printf("  <cellobject>\n");
-		printf("    <cellpath>%ws</cellpath>\n", szAll);
-		if (nSize == 0) {
-			printf("    <basename>%ws</basename>\n", TEXT("(Default)"));
-		}
-		else {
-			printf("    <basename>%ws</basename>\n", szValue);
-		}
-		printf("    <name_type>v</name_type>\n");
-		printf("    <mtime>%ws</mtime>\n", lpszModifiedTime);
-		printf("    <alloc>1</alloc>\n");
-		printf("    <data_type>%ws</data_type>\n", lpszDataType);
-		printf("    <data>%ws</data>\n", lpszValueData);
-		printf("    <raw_data>%ws</raw_data>\n", lpszRawValueData);
-		printf("  </cellobject>\n");
-
-		// Free the Registry value data
-		MYFREE(pData);
-	}
-
-	// Now loop over each of the Registry key's subkeys
-	// This is recursive, EmumerateKeys will be called recursively
-	for (i = 0; i<nSubkeys; i++)
-	{
-		memset(szSubKey, 0, sizeof(szSubKey));
-		nSize = MAX_KEY_NAME;
-
-		// Fetch the subkey name
-		if (OREnumKey(OffKey, i, szSubKey, &nSize,
-			NULL, NULL, NULL) != ERROR_SUCCESS)
-		{
-			continue;
-		}
-
-		swprintf(szNextKey, MAX_KEY_NAME, L"%s\\%s", szKeyName, szSubKey);
-
-		// Open the subkey
-		if (OROpenKey(OffKey, szSubKey, &OffKeyNext)
-			== ERROR_SUCCESS)
-		{
-			EnumerateKeys(OffKeyNext, szNextKey);
-			ORCloseKey(OffKeyNext);
-		}
-	}
-
-	// All done!
-	return 0;
-}
-
-// ----------------------------------------------------------------------
-// Determine the Registry value type (e.g., REG_SZ, REG_BINARY) and return 
-// ----------------------------------------------------------------------
-LPTSTR GetValueDataType(DWORD nTypeCode)
-{
-	LPTSTR lpszDataType;
-	lpszDataType = MYALLOC0(40 * sizeof(wchar_t));
-	if (nTypeCode == REG_NONE) { lpszDataType = TEXT("REG_NONE"); }
-	else if (nTypeCode == REG_SZ) { lpszDataType = TEXT("REG_SZ"); }
-	else if (nTypeCode == REG_EXPAND_SZ) { lpszDataType = TEXT("REG_EXPAND_SZ"); }
-	else if (nTypeCode == REG_BINARY) { lpszDataType = TEXT("REG_BINARY"); }
-	else if (nTypeCode == REG_DWORD) { lpszDataType = TEXT("REG_DWORD"); }
-	else if (nTypeCode == REG_DWORD_BIG_ENDIAN) { lpszDataType = TEXT("REG_DWORD_BIG_ENDIAN"); }
-	else if (nTypeCode == REG_LINK) { lpszDataType = TEXT("REG_LINK"); }
-	else if (nTypeCode == REG_MULTI_SZ) { lpszDataType = TEXT("REG_MULTI_SZ"); }
-	else if (nTypeCode == REG_RESOURCE_LIST) { lpszDataType = TEXT("REG_RESOURCE_LIST"); }
-	else if (nTypeCode == REG_FULL_RESOURCE_DESCRIPTOR) { lpszDataType = TEXT("REG_FULL_RESOURCE_DESCRIPTOR"); }
-	else if (nTypeCode == REG_RESOURCE_REQUIREMENTS_LIST) { lpszDataType = TEXT("REG_RESOURCE_REQUIREMENTS_LIST"); }
-	else if (nTypeCode == REG_QWORD) { lpszDataType = TEXT("REG_QWORD"); }
-	return lpszDataType;
-}
-
-// ----------------------------------------------------------------------
-// Parse Registry value data
-// Return a string (based on data type) that can be printed
-// ----------------------------------------------------------------------
-LPTSTR ParseValueData(LPBYTE lpData, PDWORD lpcbData, DWORD nTypeCode)
-{
-	LPTSTR lpszValueData;
-	lpszValueData = NULL;
-
-	// Check if the Registry value data is NULL, else process the Registry value data
-	if (NULL == lpData)
-	{
-		lpszValueData = TransformValueData(lpData, lpcbData, REG_BINARY);
-	}
-	else
-	{
-		DWORD cbData;
-		size_t cchMax;
-		size_t cchActual;
-		cbData = *lpcbData;
-		switch (nTypeCode) {
-
-			// Process the three different string types (normal, expanded and multi)
-		case REG_SZ:
-		case REG_EXPAND_SZ:
-		case REG_MULTI_SZ:
-			// We need to do a check for hidden bytes after string[s]
-			cchMax = cbData / sizeof(TCHAR);
-			if (REG_MULTI_SZ == nTypeCode)
-			{
-				// Do a search for double NULL chars (REG_MULTI_SZ ends with \0\0)
-				for (cchActual = 0; cchActual < cchMax; cchActual++)
-				{
-					if (0 != ((LPTSTR)lpData)[cchActual]) {
-						continue;
-					}
-					cchActual++;
-					// Special case check for incorrectly terminated string
-					if (cchActual >= cchMax) {
-						break;
-					}
-					if (0 != ((LPTSTR)lpData)[cchActual]) {
-						continue;
-					}
-					// Found a double NULL terminated string
-					cchActual++;
-					break;
-				}
-			}
-			else
-			{
-				// Must be a REG_SZ or REG_EXPAND_SZ
-				cchActual = _tcsnlen((LPTSTR)lpData, cchMax);
-				if (cchActual < cchMax) {
-					cchActual++;  // Account for NULL character
-				}
-			}
-
-			// Do a size check; actual size VS specified size
-			if ((cchActual * sizeof(TCHAR)) == cbData) {
-				// If determined size is the same as specified size
-				// process using the specified Registry value type
-				lpszValueData = TransformValueData(lpData, lpcbData, nTypeCode);
-			}
-			else
-			{
-				// Else process the string as REG_BINARY (binary)
-				lpszValueData = TransformValueData(lpData, lpcbData, REG_BINARY);
-			}
-			break;
-
-			// Process DWORD types
-		case REG_DWORD_LITTLE_ENDIAN:
-		case REG_DWORD_BIG_ENDIAN:
-			// Do a size check; DWORD size VS specified size
-			if (sizeof(DWORD) == cbData)
-			{
-				// If the size of the value data is the same as a DWORD size
-				// process using the specified Registry value type
-				lpszValueData = TransformValueData(lpData, lpcbData, nTypeCode);
-			}
-			else
-			{
-				// Else process the string as REG_BINARY (binary)
-				lpszValueData = TransformValueData(lpData, lpcbData, REG_BINARY);
-			}
-			break;
-
-			// Process QWORD types (currently only little endian)
-		case REG_QWORD_LITTLE_ENDIAN:
-			// If the size if the value data is the same as a QWORD size
-			// process using the specified Registry value type
-			if (sizeof(QWORD) == cbData)
-			{
-				// If the size of the value data is the same as a QWORD size
-				// process using the specified Registry value type
-				lpszValueData = TransformValueData(lpData, lpcbData, nTypeCode);
-			}
-			else
-			{
-				// Else process the string as REG_BINARY (binary)
-				lpszValueData = TransformValueData(lpData, lpcbData, REG_BINARY);
-			}
-			break;
-
-			// Process any other Registry value data type as REG_BINARY (binary)
-		default:
-			lpszValueData = TransformValueData(lpData, lpcbData, REG_BINARY);
-		}
-	}
-	return lpszValueData;
-}
-
-
-// ----------------------------------------------------------------------
-// Transform Registry value data based on data_type
-// ----------------------------------------------------------------------
-LPTSTR TransformValueData(LPBYTE lpData, PDWORD lpcbData, DWORD nConversionType)
-{
-	LPTSTR lpszValueDataIsNULL = TEXT("NULL");
-	LPTSTR lpszValueData;
-	LPDWORD lpDword;
-	LPQWORD lpQword;
-	DWORD nDwordCpu;
-
-	lpszValueData = NULL;
-	lpDword = NULL;
-	lpQword = NULL;
-	lpStringBuffer = NULL;
-
-	if (NULL == lpData)
-	{
-		lpszValueData = MYALLOC((_tcslen(lpszValueDataIsNULL) + 1) * sizeof(TCHAR));
-		//_tcscpy(lpszValueData, lpszValueDataIsNULL);
-		_tcscpy_s(lpszValueData, (_tcslen(lpszValueDataIsNULL) + 1) * sizeof(TCHAR), lpszValueDataIsNULL);
-	}
-	else
-	{
-		DWORD cbData;
-		DWORD ibCurrent;
-		size_t cchToGo;
-		size_t cchString;
-		size_t cchActual;
-		LPTSTR lpszSrc;
-		LPTSTR lpszDst;
-
-		cbData = *lpcbData;
-
-		switch (nConversionType) {
-		case REG_SZ:
-			// A normal NULL termination string
-			lpszValueData = MYALLOC0(sizeof(TCHAR) + cbData);
-			if (NULL != lpData) {
-				memcpy(lpszValueData, lpData, cbData);
-			}
-			break;
-
-		case REG_EXPAND_SZ:
-			// A NULL terminated string that contains unexpanded references to environment variables (e.g., "%PATH%")
-			// Process and output in the following format: "<string>"\0
-			lpszValueData = MYALLOC0(sizeof(TCHAR) + cbData);
-			if (NULL != lpData) {
-				memcpy(lpszValueData, lpData, cbData);
-			}
-			break;
-
-		case REG_MULTI_SZ:
-			// A sequence of null-terminated strings, terminated by an empty string (\0).
-			// Process and output in the following format: "<string>", "<string>", "<string>", ...\0
-			nStringBufferSize = AdjustBuffer(&lpStringBuffer, nStringBufferSize, 10 + (2 * cbData), 1024);
-			ZeroMemory(lpStringBuffer, nStringBufferSize);
-			lpszDst = lpStringBuffer;
-
-			cchActual = 0;
-			// Only process if the actual value data is not NULL
-			if (NULL != lpData)
-			{
-				lpszSrc = (LPTSTR)lpData;
-				// Convert the byte count to a char count
-				cchToGo = cbData / sizeof(TCHAR);
-				while ((cchToGo > 0) && (*lpszSrc)) {
-					if (0 != cchActual)
-					{
-						// Add comma (",") to separate strings
-						//_tcscpy(lpszDst, TEXT(","));
-						_tcscpy_s(lpszDst, 2 * sizeof(TCHAR), TEXT(","));
-						// Increase the count by 1 to account for comma
-						lpszDst += 1;
-						cchActual += 1;
-					}
-					cchString = _tcsnlen(lpszSrc, cchToGo);
-					_tcsncpy(lpszDst, lpszSrc, cchString);
-					lpszDst += cchString;
-					cchActual += cchString;
-
-					// Decrease count for processed, if count ToGo is 0 then we are done
-					cchToGo -= cchString;
-					if (cchToGo == 0) {
-						break;
-					}
-
-					// Account for the NULL character
-					lpszSrc += cchString + 1;
-					cchToGo -= 1;
-				}
-			}
-			cchActual += 3 + 1;
-
-			// Allocate memory for the constructed string and copy to value data string
-			lpszValueData = MYALLOC(cchActual * sizeof(TCHAR));
-			_tcscpy(lpszValueData, lpStringBuffer);
-			//_tcscpy_s(lpszValueData, cchActual * sizeof(TCHAR), lpStringBuffer);
-
-			break;
-
-		case REG_DWORD_BIG_ENDIAN:
-			// convert DWORD big endian
-			lpDword = &nDwordCpu;
-			for (ibCurrent = 0; ibCurrent < sizeof(DWORD); ibCurrent++) {
-				((LPBYTE)&nDwordCpu)[ibCurrent] = lpData[sizeof(DWORD) - 1 - ibCurrent];
-			}
-			// Output format: "0xXXXXXXXX\0"
-			lpszValueData = MYALLOC0((3 + 8 + 1) * sizeof(TCHAR));
-			if (NULL != lpData) {
-				//_sntprintf(lpszValueData, (3 + 8 + 1), TEXT("0x%08X\0"), *lpDword);
-				_sntprintf_s(lpszValueData, (3 + 8 + 1) * sizeof(TCHAR), (3 + 8 + 1), TEXT("0x%08X\0"), *lpDword);
-			}
-			break;
-
-		case REG_DWORD:
-			// A native DWORD that can be displayed as DWORD
-			// This includes REG_DWORD_LITTLE_ENDIAN (the same as DWORD)
-			if (NULL == lpDword) {
-				lpDword = (LPDWORD)lpData;
-			}
-			// Output format: "0xXXXXXXXX\0"
-			lpszValueData = MYALLOC0((2 + 8 + 1) * sizeof(TCHAR));
-			if (NULL != lpData) {
-				_sntprintf(lpszValueData, (2 + 8 + 1), TEXT("0x%08X\0"), *lpDword);
-				//_sntprintf_s(lpszValueData, (2 + 8 + 1) * sizeof(TCHAR), (2 + 8 + 1), TEXT("0x%08X\0"), *lpDword);
-			}
-			break;
-
-		case REG_QWORD:
-			// A native QWORD that can be displayed as QWORD
-			// This includes REG_QWORD_LITTLE_ENDIAN (which is the same as QWORD)
-			if (NULL == lpQword) {
-				lpQword = (LPQWORD)lpData;
-			}
-			// Output format: "0xXXXXXXXXXXXXXXXX\0"
-			lpszValueData = MYALLOC0((3 + 16 + 1) * sizeof(TCHAR));
-			if (NULL != lpData) {
-				_sntprintf(lpszValueData, (3 + 16 + 1), TEXT("0x%016I64X\0"), *lpQword);
-			}
-			break;
-
-		default:
-			// Default processing and display method: Present value as hex bytes
-			// Output format: "[XX][XX]...[XX]\0"
-			lpszValueData = MYALLOC0((1 + (cbData * 3) + 1) * sizeof(TCHAR));
-			for (ibCurrent = 0; ibCurrent < cbData; ibCurrent++) {
-				_sntprintf(lpszValueData + (ibCurrent * 3), 4, TEXT(" %02X\0"), *(lpData + ibCurrent));
-			}
-			lpszValueData += 1; // Remove the first space character
-		}
-	}
-	return lpszValueData;
+	printf("                 CellXML.exe hive-file > output.xml\n");
+	printf("             5) Only output cells matching an indicator file:\n");
+	printf("                 CellXML.exe --match ioc-file hive-file\n");
+	printf("             6) Read the hive in file order (cold storage, network shares):\n");
+	printf("                 CellXML.exe --sequential hive-file\n");
+	printf("             7) Read the hive from standard input (stdin):\n");
+	printf("                 type hive-file | CellXML.exe -\n");
+	printf("             8) Read a hive at a byte offset inside a raw disk image:\n");
+	printf("                 CellXML.exe --image disk.dd --offset 0x1F400000 --length 262144\n");
+	printf("             9) Print triage statistics instead of a full export:\n");
+	printf("                 CellXML.exe --summary hive-file\n");
+	printf("            10) Give up on a corrupt hive after 10 million keys and values:\n");
+	printf("                 CellXML.exe --max-work 10000000 hive-file\n");
+	printf("            11) Reference repeated value data instead of writing it again:\n");
+	printf("                 CellXML.exe --dedup hive-file\n");
+	printf("            12) Add key security descriptors (SDDL) to the output:\n");
+	printf("                 CellXML.exe --security hive-file\n");
+	printf("            13) Split the output into 8 balanced shard files, with a manifest:\n");
+	printf("                 CellXML.exe --shard 8 --shard-prefix ntuser hive-file > manifest.xml\n");
+	printf("            14) Save checkpoints, then resume an interrupted export:\n");
+	printf("                 CellXML.exe --output out.xml --checkpoint out.chk hive-file\n");
+	printf("                 CellXML.exe --output out.xml --checkpoint out.chk --resume hive-file\n");
+	printf("            15) Keep hives open in a query server, then query it:\n");
+	printf("                 CellXML.exe serve cellxml.sock\n");
+	printf("                 CellXML.exe query cellxml.sock get-value hive-file Console ColorTable00\n");
+	printf("            16) Export a dirty hive as found, without replaying its transaction logs:\n");
+	printf("                 CellXML.exe --no-log-replay hive-file\n");
+	printf("            17) Convert an archived export to a store, then look up a subtree:\n");
+	printf("                 CellXML.exe ingest NTUSER.DAT.xml ntuser.store\n");
+	printf("                 CellXML.exe lookup ntuser.store --prefix $$$PROTO.HIV\\Console\n\n");
 }
-
-
-// ----------------------------------------------------------------------
-// Adjust the buffer 
-// ----------------------------------------------------------------------
-size_t AdjustBuffer(LPVOID *lpBuffer, size_t nCurrentSize, size_t nWantedSize, size_t nAlign)
-{
-	if (NULL == *lpBuffer) {
-		nCurrentSize = 0;
-	}
-
-	if (nWantedSize > nCurrentSize) {
-		if (NULL != *lpBuffer) {
-			MYFREE(*lpBuffer);
-			*lpBuffer = NULL;
-		}
-
-		if (1 >= nAlign) {
-			nCurrentSize = nWantedSize;
-		}
-		else {
-			nCurrentSize = nWantedSize / nAlign;
-			nCurrentSize *= nAlign;
-			if (nWantedSize > nCurrentSize) {
-				nCurrentSize += nAlign;
-			}
-		}
-
-		*lpBuffer = MYALLOC(nCurrentSize);
-	}
-	return nCurrentSize;
-}
-
-// ----------------------------------------------------------------------
-// Attempt to determine the Registry hive root key
-// Also perform a variety of structure/magic number checks
-// ----------------------------------------------------------------------
-LPTSTR determineRootKey(LPTSTR lpszHiveFileName)
-{
-	DWORD NBW;
-
-	// Open the hive file based on user passed file name
-	HANDLE hFileHive = CreateFile(lpszHiveFileName,
-		GENERIC_READ,
-		FILE_SHARE_READ,
-		NULL,
-		OPEN_EXISTING,
-		FILE_ATTRIBUTE_NORMAL,
-		NULL);
-
-	// Get the Hive file magic number: "regf"
-	// Exit if this does not look like a hive file
-	char szRegMagicNumber[5];
-	ReadFile(hFileHive, &szRegMagicNumber, 4 * sizeof(char), &NBW, NULL);
-	szRegMagicNumber[4] = (TCHAR)'\0';
-	if (strcmp(szRegMagicNumber, "regf") != 0) {
-		printf("\n>>> ERROR: Registry hive magic number match error.\n");
-		printf("  >        Check input file. Exiting.\n");
-		exit(0);
-	}
-
-	// Move to the first HBIN (4096 bytes into the file)
-	// Get the hbin magic number ("hbin")
-	DWORD dwPtr = SetFilePointer(hFileHive, 4096, NULL, FILE_BEGIN);
-	char szHbinMagicNumber[5];
-	ReadFile(hFileHive, &szHbinMagicNumber, 4 * sizeof(char), &NBW, NULL);
-	szHbinMagicNumber[4] = (TCHAR)'\0';
-	if (strcmp(szHbinMagicNumber, "hbin") != 0) {
-		printf("\n>>> ERROR: Registry hive hbin magic number match error.\n");
-		printf("  >        Check input file. Exiting.\n");
-		exit(0);
-	}
-
-	// Move to the Rootkey length offset (seems to always be 4204 bytes from start)
-	DWORD dwPtr2 = SetFilePointer(hFileHive, 4204, NULL, FILE_BEGIN);
-
-	// Determine key name length
-	int keyNameLength;
-	ReadFile(hFileHive, &keyNameLength, sizeof(DWORD), &NBW, NULL);
-	//printf("keyNameLength: %d\n", keyNameLength);
-
-	char chRootKeyName[MAX_KEY_NAME + 1];
-	ReadFile(hFileHive, &chRootKeyName, keyNameLength * sizeof(char), &NBW, NULL);
-	//printf("chRootKeyName: %s\n", chRootKeyName);
-
-	// Close the file handle
-	CloseHandle(hFileHive);
-
-	// Convert to wide string to return
-	wchar_t * lpszRootKey = MYALLOC0(keyNameLength * sizeof(wchar_t));
-	size_t convertedChars = 0;
-	mbstowcs_s(&convertedChars, lpszRootKey, keyNameLength + 1, chRootKeyName, _TRUNCATE);
-	//printf("lpszRootKey: %ws\n", lpszRootKey);
-	//exit(0);
-
-	return lpszRootKey;
-}
\ No newline at end of file
@@ -0,0 +1,265 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "CellXML-security.h"
+#include "CellXML-dedup.h"
+#include <sddl.h>
+#pragma comment (lib, "advapi32.lib")
+#pragma comment (lib, "ntdll.lib")
+
+// Exported by ntdll.dll, but only declared in the driver kit headers
+NTSYSAPI BOOLEAN NTAPI RtlValidRelativeSecurityDescriptor(PSECURITY_DESCRIPTOR SecurityDescriptorInput,
+	ULONG SecurityDescriptorLength, SECURITY_INFORMATION RequiredInformation);
+
+// ----------------------------------------------------------------------
+// CellXML security descriptor internal functions
+// ----------------------------------------------------------------------
+PSECURITYENTRY FindSecurityEntry(PSECURITYCACHE pCache, QWORD qwKey);
+PSECURITYENTRY AddSecurityEntry(PSECURITYCACHE pCache, QWORD qwKey, PSECURITY_DESCRIPTOR pDescriptor, DWORD cbDescriptor);
+DWORD GrowSecurityCache(PSECURITYCACHE pCache);
+LPWSTR FormatSecuritySddl(PSECURITY_DESCRIPTOR pDescriptor, DWORD cbDescriptor);
+BOOL CheckSecurityDescriptor(PSECURITY_DESCRIPTOR pDescriptor, DWORD cbDescriptor);
+BOOL CheckSecurityPart(LPBYTE lpDescriptor, DWORD cbDescriptor, DWORD dwOffset, BOOL bAcl);
+
+//-----------------------------------------------------------------
+// Allocate an empty security descriptor cache
+//-----------------------------------------------------------------
+DWORD InitSecurityCache(PSECURITYCACHE pCache)
+{
+	ZeroMemory(pCache, sizeof(SECURITYCACHE));
+	pCache->lpEntries = MYALLOC0(SECURITY_CACHE_SLOTS * sizeof(SECURITYENTRY));
+	if (NULL == pCache->lpEntries) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	pCache->nSlots = SECURITY_CACHE_SLOTS;
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Free the cache and every SDDL string in it
+//-----------------------------------------------------------------
+VOID FreeSecurityCache(PSECURITYCACHE pCache)
+{
+	DWORD i;
+
+	if (NULL != pCache->lpEntries) {
+		for (i = 0; i < pCache->nSlots; i++) {
+			if (NULL != pCache->lpEntries[i].lpszSddl) {
+				MYFREE(pCache->lpEntries[i].lpszSddl);
+			}
+		}
+		MYFREE(pCache->lpEntries);
+	}
+	ZeroMemory(pCache, sizeof(SECURITYCACHE));
+}
+
+//-----------------------------------------------------------------
+// Return the security descriptor of a visited key as SDDL
+// Keys sharing an sk cell are answered without reading the
+// descriptor at all, other keys by a hash of their descriptor.
+// Returns NULL if the key has no (valid) security descriptor.
+//-----------------------------------------------------------------
+LPCWSTR GetKeySecuritySddl(PSECURITYCACHE pCache, PCELLXMLKEY pKey)
+{
+	PSECURITY_DESCRIPTOR pDescriptor;
+	PSECURITYENTRY pEntry;
+	DWORD cbDescriptor;
+	QWORD qwKey;
+
+	qwKey = 0;
+	if (pKey->dwSecurityOffset != HIVE_NO_CELL) {
+		qwKey = SECURITY_KEY_CELL | pKey->dwSecurityOffset;
+		pEntry = FindSecurityEntry(pCache, qwKey);
+		if (NULL != pEntry->lpszSddl) {
+			return (pEntry->lpszSddl[0] == L'\0') ? NULL : pEntry->lpszSddl;
+		}
+	}
+
+	pDescriptor = GetVisitKeySecurity(pKey, &cbDescriptor);
+	if (NULL == pDescriptor) {
+		return NULL;
+	}
+	if (pKey->dwSecurityOffset == HIVE_NO_CELL) {
+		qwKey = HashData((LPBYTE)pDescriptor, cbDescriptor) & ~SECURITY_KEY_CELL;
+		pEntry = FindSecurityEntry(pCache, qwKey);
+		if (NULL != pEntry->lpszSddl) {
+			return (pEntry->lpszSddl[0] == L'\0') ? NULL : pEntry->lpszSddl;
+		}
+	}
+
+	pEntry = AddSecurityEntry(pCache, qwKey, pDescriptor, cbDescriptor);
+	if (NULL == pEntry || pEntry->lpszSddl[0] == L'\0') {
+		return NULL;
+	}
+	return pEntry->lpszSddl;
+}
+
+// ----------------------------------------------------------------------
+// Find the slot of a cache key: the slot holding it, or the free slot
+// where it would be added (the cache always has free slots)
+// ----------------------------------------------------------------------
+PSECURITYENTRY FindSecurityEntry(PSECURITYCACHE pCache, QWORD qwKey)
+{
+	PSECURITYENTRY pEntry;
+	DWORD iSlot;
+
+	iSlot = (DWORD)(qwKey ^ (qwKey >> 32)) * 0x9E3779B1;
+	for (;;) {
+		iSlot &= pCache->nSlots - 1;
+		pEntry = &pCache->lpEntries[iSlot];
+		if (NULL == pEntry->lpszSddl || pEntry->qwKey == qwKey) {
+			return pEntry;
+		}
+		iSlot++;
+	}
+}
+
+// ----------------------------------------------------------------------
+// Convert a descriptor (of cbDescriptor bytes) and add it to the cache
+// ----------------------------------------------------------------------
+PSECURITYENTRY AddSecurityEntry(PSECURITYCACHE pCache, QWORD qwKey, PSECURITY_DESCRIPTOR pDescriptor, DWORD cbDescriptor)
+{
+	PSECURITYENTRY pEntry;
+	LPWSTR lpszSddl;
+
+	// Keep the table at most three quarters full
+	if ((pCache->nUsed + 1) * 4 > pCache->nSlots * 3) {
+		if (GrowSecurityCache(pCache) != ERROR_SUCCESS) {
+			return NULL;
+		}
+	}
+	lpszSddl = FormatSecuritySddl(pDescriptor, cbDescriptor);
+	if (NULL == lpszSddl) {
+		return NULL;
+	}
+
+	pEntry = FindSecurityEntry(pCache, qwKey);
+	pEntry->qwKey = qwKey;
+	pEntry->lpszSddl = lpszSddl;
+	pCache->nUsed++;
+	return pEntry;
+}
+
+// ----------------------------------------------------------------------
+// Double the size of the cache and add the entries again
+// ----------------------------------------------------------------------
+DWORD GrowSecurityCache(PSECURITYCACHE pCache)
+{
+	PSECURITYENTRY lpOldEntries;
+	PSECURITYENTRY pEntry;
+	DWORD nOldSlots;
+	DWORD i;
+
+	lpOldEntries = pCache->lpEntries;
+	nOldSlots = pCache->nSlots;
+	pCache->lpEntries = MYALLOC0(nOldSlots * 2 * sizeof(SECURITYENTRY));
+	if (NULL == pCache->lpEntries) {
+		pCache->lpEntries = lpOldEntries;
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	pCache->nSlots = nOldSlots * 2;
+
+	for (i = 0; i < nOldSlots; i++) {
+		if (NULL != lpOldEntries[i].lpszSddl) {
+			pEntry = FindSecurityEntry(pCache, lpOldEntries[i].qwKey);
+			*pEntry = lpOldEntries[i];
+		}
+	}
+	MYFREE(lpOldEntries);
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Convert a self-relative security descriptor to an SDDL string
+// A descriptor that cannot be converted (corrupt hive) becomes an
+// empty string, so it is only tried once. Nothing is converted
+// before the descriptor is known to fit in its cbDescriptor bytes.
+// ----------------------------------------------------------------------
+LPWSTR FormatSecuritySddl(PSECURITY_DESCRIPTOR pDescriptor, DWORD cbDescriptor)
+{
+	LPWSTR lpszConverted;
+	LPWSTR lpszSddl;
+	size_t cchSddl;
+
+	lpszConverted = NULL;
+	if (!CheckSecurityDescriptor(pDescriptor, cbDescriptor) ||
+		!ConvertSecurityDescriptorToStringSecurityDescriptorW(pDescriptor, SDDL_REVISION_1,
+			KEY_SECURITY_INFORMATION, &lpszConverted, NULL))
+	{
+		return MYALLOC0(sizeof(WCHAR));
+	}
+
+	cchSddl = _tcslen(lpszConverted);
+	lpszSddl = MYALLOC((cchSddl + 1) * sizeof(WCHAR));
+	if (NULL != lpszSddl) {
+		memcpy(lpszSddl, lpszConverted, (cchSddl + 1) * sizeof(WCHAR));
+	}
+	LocalFree(lpszConverted);
+	return lpszSddl;
+}
+
+// ----------------------------------------------------------------------
+// Check that a self-relative descriptor read from a hive (sk cell or
+// ORGetKeySecurity) lies within its cbDescriptor bytes: the owner and
+// group SIDs and the SACL and DACL must all end inside the descriptor
+// ----------------------------------------------------------------------
+BOOL CheckSecurityDescriptor(PSECURITY_DESCRIPTOR pDescriptor, DWORD cbDescriptor)
+{
+	PISECURITY_DESCRIPTOR_RELATIVE pRelative;
+
+	if (cbDescriptor < sizeof(SECURITY_DESCRIPTOR_RELATIVE) ||
+		!RtlValidRelativeSecurityDescriptor(pDescriptor, cbDescriptor, 0))
+	{
+		return FALSE;
+	}
+	pRelative = (PISECURITY_DESCRIPTOR_RELATIVE)pDescriptor;
+	if (!(pRelative->Control & SE_SELF_RELATIVE)) {
+		return FALSE;
+	}
+	return CheckSecurityPart((LPBYTE)pDescriptor, cbDescriptor, pRelative->Owner, FALSE) &&
+		CheckSecurityPart((LPBYTE)pDescriptor, cbDescriptor, pRelative->Group, FALSE) &&
+		CheckSecurityPart((LPBYTE)pDescriptor, cbDescriptor, pRelative->Sacl, TRUE) &&
+		CheckSecurityPart((LPBYTE)pDescriptor, cbDescriptor, pRelative->Dacl, TRUE);
+}
+
+// ----------------------------------------------------------------------
+// Check that a SID or an ACL at dwOffset (0 if not present) ends
+// inside the descriptor, both have an 8 byte header holding their size
+// ----------------------------------------------------------------------
+BOOL CheckSecurityPart(LPBYTE lpDescriptor, DWORD cbDescriptor, DWORD dwOffset, BOOL bAcl)
+{
+	DWORD cbPart;
+
+	if (dwOffset == 0) {
+		return TRUE;
+	}
+	if (dwOffset > cbDescriptor - 8) {
+		return FALSE;
+	}
+	if (bAcl) {
+		cbPart = ((PACL)(lpDescriptor + dwOffset))->AclSize;
+	}
+	else {
+		cbPart = GetSidLengthRequired(((PISID)(lpDescriptor + dwOffset))->SubAuthorityCount);
+	}
+	return cbPart <= cbDescriptor - dwOffset;
+}
@@ -0,0 +1,59 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#pragma once
+#ifndef __CELLXML_SECURITY_H__
+#define __CELLXML_SECURITY_H__
+
+#include "CellXML-api.h"
+
+#define SECURITY_CACHE_SLOTS	256						// Initial cache size (a power of 2)
+#define SECURITY_KEY_CELL		0x8000000000000000ULL	// Cache key is an sk cell offset, not a hash
+
+// ----------------------------------------------------------------------
+// A security descriptor converted to SDDL
+// ----------------------------------------------------------------------
+typedef struct _SECURITYENTRY {
+	QWORD	qwKey;					// sk cell offset (with SECURITY_KEY_CELL) or descriptor hash
+	LPWSTR	lpszSddl;				// Descriptor as SDDL ("" if invalid), NULL for a free slot
+} SECURITYENTRY, *PSECURITYENTRY;
+
+// ----------------------------------------------------------------------
+// Cache of key security descriptors in SDDL form
+// A hive only has a few hundred sk cells, each shared by many keys,
+// so every descriptor is converted once: keys are looked up by their
+// sk cell, or by a hash of the descriptor when the cell is unknown
+// ----------------------------------------------------------------------
+typedef struct _SECURITYCACHE {
+	PSECURITYENTRY lpEntries;		// Open addressing table
+	DWORD	nSlots;					// Size of lpEntries (a power of 2)
+	DWORD	nUsed;					// Slots in use
+} SECURITYCACHE, *PSECURITYCACHE;
+
+// ----------------------------------------------------------------------
+// CellXML security descriptor functions
+// ----------------------------------------------------------------------
+DWORD InitSecurityCache(PSECURITYCACHE pCache);
+VOID FreeSecurityCache(PSECURITYCACHE pCache);
+LPCWSTR GetKeySecuritySddl(PSECURITYCACHE pCache, PCELLXMLKEY pKey);
+
+#endif // __CELLXML_SECURITY_H__
@@ -0,0 +1,547 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "CellXML-sequential.h"
+
+// ----------------------------------------------------------------------
+// State of a sequential traversal
+// Key nodes and value keys are stored in ascending cell offset order
+// ----------------------------------------------------------------------
+typedef struct _SEQWALK {
+	PHIVEFILE	pHive;				// Hive being traversed
+	PHIVEKEYNODE lpKeys;			// Key nodes found by the cell scan
+	DWORD		nKeys;
+	DWORD		nMaxKeys;
+	PHIVEVALUEKEY lpValues;			// Value keys found by the cell scan
+	DWORD		nValues;
+	DWORD		nMaxValues;
+	LPBYTE		lpBigData;			// Big data of the last value read (only one is kept)
+	BOOL		bDirect;			// Cells are read from the hive when reached (no cell scan)
+	LPWSTR		szPath;				// Path of the current key or value
+	size_t		cchMaxPath;
+	PCELLXMLVISITOR pVisitor;		// Visitor receiving keys and values
+	HIVEWALKGUARD Guard;			// Visited key cells and work budget
+	CELLXMLPOSITION Position;		// Position of the current key
+	PCELLXMLPOSITION pResume;		// Key the walk resumes at (NULL once reached)
+	BOOL		bStopped;			// A visitor returned VISIT_STOP, or the work budget ran out
+} SEQWALK, *PSEQWALK;
+
+// ----------------------------------------------------------------------
+// CellXML sequential traversal internal functions
+// ----------------------------------------------------------------------
+DWORD CollectCells(PSEQWALK pWalk);
+DWORD WalkFromKey(PSEQWALK pWalk, PHIVEKEYNODE pKeyNode, LPCWSTR szKeyPath, size_t cchName, DWORD nDepth);
+VOID EmitKeySequential(PSEQWALK pWalk, PHIVEKEYNODE pKeyNode, size_t cchPath, size_t cchName, DWORD nDepth);
+BOOL GetWalkKeyNode(PSEQWALK pWalk, DWORD dwCellOffset, PHIVEKEYNODE pKeyNode);
+BOOL GetWalkValueKey(PSEQWALK pWalk, DWORD dwCellOffset, PHIVEVALUEKEY pValueKey);
+PHIVEKEYNODE FindKeyNode(PSEQWALK pWalk, DWORD dwCellOffset);
+PHIVEVALUEKEY FindValue(PSEQWALK pWalk, DWORD dwCellOffset);
+DWORD ReadSequentialValueData(PCELLXMLVALUE pValue);
+VOID FreeSequentialWalk(PSEQWALK pWalk);
+
+//-----------------------------------------------------------------
+// Enumerate the hive in file offset order, output in tree order
+// 1) Scan every hbin front to back (with readahead hints) and keep
+//    each key node and value key cell
+// 2) Walk the buffered cells depth first, visiting keys and values
+//    in the same order as offreg.dll. Value data is only read when
+//    the visitor asks for it, from hive bins the scan read ahead.
+// pResume is the position of the first key to visit, or NULL
+//-----------------------------------------------------------------
+DWORD EnumerateKeysSequential(PHIVEFILE pHive, LPCWSTR szRootKeyName, PCELLXMLVISITOR pVisitor, QWORD qwMaxWork,
+	PCELLXMLPOSITION pResume)
+{
+	SEQWALK Walk;
+	PHIVEKEYNODE pRootKey;
+	size_t cchRootKey;
+	DWORD dwError;
+
+	ZeroMemory(&Walk, sizeof(SEQWALK));
+	Walk.pHive = pHive;
+	Walk.pVisitor = pVisitor;
+	Walk.pResume = (NULL != pResume && pResume->nDepth > 0) ? pResume : NULL;
+
+	dwError = InitWalkGuard(pHive, qwMaxWork, &Walk.Guard);
+	if (dwError == ERROR_SUCCESS) {
+		dwError = CollectCells(&Walk);
+	}
+	if (dwError != ERROR_SUCCESS) {
+		FreeSequentialWalk(&Walk);
+		return dwError;
+	}
+
+	pRootKey = FindKeyNode(&Walk, pHive->dwRootCellOffset);
+	if (NULL == pRootKey) {
+		FreeSequentialWalk(&Walk);
+		return ERROR_REGISTRY_CORRUPT;
+	}
+	cchRootKey = _tcslen(szRootKeyName);
+	dwError = WalkFromKey(&Walk, pRootKey, szRootKeyName, cchRootKey, 0);
+	FreeSequentialWalk(&Walk);
+	return dwError;
+}
+
+//-----------------------------------------------------------------
+// Walk the subtree of one key, reading its cells from the mapped
+// hive as they are reached (no cell scan), in the same order as
+// EnumerateKeysSequential. szKeyPath is the full path of the key
+// (its name is the last cchName characters) at depth nDepth.
+//-----------------------------------------------------------------
+DWORD EnumerateSubtreeCells(PHIVEFILE pHive, LPCWSTR szKeyPath, size_t cchName, DWORD nDepth, DWORD dwCellOffset,
+	PCELLXMLVISITOR pVisitor, QWORD qwMaxWork)
+{
+	SEQWALK Walk;
+	HIVEKEYNODE KeyNode;
+	DWORD dwError;
+
+	if (!ReadKeyNode(pHive, dwCellOffset, &KeyNode)) {
+		return ERROR_REGISTRY_CORRUPT;
+	}
+	ZeroMemory(&Walk, sizeof(SEQWALK));
+	Walk.pHive = pHive;
+	Walk.pVisitor = pVisitor;
+	Walk.bDirect = TRUE;
+	dwError = InitWalkGuard(pHive, qwMaxWork, &Walk.Guard);
+	if (dwError == ERROR_SUCCESS) {
+		dwError = WalkFromKey(&Walk, &KeyNode, szKeyPath, cchName, nDepth);
+	}
+	FreeSequentialWalk(&Walk);
+	return dwError;
+}
+
+// ----------------------------------------------------------------------
+// Set up the path buffer (one is shared by the whole walk), visit a
+// key and everything below it, and return the result of the walk
+// ----------------------------------------------------------------------
+DWORD WalkFromKey(PSEQWALK pWalk, PHIVEKEYNODE pKeyNode, LPCWSTR szKeyPath, size_t cchName, DWORD nDepth)
+{
+	size_t cchKeyPath;
+
+	cchKeyPath = _tcslen(szKeyPath);
+	pWalk->cchMaxPath = cchKeyPath + MAX_KEY_DEPTH * (MAX_KEY_NAME + 1) + MAX_VALUE_NAME + 2;
+	pWalk->szPath = MYALLOC(pWalk->cchMaxPath * sizeof(WCHAR));
+	if (NULL == pWalk->szPath) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	memcpy(pWalk->szPath, szKeyPath, (cchKeyPath + 1) * sizeof(WCHAR));
+
+	EmitKeySequential(pWalk, pKeyNode, cchKeyPath, cchName, nDepth);
+
+	if (pWalk->Guard.bExhausted) {
+		return ERROR_NOT_ENOUGH_QUOTA;
+	}
+	if (NULL != pWalk->pResume) {
+		return ERROR_NOT_FOUND;
+	}
+	if (pWalk->bStopped) {
+		return ERROR_CANCELLED;
+	}
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Pass 1: scan all hive bins in file order and keep nk and vk cells
+// A prefetch window is kept ahead of the scan so cold reads are
+// large and sequential instead of seeking for every cell
+// ----------------------------------------------------------------------
+DWORD CollectCells(PSEQWALK pWalk)
+{
+	PHIVEFILE pHive;
+	LPBYTE lpBase;
+	QWORD qwEnd;
+	QWORD qwBin;
+	QWORD qwBinEnd;
+	QWORD qwCell;
+	QWORD qwPrefetched;
+	DWORD cbBin;
+	DWORD cbCell;
+	LONG nCellSize;
+
+	pHive = pWalk->pHive;
+	lpBase = pHive->lpBase;
+	qwEnd = (QWORD)HIVE_BASE_BLOCK_SIZE + pHive->cbHiveBins;
+	if (qwEnd > pHive->cbFile) {
+		qwEnd = pHive->cbFile;
+	}
+
+	qwPrefetched = HIVE_BASE_BLOCK_SIZE;
+	for (qwBin = HIVE_BASE_BLOCK_SIZE; qwBin + HBIN_HEADER_SIZE <= qwEnd; qwBin = qwBinEnd)
+	{
+		// Keep at least half a prefetch window ahead of the scan
+		if (qwBin + PREFETCH_WINDOW / 2 >= qwPrefetched) {
+			PrefetchHiveRange(pHive, qwPrefetched, PREFETCH_WINDOW);
+			qwPrefetched += PREFETCH_WINDOW;
+		}
+
+		if (*(LPDWORD)(lpBase + qwBin) != HIVE_HBIN_SIGNATURE) {
+			break;
+		}
+		cbBin = *(LPDWORD)(lpBase + qwBin + HBIN_SIZE);
+		if (cbBin < HBIN_HEADER_SIZE || qwBin + cbBin > qwEnd) {
+			break;
+		}
+		qwBinEnd = qwBin + cbBin;
+
+		for (qwCell = qwBin + HBIN_HEADER_SIZE; qwCell + sizeof(LONG) <= qwBinEnd; qwCell += cbCell)
+		{
+			// Allocated cells have a negative size, free cells are skipped
+			nCellSize = *(LONG *)(lpBase + qwCell);
+			cbCell = (nCellSize < 0) ? 0 - (DWORD)nCellSize : (DWORD)nCellSize;
+			if (cbCell < 2 * sizeof(DWORD) || qwCell + cbCell > qwBinEnd) {
+				break;
+			}
+			if (nCellSize >= 0) {
+				continue;
+			}
+
+			switch (*(LPWORD)(lpBase + qwCell + sizeof(LONG))) {
+			case HIVE_NK_SIGNATURE:
+				if (pWalk->nKeys == pWalk->nMaxKeys) {
+					PHIVEKEYNODE lpKeys;
+					DWORD nMaxKeys = (pWalk->nMaxKeys == 0) ? 1024 : pWalk->nMaxKeys * 2;
+					lpKeys = (NULL == pWalk->lpKeys) ? MYALLOC(nMaxKeys * sizeof(HIVEKEYNODE)) :
+						MYREALLOC(pWalk->lpKeys, nMaxKeys * sizeof(HIVEKEYNODE));
+					if (NULL == lpKeys) {
+						return ERROR_NOT_ENOUGH_MEMORY;
+					}
+					pWalk->lpKeys = lpKeys;
+					pWalk->nMaxKeys = nMaxKeys;
+				}
+				if (ParseKeyNode(lpBase + qwCell + sizeof(LONG), cbCell - sizeof(LONG),
+					(DWORD)(qwCell - HIVE_BASE_BLOCK_SIZE), &pWalk->lpKeys[pWalk->nKeys]))
+				{
+					pWalk->nKeys++;
+				}
+				break;
+
+			case HIVE_VK_SIGNATURE:
+				if (pWalk->nValues == pWalk->nMaxValues) {
+					PHIVEVALUEKEY lpValues;
+					DWORD nMaxValues = (pWalk->nMaxValues == 0) ? 1024 : pWalk->nMaxValues * 2;
+					lpValues = (NULL == pWalk->lpValues) ? MYALLOC(nMaxValues * sizeof(HIVEVALUEKEY)) :
+						MYREALLOC(pWalk->lpValues, nMaxValues * sizeof(HIVEVALUEKEY));
+					if (NULL == lpValues) {
+						return ERROR_NOT_ENOUGH_MEMORY;
+					}
+					pWalk->lpValues = lpValues;
+					pWalk->nMaxValues = nMaxValues;
+				}
+				if (ParseValueKey(lpBase + qwCell + sizeof(LONG), cbCell - sizeof(LONG),
+					(DWORD)(qwCell - HIVE_BASE_BLOCK_SIZE), &pWalk->lpValues[pWalk->nValues]))
+				{
+					pWalk->nValues++;
+				}
+				break;
+			}
+		}
+	}
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Pass 2: visit a key, its values and (recursively) its subkeys
+// (a direct walk reads each key and value cell here instead)
+// szPath holds the key path (cchPath characters), names are appended
+// in place and removed again after each value or subkey. Each key
+// cell is visited once, whatever number of subkey lists it is in.
+// When resuming, keys are only marked and charged (without callbacks
+// and without their values) until the resumed key is reached.
+// ----------------------------------------------------------------------
+VOID EmitKeySequential(PSEQWALK pWalk, PHIVEKEYNODE pKeyNode, size_t cchPath, size_t cchName, DWORD nDepth)
+{
+	PHIVEFILE pHive;
+	CELLXMLKEY Key;
+	CELLXMLVALUE Value;
+	LPDWORD lpValueList;
+	LPDWORD lpSubkeys;
+	DWORD nSubkeys;
+	DWORD nValues;
+	DWORD dwAction;
+	DWORD i;
+	LPWSTR szName;
+
+	pHive = pWalk->pHive;
+	szName = pWalk->szPath + cchPath + 1;
+	if (!ChargeWalkWork(&pWalk->Guard)) {
+		pWalk->bStopped = TRUE;
+		return;
+	}
+	if (!MarkKeyVisited(&pWalk->Guard, pKeyNode->dwOffset)) {
+		return;
+	}
+	pWalk->Position.nDepth = nDepth;
+	if (NULL != pWalk->pResume && nDepth == pWalk->pResume->nDepth &&
+		memcmp(&pWalk->Position.Indices[1], &pWalk->pResume->Indices[1], nDepth * sizeof(DWORD)) == 0)
+	{
+		pWalk->pResume = NULL;
+	}
+
+	// Never trust the counts in the key node beyond the real list sizes
+	nValues = pKeyNode->nValues;
+	lpValueList = GetValueList(pHive, pKeyNode->dwValueList, &nValues);
+	nSubkeys = GetSubkeyOffsets(pHive, pKeyNode->dwSubkeyList, NULL, pKeyNode->nSubkeys);
+
+	ZeroMemory(&Key, sizeof(CELLXMLKEY));
+	Key.lpszPath = pWalk->szPath;
+	Key.cchPath = cchPath;
+	Key.lpszName = pWalk->szPath + cchPath - cchName;
+	Key.cchName = cchName;
+	Key.ftLastWriteTime = pKeyNode->ftLastWriteTime;
+	Key.nSubkeys = nSubkeys;
+	Key.nValues = nValues;
+	Key.nDepth = nDepth;
+	Key.dwSecurityOffset = pKeyNode->dwSecurity;
+	Key.pPosition = pWalk->bDirect ? NULL : &pWalk->Position;
+	Key.pHive = pHive;
+	Key.lpWalk = pWalk;
+
+	dwAction = VISIT_CONTINUE;
+	if (NULL == pWalk->pResume && NULL != pWalk->pVisitor->OnKey) {
+		dwAction = pWalk->pVisitor->OnKey(pWalk->pVisitor->lpContext, &Key);
+	}
+	if (dwAction == VISIT_STOP) {
+		pWalk->bStopped = TRUE;
+	}
+	if (dwAction != VISIT_CONTINUE) {
+		return;
+	}
+
+	// Values, in value list order (data is read by GetVisitValueData)
+	for (i = 0; NULL != lpValueList && i < nValues && NULL != pWalk->pVisitor->OnValue; i++)
+	{
+		HIVEVALUEKEY ValueKey;
+		if (!ChargeWalkWork(&pWalk->Guard)) {
+			pWalk->bStopped = TRUE;
+			return;
+		}
+		if (NULL != pWalk->pResume) {
+			continue;
+		}
+		if (!GetWalkValueKey(pWalk, lpValueList[i], &ValueKey)) {
+			continue;
+		}
+
+		ZeroMemory(&Value, sizeof(CELLXMLVALUE));
+		pWalk->szPath[cchPath] = L'\\';
+		if (ValueKey.cbName == 0) {
+			memcpy(szName, TEXT("(Default)"), 10 * sizeof(WCHAR));
+			Value.lpszName = L"";
+			Value.cchPath = cchPath + 1 + 9;
+		}
+		else {
+			Value.cchName = CopyHiveName(ValueKey.lpName, ValueKey.cbName,
+				ValueKey.wFlags & VK_VALUE_COMP_NAME,
+				szName, (DWORD)(pWalk->cchMaxPath - cchPath - 1));
+			Value.lpszName = szName;
+			Value.cchPath = cchPath + 1 + Value.cchName;
+		}
+		Value.lpszPath = pWalk->szPath;
+		Value.dwType = ValueKey.dwType;
+		Value.cbData = ValueKey.dwDataSize & ~VK_DATA_INLINE;
+		if (ValueKey.dwDataSize & VK_DATA_INLINE) {
+			Value.cbData = min(Value.cbData, (DWORD)sizeof(DWORD));
+		}
+		Value.dwCellOffset = lpValueList[i];
+		Value.lpWalk = pWalk;
+		Value.lpKey = &ValueKey;
+		Value.pfnReadData = ReadSequentialValueData;
+
+		dwAction = pWalk->pVisitor->OnValue(pWalk->pVisitor->lpContext, &Key, &Value);
+		pWalk->szPath[cchPath] = L'\0';
+		if (dwAction == VISIT_STOP) {
+			pWalk->bStopped = TRUE;
+			return;
+		}
+		if (dwAction == VISIT_SKIP) {
+			break;
+		}
+	}
+
+	// Subkeys, in subkey list order (the same order as offreg.dll)
+	if (nSubkeys == 0 || nDepth >= MAX_KEY_DEPTH) {
+		return;
+	}
+	lpSubkeys = MYALLOC(nSubkeys * sizeof(DWORD));
+	if (NULL == lpSubkeys) {
+		return;
+	}
+	nSubkeys = GetSubkeyOffsets(pHive, pKeyNode->dwSubkeyList, lpSubkeys, nSubkeys);
+	for (i = 0; i < nSubkeys && !pWalk->bStopped; i++)
+	{
+		HIVEKEYNODE Subkey;
+		DWORD cchSubkey;
+
+		if (!GetWalkKeyNode(pWalk, lpSubkeys[i], &Subkey)) {
+			if (!ChargeWalkWork(&pWalk->Guard)) {
+				pWalk->bStopped = TRUE;
+			}
+			continue;
+		}
+
+		pWalk->szPath[cchPath] = L'\\';
+		cchSubkey = CopyHiveName(Subkey.lpName, Subkey.cbName,
+			Subkey.wFlags & NK_KEY_COMP_NAME,
+			szName, min(MAX_KEY_NAME + 1, (DWORD)(pWalk->cchMaxPath - cchPath - 1)));
+		pWalk->Position.Indices[nDepth + 1] = i;
+		EmitKeySequential(pWalk, &Subkey, cchPath + 1 + cchSubkey, cchSubkey, nDepth + 1);
+		pWalk->szPath[cchPath] = L'\0';
+	}
+	MYFREE(lpSubkeys);
+}
+
+// ----------------------------------------------------------------------
+// Get a key node: from the hive in a direct walk, else from the cells
+// buffered by the scan (a cell the scan did not find is not a key)
+// ----------------------------------------------------------------------
+BOOL GetWalkKeyNode(PSEQWALK pWalk, DWORD dwCellOffset, PHIVEKEYNODE pKeyNode)
+{
+	PHIVEKEYNODE pFound;
+
+	if (pWalk->bDirect) {
+		return ReadKeyNode(pWalk->pHive, dwCellOffset, pKeyNode);
+	}
+	pFound = FindKeyNode(pWalk, dwCellOffset);
+	if (NULL == pFound) {
+		return FALSE;
+	}
+	*pKeyNode = *pFound;
+	return TRUE;
+}
+
+// ----------------------------------------------------------------------
+// Get a value key, in the same way as GetWalkKeyNode
+// ----------------------------------------------------------------------
+BOOL GetWalkValueKey(PSEQWALK pWalk, DWORD dwCellOffset, PHIVEVALUEKEY pValueKey)
+{
+	PHIVEVALUEKEY pFound;
+
+	if (pWalk->bDirect) {
+		return ReadValueKey(pWalk->pHive, dwCellOffset, pValueKey);
+	}
+	pFound = FindValue(pWalk, dwCellOffset);
+	if (NULL == pFound) {
+		return FALSE;
+	}
+	*pValueKey = *pFound;
+	return TRUE;
+}
+
+// ----------------------------------------------------------------------
+// Find a buffered key node by cell offset (binary search)
+// ----------------------------------------------------------------------
+PHIVEKEYNODE FindKeyNode(PSEQWALK pWalk, DWORD dwCellOffset)
+{
+	DWORD iLow;
+	DWORD iHigh;
+	DWORD iMiddle;
+
+	iLow = 0;
+	iHigh = pWalk->nKeys;
+	while (iLow < iHigh) {
+		iMiddle = iLow + (iHigh - iLow) / 2;
+		if (pWalk->lpKeys[iMiddle].dwOffset < dwCellOffset) {
+			iLow = iMiddle + 1;
+		}
+		else {
+			iHigh = iMiddle;
+		}
+	}
+	if (iLow < pWalk->nKeys && pWalk->lpKeys[iLow].dwOffset == dwCellOffset) {
+		return &pWalk->lpKeys[iLow];
+	}
+	return NULL;
+}
+
+// ----------------------------------------------------------------------
+// Find a buffered value key by cell offset (binary search)
+// ----------------------------------------------------------------------
+PHIVEVALUEKEY FindValue(PSEQWALK pWalk, DWORD dwCellOffset)
+{
+	DWORD iLow;
+	DWORD iHigh;
+	DWORD iMiddle;
+
+	iLow = 0;
+	iHigh = pWalk->nValues;
+	while (iLow < iHigh) {
+		iMiddle = iLow + (iHigh - iLow) / 2;
+		if (pWalk->lpValues[iMiddle].dwOffset < dwCellOffset) {
+			iLow = iMiddle + 1;
+		}
+		else {
+			iHigh = iMiddle;
+		}
+	}
+	if (iLow < pWalk->nValues && pWalk->lpValues[iLow].dwOffset == dwCellOffset) {
+		return &pWalk->lpValues[iLow];
+	}
+	return NULL;
+}
+
+// ----------------------------------------------------------------------
+// Read the data of a visited value (lpKey is its value key)
+// Data stays in the mapped hive, except big data: its segments are
+// copied to one buffer, which is freed when the next value is read
+// ----------------------------------------------------------------------
+DWORD ReadSequentialValueData(PCELLXMLVALUE pValue)
+{
+	PSEQWALK pWalk;
+	LPBYTE lpData;
+	DWORD cbData;
+	BOOL bAllocated;
+
+	pWalk = (PSEQWALK)pValue->lpWalk;
+	if (NULL != pWalk->lpBigData) {
+		MYFREE(pWalk->lpBigData);
+		pWalk->lpBigData = NULL;
+	}
+	lpData = GetValueData(pWalk->pHive, (PHIVEVALUEKEY)pValue->lpKey, &cbData, &bAllocated);
+	if (NULL == lpData) {
+		return ERROR_BADDB;
+	}
+	if (bAllocated) {
+		pWalk->lpBigData = lpData;
+	}
+	pValue->lpData = lpData;
+	pValue->cbData = cbData;
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Free the buffered cells, the big data buffer and the path buffer
+// ----------------------------------------------------------------------
+VOID FreeSequentialWalk(PSEQWALK pWalk)
+{
+	if (NULL != pWalk->lpValues) {
+		MYFREE(pWalk->lpValues);
+	}
+	if (NULL != pWalk->lpBigData) {
+		MYFREE(pWalk->lpBigData);
+	}
+	if (NULL != pWalk->lpKeys) {
+		MYFREE(pWalk->lpKeys);
+	}
+	if (NULL != pWalk->szPath) {
+		MYFREE(pWalk->szPath);
+	}
+	FreeWalkGuard(&pWalk->Guard);
+	ZeroMemory(pWalk, sizeof(SEQWALK));
+}
@@ -0,0 +1,38 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#ifndef __CELLXML_SEQUENTIAL_H__
+#define __CELLXML_SEQUENTIAL_H__
+
+#include "CellXML-api.h"
+
+#define PREFETCH_WINDOW		(8 * 1024 * 1024)	// Readahead window for the cell scan
+
+// ----------------------------------------------------------------------
+// CellXML sequential (file offset ordered) traversal functions
+// ----------------------------------------------------------------------
+DWORD EnumerateKeysSequential(PHIVEFILE pHive, LPCWSTR szRootKeyName, PCELLXMLVISITOR pVisitor, QWORD qwMaxWork,
+	PCELLXMLPOSITION pResume);
+DWORD EnumerateSubtreeCells(PHIVEFILE pHive, LPCWSTR szKeyPath, size_t cchName, DWORD nDepth, DWORD dwCellOffset,
+	PCELLXMLVISITOR pVisitor, QWORD qwMaxWork);
+
+#endif // __CELLXML_SEQUENTIAL_H__
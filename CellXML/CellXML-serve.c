@@ -0,0 +1,961 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <winsock2.h>
+#include <afunix.h>
+#include <stdlib.h>
+#include "CellXML-serve.h"
+#include "CellXML-log.h"
+
+#pragma comment (lib, "ws2_32.lib")
+
+// Longest key or value path (in characters): a root key name (up to
+// 65535 characters), a requested key path and a subkey or value name
+#define SERVE_MAX_PATH		(65536 + SERVE_MAX_REQUEST + MAX_KEY_NAME + MAX_VALUE_NAME + 4)
+
+#define SERVE_GET_KEY		1			// Requests (first field of a request line)
+#define SERVE_LIST_CHILDREN	2
+#define SERVE_GET_VALUE		3
+#define SERVE_SUBTREE		4
+
+// ----------------------------------------------------------------------
+// CellXML query server internal functions
+// ----------------------------------------------------------------------
+PHIVEFILE OpenServedHive(PCELLXMLSERVER pServer, LPCWSTR lpszFileName, PDWORD lpdwError);
+VOID CloseServedHive(PCELLXMLSERVER pServer, PSERVEDHIVE pServed);
+DWORD ResolveServedKey(PCELLXMLSERVER pServer, PHIVEFILE pHive, LPCWSTR lpszPath, size_t cchPath, PSERVEDKEY *ppKey);
+PSERVEDKEY FindServedKey(PCELLXMLSERVER pServer, PHIVEFILE pHive, LPCWSTR lpszPath, size_t cchPath);
+PSERVEDKEY AddServedKey(PCELLXMLSERVER pServer, PHIVEFILE pHive, DWORD dwCellOffset, LPCWSTR lpszPath, size_t cchPath);
+VOID DropServedKey(PCELLXMLSERVER pServer, DWORD iKey);
+QWORD HashServedPath(LPCWSTR lpszPath, size_t cchPath);
+DWORD FindSubkeyCell(PHIVEFILE pHive, PHIVEKEYNODE pKeyNode, LPCWSTR szName, DWORD cchName);
+size_t GetServedKeyPath(PCELLXMLSERVER pServer, PHIVEFILE pHive, PSERVEDKEY pKey);
+DWORD ServeGetKey(PCELLXMLSERVER pServer, PHIVEFILE pHive, PSERVEDKEY pKey);
+DWORD ServeListChildren(PCELLXMLSERVER pServer, PHIVEFILE pHive, PSERVEDKEY pKey);
+DWORD ServeGetValue(PCELLXMLSERVER pServer, PHIVEFILE pHive, PSERVEDKEY pKey, LPCWSTR lpszValueName);
+DWORD ServeSubtree(PCELLXMLSERVER pServer, PHIVEFILE pHive, PSERVEDKEY pKey);
+DWORD ServeConnection(PCELLXMLSERVER pServer, SOCKET hClient);
+DWORD GetSocketAddress(LPCWSTR lpszSocketPath, PSOCKADDR_UN pAddress);
+BOOL SendAll(SOCKET hSocket, const char *lpBuffer, size_t cbBuffer);
+
+//-----------------------------------------------------------------
+// Set up an empty query server
+//-----------------------------------------------------------------
+DWORD InitCellXmlServer(PCELLXMLSERVER pServer)
+{
+	DWORD i;
+
+	ZeroMemory(pServer, sizeof(CELLXMLSERVER));
+	pServer->lpKeys = MYALLOC0(SERVE_MAX_KEYS * sizeof(SERVEDKEY));
+	pServer->lpBuckets = MYALLOC(SERVE_KEY_BUCKETS * sizeof(DWORD));
+	pServer->lpszPath = MYALLOC(SERVE_MAX_PATH * sizeof(WCHAR));
+	pServer->lpszName = MYALLOC((MAX_VALUE_NAME + 1) * sizeof(WCHAR));
+	if (NULL == pServer->lpKeys || NULL == pServer->lpBuckets || NULL == pServer->lpszPath || NULL == pServer->lpszName) {
+		FreeCellXmlServer(pServer);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	for (i = 0; i < SERVE_KEY_BUCKETS; i++) {
+		pServer->lpBuckets[i] = SERVE_NO_KEY;
+	}
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Close every served hive and release the server
+//-----------------------------------------------------------------
+VOID FreeCellXmlServer(PCELLXMLSERVER pServer)
+{
+	DWORD i;
+
+	for (i = 0; i < SERVE_MAX_HIVES; i++) {
+		if (NULL != pServer->Hives[i].lpszFileName) {
+			CloseServedHive(pServer, &pServer->Hives[i]);
+		}
+	}
+	if (NULL != pServer->lpKeys) {
+		MYFREE(pServer->lpKeys);
+		pServer->lpKeys = NULL;
+	}
+	if (NULL != pServer->lpBuckets) {
+		MYFREE(pServer->lpBuckets);
+		pServer->lpBuckets = NULL;
+	}
+	if (NULL != pServer->lpszPath) {
+		MYFREE(pServer->lpszPath);
+		pServer->lpszPath = NULL;
+	}
+	if (NULL != pServer->lpszName) {
+		MYFREE(pServer->lpszName);
+		pServer->lpszName = NULL;
+	}
+	if (NULL != pServer->Response.lpBuffer) {
+		MYFREE(pServer->Response.lpBuffer);
+		pServer->Response.lpBuffer = NULL;
+	}
+}
+
+//-----------------------------------------------------------------
+// Answer one request, the response document is left in Response
+// A request is a line of tab separated fields:
+//   get-key       hive-file  key-path
+//   list-children hive-file  key-path
+//   get-value     hive-file  key-path  value-name (empty for the default value)
+//   subtree       hive-file  key-path
+//   quit
+// Key paths are below the root key (empty for the root key itself).
+// An error before any cellobject is written is returned without a
+// document, a later error ends the document with a partial marker.
+// A document with text missing (see PrintXml) is never answered.
+//-----------------------------------------------------------------
+DWORD ServeRequest(PCELLXMLSERVER pServer, LPWSTR lpszRequest)
+{
+	LPWSTR lpszFields[4];
+	DWORD nFields;
+	DWORD nRequest;
+	LPWSTR lpszKeyPath;
+	size_t cchKeyPath;
+	PHIVEFILE pHive;
+	PSERVEDKEY pKey;
+	DWORD dwError;
+	LPWSTR p;
+
+	pServer->qwClock++;
+	pServer->Response.cbBuffer = 0;
+	pServer->Response.nKeyObjects = 0;
+	pServer->Response.nValueObjects = 0;
+	pServer->Response.dwError = ERROR_SUCCESS;
+
+	// Split the request line into its fields
+	nFields = 0;
+	lpszFields[nFields++] = lpszRequest;
+	for (p = lpszRequest; *p != L'\0'; p++) {
+		if (*p == L'\t') {
+			if (nFields == 4) {
+				return ERROR_INVALID_PARAMETER;
+			}
+			*p = L'\0';
+			lpszFields[nFields++] = p + 1;
+		}
+	}
+
+	if (wcscmp(lpszFields[0], L"quit") == 0) {
+		pServer->bQuit = TRUE;
+		return ERROR_SUCCESS;
+	}
+	else if (wcscmp(lpszFields[0], L"get-key") == 0 && nFields <= 3) {
+		nRequest = SERVE_GET_KEY;
+	}
+	else if (wcscmp(lpszFields[0], L"list-children") == 0 && nFields <= 3) {
+		nRequest = SERVE_LIST_CHILDREN;
+	}
+	else if (wcscmp(lpszFields[0], L"get-value") == 0 && nFields == 4) {
+		nRequest = SERVE_GET_VALUE;
+	}
+	else if (wcscmp(lpszFields[0], L"subtree") == 0 && nFields <= 3) {
+		nRequest = SERVE_SUBTREE;
+	}
+	else {
+		return ERROR_INVALID_FUNCTION;
+	}
+	if (nFields < 2) {
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	pHive = OpenServedHive(pServer, lpszFields[1], &dwError);
+	if (NULL == pHive) {
+		return dwError;
+	}
+
+	// Leading and trailing backslashes are ignored
+	lpszKeyPath = (nFields > 2) ? lpszFields[2] : L"";
+	while (*lpszKeyPath == L'\\') {
+		lpszKeyPath++;
+	}
+	cchKeyPath = wcslen(lpszKeyPath);
+	while (cchKeyPath > 0 && lpszKeyPath[cchKeyPath - 1] == L'\\') {
+		cchKeyPath--;
+	}
+	dwError = ResolveServedKey(pServer, pHive, lpszKeyPath, cchKeyPath, &pKey);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+
+	PrintHiveHeader(&pServer->Response);
+	if (nRequest == SERVE_GET_KEY) {
+		dwError = ServeGetKey(pServer, pHive, pKey);
+	}
+	else if (nRequest == SERVE_LIST_CHILDREN) {
+		dwError = ServeListChildren(pServer, pHive, pKey);
+	}
+	else if (nRequest == SERVE_GET_VALUE) {
+		dwError = ServeGetValue(pServer, pHive, pKey, lpszFields[3]);
+	}
+	else {
+		dwError = ServeSubtree(pServer, pHive, pKey);
+	}
+	if (dwError != ERROR_SUCCESS && pServer->Response.nKeyObjects + pServer->Response.nValueObjects == 0) {
+		return dwError;
+	}
+	PrintHiveFooter(&pServer->Response, dwError);
+	return pServer->Response.dwError;
+}
+
+//-----------------------------------------------------------------
+// Find an open hive, or open it (closing the least recently used
+// hive when every slot is taken)
+//-----------------------------------------------------------------
+PHIVEFILE OpenServedHive(PCELLXMLSERVER pServer, LPCWSTR lpszFileName, PDWORD lpdwError)
+{
+	PSERVEDHIVE pServed;
+	PSERVEDHIVE pFree;
+	HIVELOGREPLAY LogReplay;
+	size_t cchFileName;
+	DWORD i;
+
+	// A hive that failed to open leaves a free slot between taken
+	// ones, so every slot is searched for the name
+	pServed = NULL;
+	pFree = NULL;
+	for (i = 0; i < SERVE_MAX_HIVES; i++) {
+		if (NULL == pServer->Hives[i].lpszFileName) {
+			if (NULL == pFree) {
+				pFree = &pServer->Hives[i];
+			}
+			continue;
+		}
+		if (_wcsicmp(pServer->Hives[i].lpszFileName, lpszFileName) == 0) {
+			pServer->Hives[i].qwLastUse = pServer->qwClock;
+			return &pServer->Hives[i].Hive;
+		}
+		if (NULL == pServed || pServer->Hives[i].qwLastUse < pServed->qwLastUse) {
+			pServed = &pServer->Hives[i];
+		}
+	}
+
+	// Take a free slot, else the least recently used one
+	if (NULL != pFree) {
+		pServed = pFree;
+	}
+	else {
+		CloseServedHive(pServer, pServed);
+	}
+	cchFileName = wcslen(lpszFileName);
+	pServed->lpszFileName = MYALLOC((cchFileName + 1) * sizeof(WCHAR));
+	if (NULL == pServed->lpszFileName) {
+		*lpdwError = ERROR_NOT_ENOUGH_MEMORY;
+		return NULL;
+	}
+	memcpy(pServed->lpszFileName, lpszFileName, (cchFileName + 1) * sizeof(WCHAR));
+	*lpdwError = OpenHiveFile(lpszFileName, &pServed->Hive);
+
+	// A dirty hive is served with its transaction logs applied
+	// (old format logs are not supported, the hive is served as found)
+	if (*lpdwError == ERROR_SUCCESS && !pServed->Hive.bSequenceValid) {
+		*lpdwError = ReplayHiveLogs(&pServed->Hive, lpszFileName, &LogReplay);
+		if (*lpdwError == ERROR_NOT_SUPPORTED) {
+			*lpdwError = ERROR_SUCCESS;
+		}
+		if (*lpdwError != ERROR_SUCCESS) {
+			CloseHiveFile(&pServed->Hive);
+		}
+	}
+	if (*lpdwError != ERROR_SUCCESS) {
+		MYFREE(pServed->lpszFileName);
+		pServed->lpszFileName = NULL;
+		return NULL;
+	}
+	pServed->qwLastUse = pServer->qwClock;
+	return &pServed->Hive;
+}
+
+//-----------------------------------------------------------------
+// Close a served hive, and forget the key paths resolved in it
+//-----------------------------------------------------------------
+VOID CloseServedHive(PCELLXMLSERVER pServer, PSERVEDHIVE pServed)
+{
+	DWORD iKey;
+
+	for (iKey = 0; iKey < pServer->nKeys; iKey++) {
+		if (pServer->lpKeys[iKey].pHive == &pServed->Hive) {
+			DropServedKey(pServer, iKey);
+		}
+	}
+	CloseHiveFile(&pServed->Hive);
+	MYFREE(pServed->lpszFileName);
+	pServed->lpszFileName = NULL;
+	pServed->qwLastUse = 0;
+}
+
+//-----------------------------------------------------------------
+// Resolve a key path (below the root key) to its key cell
+// The deepest key of the path resolved before is looked up first,
+// then the remaining key names are found in their parent subkey
+// lists, and every key on the way is remembered.
+//-----------------------------------------------------------------
+DWORD ResolveServedKey(PCELLXMLSERVER pServer, PHIVEFILE pHive, LPCWSTR lpszPath, size_t cchPath, PSERVEDKEY *ppKey)
+{
+	PSERVEDKEY pKey;
+	HIVEKEYNODE KeyNode;
+	size_t cchKnown;
+	size_t iName;
+	size_t cchName;
+	size_t cchResolved;
+	DWORD dwCellOffset;
+
+	cchKnown = cchPath;
+	pKey = FindServedKey(pServer, pHive, lpszPath, cchKnown);
+	while (NULL == pKey && cchKnown > 0) {
+		while (cchKnown > 0 && lpszPath[cchKnown - 1] != L'\\') {
+			cchKnown--;
+		}
+		if (cchKnown > 0) {
+			cchKnown--;
+		}
+		pKey = FindServedKey(pServer, pHive, lpszPath, cchKnown);
+	}
+	if (NULL == pKey) {
+		pKey = AddServedKey(pServer, pHive, pHive->dwRootCellOffset, L"", 0);
+		if (NULL == pKey) {
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+	}
+
+	while (cchKnown < cchPath)
+	{
+		iName = (cchKnown == 0) ? 0 : cchKnown + 1;
+		for (cchName = 0; iName + cchName < cchPath && lpszPath[iName + cchName] != L'\\'; cchName++);
+		if (cchName == 0 || cchName > MAX_KEY_NAME || !ReadKeyNode(pHive, pKey->dwCellOffset, &KeyNode)) {
+			return ERROR_FILE_NOT_FOUND;
+		}
+		dwCellOffset = FindSubkeyCell(pHive, &KeyNode, lpszPath + iName, (DWORD)cchName);
+		if (dwCellOffset == HIVE_NO_CELL || !ReadKeyNode(pHive, dwCellOffset, &KeyNode)) {
+			return ERROR_FILE_NOT_FOUND;
+		}
+
+		// The resolved path has the key names as written in the hive
+		cchResolved = pKey->cchPath;
+		memcpy(pServer->lpszPath, pKey->lpszPath, cchResolved * sizeof(WCHAR));
+		if (cchResolved > 0) {
+			pServer->lpszPath[cchResolved++] = L'\\';
+		}
+		cchResolved += CopyHiveName(KeyNode.lpName, KeyNode.cbName, KeyNode.wFlags & NK_KEY_COMP_NAME,
+			pServer->lpszPath + cchResolved, MAX_KEY_NAME + 1);
+		pKey = AddServedKey(pServer, pHive, dwCellOffset, pServer->lpszPath, cchResolved);
+		if (NULL == pKey) {
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+		cchKnown = iName + cchName;
+	}
+	*ppKey = pKey;
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Look up a resolved key path (case insensitive)
+//-----------------------------------------------------------------
+PSERVEDKEY FindServedKey(PCELLXMLSERVER pServer, PHIVEFILE pHive, LPCWSTR lpszPath, size_t cchPath)
+{
+	PSERVEDKEY pKey;
+	QWORD qwHash;
+	DWORD iKey;
+
+	qwHash = HashServedPath(lpszPath, cchPath);
+	for (iKey = pServer->lpBuckets[qwHash % SERVE_KEY_BUCKETS]; iKey != SERVE_NO_KEY; iKey = pKey->iNext) {
+		pKey = &pServer->lpKeys[iKey];
+		if (pKey->qwHash == qwHash && pKey->pHive == pHive && pKey->cchPath == cchPath &&
+			_wcsnicmp(pKey->lpszPath, lpszPath, cchPath) == 0)
+		{
+			pKey->qwLastUse = pServer->qwClock;
+			return pKey;
+		}
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------
+// Remember a resolved key path
+// Once the table is full, the least recently used path is dropped
+//-----------------------------------------------------------------
+PSERVEDKEY AddServedKey(PCELLXMLSERVER pServer, PHIVEFILE pHive, DWORD dwCellOffset, LPCWSTR lpszPath, size_t cchPath)
+{
+	PSERVEDKEY pKey;
+	DWORD iKey;
+	DWORD iBucket;
+	DWORD i;
+
+	if (pServer->nKeys < SERVE_MAX_KEYS) {
+		iKey = pServer->nKeys++;
+	}
+	else {
+		iKey = 0;
+		for (i = 1; i < SERVE_MAX_KEYS; i++) {
+			if (pServer->lpKeys[i].qwLastUse < pServer->lpKeys[iKey].qwLastUse) {
+				iKey = i;
+			}
+		}
+		DropServedKey(pServer, iKey);
+	}
+
+	pKey = &pServer->lpKeys[iKey];
+	pKey->lpszPath = MYALLOC((cchPath + 1) * sizeof(WCHAR));
+	if (NULL == pKey->lpszPath) {
+		return NULL;
+	}
+	memcpy(pKey->lpszPath, lpszPath, cchPath * sizeof(WCHAR));
+	pKey->lpszPath[cchPath] = L'\0';
+	pKey->cchPath = cchPath;
+	pKey->qwHash = HashServedPath(lpszPath, cchPath);
+	pKey->pHive = pHive;
+	pKey->dwCellOffset = dwCellOffset;
+	pKey->qwLastUse = pServer->qwClock;
+	iBucket = (DWORD)(pKey->qwHash % SERVE_KEY_BUCKETS);
+	pKey->iNext = pServer->lpBuckets[iBucket];
+	pServer->lpBuckets[iBucket] = iKey;
+	return pKey;
+}
+
+//-----------------------------------------------------------------
+// Forget a resolved key path (the slot is reused first)
+//-----------------------------------------------------------------
+VOID DropServedKey(PCELLXMLSERVER pServer, DWORD iKey)
+{
+	PSERVEDKEY pKey;
+	LPDWORD lpiLink;
+
+	pKey = &pServer->lpKeys[iKey];
+	if (NULL == pKey->pHive) {
+		return;
+	}
+	lpiLink = &pServer->lpBuckets[pKey->qwHash % SERVE_KEY_BUCKETS];
+	while (*lpiLink != iKey) {
+		lpiLink = &pServer->lpKeys[*lpiLink].iNext;
+	}
+	*lpiLink = pKey->iNext;
+	MYFREE(pKey->lpszPath);
+	ZeroMemory(pKey, sizeof(SERVEDKEY));
+}
+
+//-----------------------------------------------------------------
+// Hash a key path, ASCII letters are case folded (FNV-1a)
+//-----------------------------------------------------------------
+QWORD HashServedPath(LPCWSTR lpszPath, size_t cchPath)
+{
+	QWORD qwHash;
+	WCHAR ch;
+	size_t i;
+
+	qwHash = 14695981039346656037ULL;
+	for (i = 0; i < cchPath; i++) {
+		ch = lpszPath[i];
+		if (ch >= L'a' && ch <= L'z') {
+			ch -= L'a' - L'A';
+		}
+		qwHash = (qwHash ^ ch) * 1099511628211ULL;
+	}
+	return qwHash;
+}
+
+//-----------------------------------------------------------------
+// Find a subkey cell by name (case insensitive)
+// Returns HIVE_NO_CELL if the key has no such subkey
+//-----------------------------------------------------------------
+DWORD FindSubkeyCell(PHIVEFILE pHive, PHIVEKEYNODE pKeyNode, LPCWSTR szName, DWORD cchName)
+{
+	LPDWORD lpSubkeys;
+	DWORD nSubkeys;
+	DWORD dwCellOffset;
+	DWORD i;
+
+	nSubkeys = GetSubkeyOffsets(pHive, pKeyNode->dwSubkeyList, NULL, pKeyNode->nSubkeys);
+	if (nSubkeys == 0) {
+		return HIVE_NO_CELL;
+	}
+	lpSubkeys = MYALLOC(nSubkeys * sizeof(DWORD));
+	if (NULL == lpSubkeys) {
+		return HIVE_NO_CELL;
+	}
+	nSubkeys = GetSubkeyOffsets(pHive, pKeyNode->dwSubkeyList, lpSubkeys, nSubkeys);
+	dwCellOffset = HIVE_NO_CELL;
+	for (i = 0; i < nSubkeys && dwCellOffset == HIVE_NO_CELL; i++) {
+		dwCellOffset = MatchSubkeyCell(pHive, lpSubkeys, nSubkeys, i, szName, cchName);
+	}
+	MYFREE(lpSubkeys);
+	return dwCellOffset;
+}
+
+//-----------------------------------------------------------------
+// Put the full path of a resolved key (with the root key name read
+// from the root cell) in lpszPath, returns its length
+//-----------------------------------------------------------------
+size_t GetServedKeyPath(PCELLXMLSERVER pServer, PHIVEFILE pHive, PSERVEDKEY pKey)
+{
+	size_t cchPath;
+
+	cchPath = wcslen(pHive->lpszRootKeyName);
+	memcpy(pServer->lpszPath, pHive->lpszRootKeyName, cchPath * sizeof(WCHAR));
+	if (pKey->cchPath > 0) {
+		pServer->lpszPath[cchPath++] = L'\\';
+		memcpy(pServer->lpszPath + cchPath, pKey->lpszPath, pKey->cchPath * sizeof(WCHAR));
+		cchPath += pKey->cchPath;
+	}
+	pServer->lpszPath[cchPath] = L'\0';
+	return cchPath;
+}
+
+//-----------------------------------------------------------------
+// get-key: write the key cellobject
+//-----------------------------------------------------------------
+DWORD ServeGetKey(PCELLXMLSERVER pServer, PHIVEFILE pHive, PSERVEDKEY pKey)
+{
+	HIVEKEYNODE KeyNode;
+	LPTSTR lpszModifiedTime;
+
+	if (!ReadKeyNode(pHive, pKey->dwCellOffset, &KeyNode)) {
+		return ERROR_BADDB;
+	}
+	GetServedKeyPath(pServer, pHive, pKey);
+	lpszModifiedTime = FormatLastWriteTime(&KeyNode.ftLastWriteTime);
+	pServer->Response.nKeyObjects++;
+	PrintKeyCellObject(&pServer->Response, pServer->lpszPath, lpszModifiedTime, NULL, NULL);
+	MYFREE(lpszModifiedTime);
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// list-children: write the key cellobject of every subkey (in
+// subkey list order, like a walk)
+//-----------------------------------------------------------------
+DWORD ServeListChildren(PCELLXMLSERVER pServer, PHIVEFILE pHive, PSERVEDKEY pKey)
+{
+	HIVEKEYNODE KeyNode;
+	HIVEKEYNODE Subkey;
+	LPDWORD lpSubkeys;
+	DWORD nSubkeys;
+	LPTSTR lpszModifiedTime;
+	size_t cchPath;
+	DWORD i;
+
+	if (!ReadKeyNode(pHive, pKey->dwCellOffset, &KeyNode)) {
+		return ERROR_BADDB;
+	}
+	nSubkeys = GetSubkeyOffsets(pHive, KeyNode.dwSubkeyList, NULL, KeyNode.nSubkeys);
+	if (nSubkeys == 0) {
+		return ERROR_SUCCESS;
+	}
+	lpSubkeys = MYALLOC(nSubkeys * sizeof(DWORD));
+	if (NULL == lpSubkeys) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	nSubkeys = GetSubkeyOffsets(pHive, KeyNode.dwSubkeyList, lpSubkeys, nSubkeys);
+
+	cchPath = GetServedKeyPath(pServer, pHive, pKey);
+	pServer->lpszPath[cchPath++] = L'\\';
+	for (i = 0; i < nSubkeys; i++) {
+		if (!ReadKeyNode(pHive, lpSubkeys[i], &Subkey)) {
+			continue;
+		}
+		CopyHiveName(Subkey.lpName, Subkey.cbName, Subkey.wFlags & NK_KEY_COMP_NAME,
+			pServer->lpszPath + cchPath, MAX_KEY_NAME + 1);
+		lpszModifiedTime = FormatLastWriteTime(&Subkey.ftLastWriteTime);
+		pServer->Response.nKeyObjects++;
+		PrintKeyCellObject(&pServer->Response, pServer->lpszPath, lpszModifiedTime, NULL, NULL);
+		MYFREE(lpszModifiedTime);
+	}
+	MYFREE(lpSubkeys);
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// get-value: write the value cellobject of a named value
+// Like a walk, an empty value is not written
+//-----------------------------------------------------------------
+DWORD ServeGetValue(PCELLXMLSERVER pServer, PHIVEFILE pHive, PSERVEDKEY pKey, LPCWSTR lpszValueName)
+{
+	HIVEKEYNODE KeyNode;
+	HIVEVALUEKEY ValueKey;
+	LPDWORD lpValues;
+	DWORD nValues;
+	DWORD cchName;
+	DWORD cchValueName;
+	LPBYTE lpData;
+	DWORD cbData;
+	BOOL bAllocated;
+	LPTSTR lpszModifiedTime;
+	size_t cchPath;
+	DWORD i;
+
+	if (!ReadKeyNode(pHive, pKey->dwCellOffset, &KeyNode)) {
+		return ERROR_BADDB;
+	}
+	nValues = KeyNode.nValues;
+	lpValues = (nValues == 0) ? NULL : GetValueList(pHive, KeyNode.dwValueList, &nValues);
+	cchValueName = (DWORD)wcslen(lpszValueName);
+	for (i = 0; i < nValues; i++) {
+		if (!ReadValueKey(pHive, lpValues[i], &ValueKey)) {
+			continue;
+		}
+		cchName = CopyHiveName(ValueKey.lpName, ValueKey.cbName, ValueKey.wFlags & VK_VALUE_COMP_NAME,
+			pServer->lpszName, MAX_VALUE_NAME + 1);
+		if (cchName == cchValueName && _wcsnicmp(pServer->lpszName, lpszValueName, cchName) == 0) {
+			break;
+		}
+	}
+	if (i == nValues) {
+		return ERROR_FILE_NOT_FOUND;
+	}
+
+	lpData = GetValueData(pHive, &ValueKey, &cbData, &bAllocated);
+	if (NULL == lpData || cbData == 0) {
+		return ERROR_SUCCESS;
+	}
+	cchPath = GetServedKeyPath(pServer, pHive, pKey);
+	pServer->lpszPath[cchPath++] = L'\\';
+	wcscpy_s(pServer->lpszPath + cchPath, SERVE_MAX_PATH - cchPath, (cchName == 0) ? L"(Default)" : pServer->lpszName);
+	lpszModifiedTime = FormatLastWriteTime(&KeyNode.ftLastWriteTime);
+	pServer->Response.nValueObjects++;
+	PrintValueCellObject(&pServer->Response, pServer->lpszPath, (cchName == 0) ? L"(Default)" : pServer->lpszName,
+		lpszModifiedTime, ValueKey.dwType, lpData, cbData, 0, NULL);
+	MYFREE(lpszModifiedTime);
+	if (bAllocated) {
+		MYFREE(lpData);
+	}
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// subtree: write the key and everything below it, like an export
+// The walk starts at the resolved key cell, so only the cells of the
+// subtree are read
+//-----------------------------------------------------------------
+DWORD ServeSubtree(PCELLXMLSERVER pServer, PHIVEFILE pHive, PSERVEDKEY pKey)
+{
+	CELLXMLVISITOR Visitor;
+	XMLWRITER Writer;
+	DWORD nDepth;
+	DWORD dwError;
+	size_t i;
+
+	InitXmlWriter(&Writer, &Visitor, NULL, NULL, NULL);
+	Writer.pOutput = &pServer->Response;
+	GetServedKeyPath(pServer, pHive, pKey);
+
+	// Key names never hold a backslash
+	nDepth = (pKey->cchPath == 0) ? 0 : 1;
+	for (i = 0; i < pKey->cchPath; i++) {
+		if (pKey->lpszPath[i] == L'\\') {
+			nDepth++;
+		}
+	}
+
+	dwError = VisitHiveKey(pHive, pServer->lpszPath, nDepth, pKey->dwCellOffset, &Visitor, 0);
+	FreeXmlWriter(&Writer);
+	return dwError;
+}
+
+//-----------------------------------------------------------------
+// Serve requests on a Unix domain socket until a quit request
+// One client is served at a time, and each client can send any
+// number of requests over its connection. Every response starts
+// with a line "OK <bytes>" followed by the CellXML document, or is
+// the line "ERROR <system error code>".
+//-----------------------------------------------------------------
+DWORD RunCellXmlServer(LPCWSTR lpszSocketPath)
+{
+	CELLXMLSERVER Server;
+	WSADATA WsaData;
+	SOCKADDR_UN Address;
+	SOCKET hListen;
+	SOCKET hClient;
+	DWORD dwAttributes;
+	DWORD dwError;
+
+	dwError = GetSocketAddress(lpszSocketPath, &Address);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+	dwError = WSAStartup(MAKEWORD(2, 2), &WsaData);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+	dwError = InitCellXmlServer(&Server);
+	if (dwError != ERROR_SUCCESS) {
+		WSACleanup();
+		return dwError;
+	}
+
+	// A socket file left by an earlier server would fail the bind
+	dwAttributes = GetFileAttributesW(lpszSocketPath);
+	if (dwAttributes != INVALID_FILE_ATTRIBUTES && (dwAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+		DeleteFileW(lpszSocketPath);
+	}
+
+	hListen = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (INVALID_SOCKET == hListen) {
+		dwError = WSAGetLastError();
+	}
+	else if (bind(hListen, (struct sockaddr *)&Address, sizeof(SOCKADDR_UN)) == SOCKET_ERROR ||
+		listen(hListen, SOMAXCONN) == SOCKET_ERROR)
+	{
+		dwError = WSAGetLastError();
+	}
+	else
+	{
+		while (!Server.bQuit) {
+			hClient = accept(hListen, NULL, NULL);
+			if (INVALID_SOCKET == hClient) {
+				dwError = WSAGetLastError();
+				break;
+			}
+			ServeConnection(&Server, hClient);
+			closesocket(hClient);
+		}
+		DeleteFileW(lpszSocketPath);
+	}
+	if (INVALID_SOCKET != hListen) {
+		closesocket(hListen);
+	}
+	FreeCellXmlServer(&Server);
+	WSACleanup();
+	return dwError;
+}
+
+//-----------------------------------------------------------------
+// Answer the request lines of one client until it disconnects
+// Request lines are UTF-8, ending with "\n" (or "\r\n")
+//-----------------------------------------------------------------
+DWORD ServeConnection(PCELLXMLSERVER pServer, SOCKET hClient)
+{
+	LPSTR lpRequest;
+	LPWSTR lpszRequest;
+	size_t cbRequest;
+	size_t cbLine;
+	LPSTR lpEnd;
+	int cbRead;
+	int cchRequest;
+	char szStatus[32];
+	int cchStatus;
+	DWORD dwError;
+
+	lpRequest = MYALLOC(SERVE_MAX_REQUEST);
+	lpszRequest = MYALLOC((SERVE_MAX_REQUEST + 1) * sizeof(WCHAR));
+	if (NULL == lpRequest || NULL == lpszRequest) {
+		if (NULL != lpRequest) {
+			MYFREE(lpRequest);
+		}
+		if (NULL != lpszRequest) {
+			MYFREE(lpszRequest);
+		}
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	cbRequest = 0;
+	dwError = ERROR_SUCCESS;
+	while (!pServer->bQuit)
+	{
+		lpEnd = memchr(lpRequest, '\n', cbRequest);
+		if (NULL == lpEnd) {
+			if (cbRequest == SERVE_MAX_REQUEST) {
+				cchStatus = sprintf_s(szStatus, sizeof(szStatus), "ERROR %u\n", ERROR_INSUFFICIENT_BUFFER);
+				SendAll(hClient, szStatus, cchStatus);
+				dwError = ERROR_INSUFFICIENT_BUFFER;
+				break;
+			}
+			cbRead = recv(hClient, lpRequest + cbRequest, (int)(SERVE_MAX_REQUEST - cbRequest), 0);
+			if (cbRead <= 0) {
+				break;
+			}
+			cbRequest += cbRead;
+			continue;
+		}
+
+		cbLine = lpEnd - lpRequest;
+		if (cbLine > 0 && lpRequest[cbLine - 1] == '\r') {
+			cbLine--;
+		}
+		cchRequest = (cbLine == 0) ? 0 :
+			MultiByteToWideChar(CP_UTF8, 0, lpRequest, (int)cbLine, lpszRequest, SERVE_MAX_REQUEST);
+		lpszRequest[cchRequest] = L'\0';
+		cbRequest -= (lpEnd - lpRequest) + 1;
+		memmove(lpRequest, lpEnd + 1, cbRequest);
+
+		dwError = ServeRequest(pServer, lpszRequest);
+		if (dwError == ERROR_SUCCESS) {
+			cchStatus = sprintf_s(szStatus, sizeof(szStatus), "OK %llu\n", (QWORD)pServer->Response.cbBuffer);
+			if (!SendAll(hClient, szStatus, cchStatus) ||
+				!SendAll(hClient, pServer->Response.lpBuffer, pServer->Response.cbBuffer))
+			{
+				dwError = WSAGetLastError();
+				break;
+			}
+		}
+		else {
+			cchStatus = sprintf_s(szStatus, sizeof(szStatus), "ERROR %u\n", dwError);
+			if (!SendAll(hClient, szStatus, cchStatus)) {
+				dwError = WSAGetLastError();
+				break;
+			}
+		}
+	}
+	MYFREE(lpRequest);
+	MYFREE(lpszRequest);
+	return dwError;
+}
+
+//-----------------------------------------------------------------
+// Send one request to a query server and copy the response
+// document to standard output
+// The fields are joined into one request line (see ServeRequest),
+// returns the error code sent back by the server
+//-----------------------------------------------------------------
+DWORD RunCellXmlClient(LPCWSTR lpszSocketPath, LPWSTR *lpszFields, DWORD nFields)
+{
+	WSADATA WsaData;
+	SOCKADDR_UN Address;
+	SOCKET hServer;
+	LPSTR lpRequest;
+	int cbRequest;
+	int cbField;
+	char szStatus[32];
+	size_t cchStatus;
+	char Buffer[4096];
+	int cbRead;
+	QWORD cbResponse;
+	DWORD dwError;
+	DWORD i;
+
+	dwError = GetSocketAddress(lpszSocketPath, &Address);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+	lpRequest = MYALLOC(SERVE_MAX_REQUEST);
+	if (NULL == lpRequest) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	// Join the fields into one UTF-8 request line
+	cbRequest = 0;
+	for (i = 0; i < nFields; i++) {
+		if (i > 0) {
+			lpRequest[cbRequest++] = '\t';
+		}
+		cbField = 0;
+		if (lpszFields[i][0] != L'\0') {
+			cbField = WideCharToMultiByte(CP_UTF8, 0, lpszFields[i], (int)wcslen(lpszFields[i]),
+				lpRequest + cbRequest, SERVE_MAX_REQUEST - 2 - cbRequest, NULL, NULL);
+			if (cbField == 0) {
+				MYFREE(lpRequest);
+				return ERROR_INSUFFICIENT_BUFFER;
+			}
+		}
+		cbRequest += cbField;
+	}
+	lpRequest[cbRequest++] = '\n';
+
+	dwError = WSAStartup(MAKEWORD(2, 2), &WsaData);
+	if (dwError != ERROR_SUCCESS) {
+		MYFREE(lpRequest);
+		return dwError;
+	}
+	hServer = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (INVALID_SOCKET == hServer ||
+		connect(hServer, (struct sockaddr *)&Address, sizeof(SOCKADDR_UN)) == SOCKET_ERROR ||
+		!SendAll(hServer, lpRequest, cbRequest))
+	{
+		dwError = WSAGetLastError();
+	}
+	else
+	{
+		// Read the status line, then the document
+		cchStatus = 0;
+		while (cchStatus < sizeof(szStatus) - 1) {
+			if (recv(hServer, szStatus + cchStatus, 1, 0) != 1) {
+				dwError = ERROR_HANDLE_EOF;
+				break;
+			}
+			if (szStatus[cchStatus] == '\n') {
+				break;
+			}
+			cchStatus++;
+		}
+		szStatus[cchStatus] = '\0';
+		if (dwError != ERROR_SUCCESS) {
+			// The server closed the connection
+		}
+		else if (strncmp(szStatus, "OK ", 3) == 0) {
+			cbResponse = _strtoui64(szStatus + 3, NULL, 10);
+			while (cbResponse > 0) {
+				cbRead = recv(hServer, Buffer, (int)min(sizeof(Buffer), cbResponse), 0);
+				if (cbRead <= 0) {
+					dwError = ERROR_HANDLE_EOF;
+					break;
+				}
+				fwrite(Buffer, 1, cbRead, stdout);
+				cbResponse -= cbRead;
+			}
+		}
+		else if (strncmp(szStatus, "ERROR ", 6) == 0) {
+			dwError = strtoul(szStatus + 6, NULL, 10);
+		}
+		else {
+			dwError = ERROR_INVALID_DATA;
+		}
+	}
+	if (INVALID_SOCKET != hServer) {
+		closesocket(hServer);
+	}
+	MYFREE(lpRequest);
+	WSACleanup();
+	return dwError;
+}
+
+//-----------------------------------------------------------------
+// Fill in the address of a Unix domain socket (a UTF-8 file path)
+//-----------------------------------------------------------------
+DWORD GetSocketAddress(LPCWSTR lpszSocketPath, PSOCKADDR_UN pAddress)
+{
+	ZeroMemory(pAddress, sizeof(SOCKADDR_UN));
+	pAddress->sun_family = AF_UNIX;
+	if (WideCharToMultiByte(CP_UTF8, 0, lpszSocketPath, -1, pAddress->sun_path,
+		sizeof(pAddress->sun_path), NULL, NULL) == 0)
+	{
+		return ERROR_FILENAME_EXCED_RANGE;
+	}
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Send a whole buffer (send may take less than asked)
+//-----------------------------------------------------------------
+BOOL SendAll(SOCKET hSocket, const char *lpBuffer, size_t cbBuffer)
+{
+	int cbSent;
+
+	while (cbBuffer > 0) {
+		cbSent = send(hSocket, lpBuffer, (int)min(cbBuffer, 0x40000000), 0);
+		if (cbSent == SOCKET_ERROR) {
+			return FALSE;
+		}
+		lpBuffer += cbSent;
+		cbBuffer -= cbSent;
+	}
+	return TRUE;
+}
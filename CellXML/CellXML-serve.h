@@ -0,0 +1,88 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#pragma once
+#ifndef __CELLXML_SERVE_H__
+#define __CELLXML_SERVE_H__
+
+#include "CellXML-xml.h"
+
+#define SERVE_MAX_HIVES		16			// Hives kept open (and mapped) at once
+#define SERVE_MAX_KEYS		4096		// Resolved key paths kept (least recently used are dropped)
+#define SERVE_KEY_BUCKETS	1024		// Hash buckets of the resolved key paths
+#define SERVE_NO_KEY		0xFFFFFFFF	// End of a hash bucket chain
+#define SERVE_MAX_REQUEST	65536		// Longest request line (in bytes)
+
+// ----------------------------------------------------------------------
+// A hive kept open by the server, until it is the least recently
+// used hive and another one is needed
+// ----------------------------------------------------------------------
+typedef struct _SERVEDHIVE {
+	LPWSTR	lpszFileName;			// Hive file name (as requested), NULL if the slot is free
+	HIVEFILE Hive;					// Opened and mapped hive
+	QWORD	qwLastUse;				// Server clock of the last request
+} SERVEDHIVE, *PSERVEDHIVE;
+
+// ----------------------------------------------------------------------
+// A key path resolved to its key cell
+// Paths are below the root key and matched without case, the stored
+// path has the key names as written in the hive
+// ----------------------------------------------------------------------
+typedef struct _SERVEDKEY {
+	QWORD	qwHash;					// Case folded hash of lpszPath
+	PHIVEFILE pHive;				// Hive of the key (NULL if the slot is free)
+	DWORD	dwCellOffset;			// Key node cell
+	DWORD	iNext;					// Next key in the hash bucket, or SERVE_NO_KEY
+	LPWSTR	lpszPath;				// Key path below the root key (empty for the root key)
+	size_t	cchPath;				// Length of lpszPath (in characters)
+	QWORD	qwLastUse;				// Server clock of the last lookup
+} SERVEDKEY, *PSERVEDKEY;
+
+// ----------------------------------------------------------------------
+// Query server state
+// Requests are answered from the mapped hive cells: a key path is
+// resolved once, then found in the hash table of resolved paths. Each
+// response is a CellXML document built in memory.
+// ----------------------------------------------------------------------
+typedef struct _CELLXMLSERVER {
+	SERVEDHIVE	Hives[SERVE_MAX_HIVES];	// Open hives
+	PSERVEDKEY	lpKeys;				// Resolved key paths (SERVE_MAX_KEYS entries)
+	DWORD		nKeys;				// Entries of lpKeys in use
+	LPDWORD		lpBuckets;			// First key of each hash bucket (SERVE_KEY_BUCKETS entries)
+	QWORD		qwClock;			// Requests served (orders the least recently used)
+	XMLOUTPUT	Response;			// Response document of the last request
+	LPWSTR		lpszPath;			// Scratch key or value path
+	LPWSTR		lpszName;			// Scratch key or value name
+	BOOL		bQuit;				// A quit request was served
+} CELLXMLSERVER, *PCELLXMLSERVER;
+
+// ----------------------------------------------------------------------
+// CellXML query server functions
+// ----------------------------------------------------------------------
+DWORD InitCellXmlServer(PCELLXMLSERVER pServer);
+VOID FreeCellXmlServer(PCELLXMLSERVER pServer);
+DWORD ServeRequest(PCELLXMLSERVER pServer, LPWSTR lpszRequest);
+DWORD RunCellXmlServer(LPCWSTR lpszSocketPath);
+DWORD RunCellXmlClient(LPCWSTR lpszSocketPath, LPWSTR *lpszFields, DWORD nFields);
+
+#endif // __CELLXML_SERVE_H__
@@ -0,0 +1,409 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include "CellXML-shard.h"
+
+// ----------------------------------------------------------------------
+// CellXML shard internal functions
+// ----------------------------------------------------------------------
+PSHARDFILE OpenShardFile(PSHARDWRITER pShards);
+VOID CloseShardFile(PSHARDFILE pShard, DWORD dwError);
+PSHARDSUBTREE AddShardSubtree(PSHARDWRITER pShards, LPCWSTR szPath, size_t cchPath, QWORD nRecords);
+BOOL GrowShardArray(LPVOID *lpArray, PDWORD lpnMaxEntries, DWORD cbEntry);
+DWORD SelectSubtreeShard(PSHARDWRITER pShards, PCELLXMLKEY pKey);
+DWORD PickLeastLoadedShard(PSHARDWRITER pShards, QWORD nRecords);
+DWORD CountSubtreeKeys(LPVOID lpContext, PCELLXMLKEY pKey);
+int CompareShardSubtrees(const void *lpFirst, const void *lpSecond);
+
+//-----------------------------------------------------------------
+// Put a shard router in front of an XML writer
+// pVisitor must already be set up by InitXmlWriter, it is changed
+// to route every key (and its values) to the shard of its subtree.
+// nGroups is the number of balanced shards (--shard N, see
+// PlanShards), or 0 for one shard per subtree (--shard-by-depth D).
+// The trunk shard is opened here.
+//-----------------------------------------------------------------
+DWORD InitShardWriter(PSHARDWRITER pShards, PXMLWRITER pWriter, PCELLXMLVISITOR pVisitor, LPCWSTR lpszPrefix,
+	DWORD nShardDepth, DWORD nGroups)
+{
+	ZeroMemory(pShards, sizeof(SHARDWRITER));
+	pShards->pWriter = pWriter;
+	pShards->Writer = *pVisitor;
+	pShards->lpszPrefix = lpszPrefix;
+	pShards->nShardDepth = (nShardDepth == 0) ? 1 : nShardDepth;
+	pShards->nGroups = (nGroups > SHARD_MAX_GROUPS) ? SHARD_MAX_GROUPS : nGroups;
+
+	if (NULL == OpenShardFile(pShards)) {
+		return pShards->dwError;
+	}
+	pWriter->pOutput = &pShards->lpShards[SHARD_TRUNK].Output;
+
+	pVisitor->OnKey = RouteKeyXml;
+	pVisitor->OnValue = RouteValueXml;
+	pVisitor->lpContext = pShards;
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Spread the subtrees over nGroups balanced shards (--shard N)
+// A first walk only counts the keys and values of each subtree
+// (no value data is read), then the largest subtree goes to the
+// least loaded shard, and so on. Subtrees missed by the count (an
+// exhausted work budget) are placed when the export reaches them.
+//-----------------------------------------------------------------
+DWORD PlanShards(PSHARDWRITER pShards, PHIVEFILE pHive, LPCWSTR szRootKeyName, DWORD dwFlags, QWORD qwMaxWork)
+{
+	CELLXMLVISITOR Visitor;
+	PSHARDSUBTREE *lpOrder;
+	DWORD i;
+
+	if (pShards->nGroups == 0) {
+		return ERROR_SUCCESS;
+	}
+
+	// An unfinished count is not an error: the export walk reports it
+	Visitor.OnKey = CountSubtreeKeys;
+	Visitor.OnValue = NULL;
+	Visitor.lpContext = pShards;
+	VisitHive(pHive, szRootKeyName, &Visitor, dwFlags, qwMaxWork);
+	if (pShards->dwError != ERROR_SUCCESS) {
+		return pShards->dwError;
+	}
+	pShards->nPlannedSubtrees = pShards->nSubtrees;
+
+	for (i = 0; i < pShards->nGroups; i++) {
+		if (NULL == OpenShardFile(pShards)) {
+			return pShards->dwError;
+		}
+	}
+	pShards->pWriter->pOutput = &pShards->lpShards[SHARD_TRUNK].Output;
+
+	if (pShards->nSubtrees == 0) {
+		return ERROR_SUCCESS;
+	}
+	lpOrder = MYALLOC(pShards->nSubtrees * sizeof(PSHARDSUBTREE));
+	if (NULL == lpOrder) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	for (i = 0; i < pShards->nSubtrees; i++) {
+		lpOrder[i] = &pShards->lpSubtrees[i];
+	}
+	qsort(lpOrder, pShards->nSubtrees, sizeof(PSHARDSUBTREE), CompareShardSubtrees);
+	for (i = 0; i < pShards->nSubtrees; i++) {
+		lpOrder[i]->nShard = PickLeastLoadedShard(pShards, lpOrder[i]->nRecords);
+	}
+	MYFREE(lpOrder);
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------
+// Visitor callback: switch the XML writer to the shard of a key
+//-----------------------------------------------------------------
+DWORD RouteKeyXml(LPVOID lpContext, PCELLXMLKEY pKey)
+{
+	PSHARDWRITER pShards;
+	DWORD nShard;
+
+	pShards = (PSHARDWRITER)lpContext;
+	if (pKey->nDepth < pShards->nShardDepth) {
+		nShard = SHARD_TRUNK;
+	}
+	else if (pKey->nDepth == pShards->nShardDepth) {
+		nShard = SelectSubtreeShard(pShards, pKey);
+		if (nShard == SHARD_TRUNK) {
+			return VISIT_STOP;
+		}
+		pShards->nCurrentShard = nShard;
+	}
+	else {
+		nShard = pShards->nCurrentShard;
+	}
+
+	pShards->pWriter->pOutput = &pShards->lpShards[nShard].Output;
+	return pShards->Writer.OnKey(pShards->Writer.lpContext, pKey);
+}
+
+//-----------------------------------------------------------------
+// Visitor callback: values go to the shard of their key
+//-----------------------------------------------------------------
+DWORD RouteValueXml(LPVOID lpContext, PCELLXMLKEY pKey, PCELLXMLVALUE pValue)
+{
+	PSHARDWRITER pShards;
+
+	pShards = (PSHARDWRITER)lpContext;
+	return pShards->Writer.OnValue(pShards->Writer.lpContext, pKey, pValue);
+}
+
+//-----------------------------------------------------------------
+// Close every shard still open, marking them if the walk is
+// unfinished (dwError is not ERROR_SUCCESS)
+//-----------------------------------------------------------------
+VOID CloseShardFiles(PSHARDWRITER pShards, DWORD dwError)
+{
+	DWORD i;
+
+	for (i = 0; i < pShards->nShards; i++) {
+		CloseShardFile(&pShards->lpShards[i], dwError);
+	}
+}
+
+//-----------------------------------------------------------------
+// Print the shard manifest (to standard output or the --output file)
+// Each shard lists its file, the root keys of its subtrees (none for
+// the trunk), its number of cellobjects and its size
+//-----------------------------------------------------------------
+VOID PrintShardManifest(PSHARDWRITER pShards, FILE *fp, DWORD dwError)
+{
+	PSHARDFILE pShard;
+	XMLOUTPUT Manifest;
+	DWORD i;
+	DWORD j;
+
+	ZeroMemory(&Manifest, sizeof(XMLOUTPUT));
+	Manifest.fp = fp;
+	fprintf(fp, "<?xml version = '1.0' encoding = 'UTF-8'?>\n");
+	fprintf(fp, "<manifest>\n");
+	for (i = 0; i < pShards->nShards; i++) {
+		pShard = &pShards->lpShards[i];
+		fprintf(fp, "  <shard>\n");
+		fprintf(fp, "    <file>%ws</file>\n", pShard->szFileName);
+		for (j = 0; j < pShards->nSubtrees; j++) {
+			if (pShards->lpSubtrees[j].nShard == i && pShards->lpSubtrees[j].bWritten) {
+				fprintf(fp, "    <prefix>%ws</prefix>\n", pShards->lpSubtrees[j].lpszPath);
+			}
+		}
+		fprintf(fp, "    <records>%llu</records>\n", (QWORD)pShard->Output.nKeyObjects + pShard->Output.nValueObjects);
+		fprintf(fp, "    <bytes>%llu</bytes>\n", pShard->cbFile);
+		fprintf(fp, "  </shard>\n");
+	}
+	PrintPartialMarker(&Manifest, dwError);
+	fprintf(fp, "</manifest>\n");
+}
+
+//-----------------------------------------------------------------
+// Close the shard files and free the router
+//-----------------------------------------------------------------
+VOID FreeShardWriter(PSHARDWRITER pShards)
+{
+	DWORD i;
+
+	if (NULL != pShards->lpShards) {
+		CloseShardFiles(pShards, ERROR_CANCELLED);
+		MYFREE(pShards->lpShards);
+	}
+	if (NULL != pShards->lpSubtrees) {
+		for (i = 0; i < pShards->nSubtrees; i++) {
+			MYFREE(pShards->lpSubtrees[i].lpszPath);
+		}
+		MYFREE(pShards->lpSubtrees);
+	}
+	ZeroMemory(pShards, sizeof(SHARDWRITER));
+}
+
+// ----------------------------------------------------------------------
+// Create the next shard file (<prefix>-NNNN.xml) and start its document
+// The shard array can move, so shards are referred to by number
+// ----------------------------------------------------------------------
+PSHARDFILE OpenShardFile(PSHARDWRITER pShards)
+{
+	PSHARDFILE pShard;
+
+	if (pShards->nShards == pShards->nMaxShards &&
+		!GrowShardArray((LPVOID *)&pShards->lpShards, &pShards->nMaxShards, sizeof(SHARDFILE)))
+	{
+		pShards->dwError = ERROR_NOT_ENOUGH_MEMORY;
+		return NULL;
+	}
+	pShard = &pShards->lpShards[pShards->nShards];
+	ZeroMemory(pShard, sizeof(SHARDFILE));
+	_snwprintf_s(pShard->szFileName, MAX_PATH, _TRUNCATE, L"%s-%04u.xml", pShards->lpszPrefix, pShards->nShards);
+	if (_wfopen_s(&pShard->Output.fp, pShard->szFileName, L"w") != 0) {
+		pShard->Output.fp = NULL;
+		pShards->dwError = ERROR_OPEN_FAILED;
+		return NULL;
+	}
+	pShard->Output.nDocument = pShards->nShards;
+	PrintHiveHeader(&pShard->Output);
+	pShards->nShards++;
+	return pShard;
+}
+
+// ----------------------------------------------------------------------
+// End the document of a shard and close its file
+// ----------------------------------------------------------------------
+VOID CloseShardFile(PSHARDFILE pShard, DWORD dwError)
+{
+	if (NULL == pShard->Output.fp) {
+		return;
+	}
+	PrintHiveFooter(&pShard->Output, dwError);
+	pShard->cbFile = _ftelli64(pShard->Output.fp);
+	fclose(pShard->Output.fp);
+	pShard->Output.fp = NULL;
+}
+
+// ----------------------------------------------------------------------
+// Add a subtree (not yet placed in a shard) to the subtree list
+// ----------------------------------------------------------------------
+PSHARDSUBTREE AddShardSubtree(PSHARDWRITER pShards, LPCWSTR szPath, size_t cchPath, QWORD nRecords)
+{
+	PSHARDSUBTREE pSubtree;
+
+	if (pShards->nSubtrees == pShards->nMaxSubtrees &&
+		!GrowShardArray((LPVOID *)&pShards->lpSubtrees, &pShards->nMaxSubtrees, sizeof(SHARDSUBTREE)))
+	{
+		pShards->dwError = ERROR_NOT_ENOUGH_MEMORY;
+		return NULL;
+	}
+	pSubtree = &pShards->lpSubtrees[pShards->nSubtrees];
+	ZeroMemory(pSubtree, sizeof(SHARDSUBTREE));
+	pSubtree->lpszPath = MYALLOC((cchPath + 1) * sizeof(WCHAR));
+	if (NULL == pSubtree->lpszPath) {
+		pShards->dwError = ERROR_NOT_ENOUGH_MEMORY;
+		return NULL;
+	}
+	memcpy(pSubtree->lpszPath, szPath, cchPath * sizeof(WCHAR));
+	pSubtree->lpszPath[cchPath] = L'\0';
+	pSubtree->nRecords = nRecords;
+	pSubtree->nShard = SHARD_TRUNK;
+	pShards->nSubtrees++;
+	return pSubtree;
+}
+
+// ----------------------------------------------------------------------
+// Double the size of a shard or subtree array
+// ----------------------------------------------------------------------
+BOOL GrowShardArray(LPVOID *lpArray, PDWORD lpnMaxEntries, DWORD cbEntry)
+{
+	LPVOID lpGrown;
+	DWORD nMaxEntries;
+
+	nMaxEntries = (*lpnMaxEntries == 0) ? 16 : *lpnMaxEntries * 2;
+	if (NULL == *lpArray) {
+		lpGrown = MYALLOC((SIZE_T)nMaxEntries * cbEntry);
+	}
+	else {
+		lpGrown = MYREALLOC(*lpArray, (SIZE_T)nMaxEntries * cbEntry);
+	}
+	if (NULL == lpGrown) {
+		return FALSE;
+	}
+	*lpArray = lpGrown;
+	*lpnMaxEntries = nMaxEntries;
+	return TRUE;
+}
+
+// ----------------------------------------------------------------------
+// Find the shard of a subtree root key, or SHARD_TRUNK on error
+// With one shard per subtree, the previous subtree is complete and
+// its shard is closed. Balanced shards follow the plan, as long as
+// the walk reaches the subtrees in the same order as the count.
+// ----------------------------------------------------------------------
+DWORD SelectSubtreeShard(PSHARDWRITER pShards, PCELLXMLKEY pKey)
+{
+	PSHARDSUBTREE pSubtree;
+	DWORD iSubtree;
+
+	iSubtree = pShards->nNextSubtree++;
+	if (pShards->nGroups == 0) {
+		if (pShards->nShards > 1) {
+			CloseShardFile(&pShards->lpShards[pShards->nShards - 1], ERROR_SUCCESS);
+		}
+		if (NULL == OpenShardFile(pShards)) {
+			return SHARD_TRUNK;
+		}
+		pSubtree = AddShardSubtree(pShards, pKey->lpszPath, pKey->cchPath, 0);
+		if (NULL == pSubtree) {
+			return SHARD_TRUNK;
+		}
+		pSubtree->nShard = pShards->nShards - 1;
+	}
+	else if (iSubtree < pShards->nPlannedSubtrees &&
+		wcscmp(pShards->lpSubtrees[iSubtree].lpszPath, pKey->lpszPath) == 0)
+	{
+		pSubtree = &pShards->lpSubtrees[iSubtree];
+	}
+	else {
+		pSubtree = AddShardSubtree(pShards, pKey->lpszPath, pKey->cchPath, 1 + pKey->nValues + pKey->nSubkeys);
+		if (NULL == pSubtree) {
+			return SHARD_TRUNK;
+		}
+		pSubtree->nShard = PickLeastLoadedShard(pShards, pSubtree->nRecords);
+	}
+	pSubtree->bWritten = TRUE;
+	return pSubtree->nShard;
+}
+
+// ----------------------------------------------------------------------
+// Find the balanced shard with the fewest records, and add to it
+// ----------------------------------------------------------------------
+DWORD PickLeastLoadedShard(PSHARDWRITER pShards, QWORD nRecords)
+{
+	DWORD nShard;
+	DWORD i;
+
+	nShard = SHARD_TRUNK + 1;
+	for (i = SHARD_TRUNK + 2; i < pShards->nShards; i++) {
+		if (pShards->lpShards[i].nRecords < pShards->lpShards[nShard].nRecords) {
+			nShard = i;
+		}
+	}
+	pShards->lpShards[nShard].nRecords += nRecords;
+	return nShard;
+}
+
+// ----------------------------------------------------------------------
+// Visitor callback for PlanShards: count the keys and values of each
+// subtree (a key, and the values counted in its key cell)
+// ----------------------------------------------------------------------
+DWORD CountSubtreeKeys(LPVOID lpContext, PCELLXMLKEY pKey)
+{
+	PSHARDWRITER pShards;
+
+	pShards = (PSHARDWRITER)lpContext;
+	if (pKey->nDepth == pShards->nShardDepth) {
+		if (NULL == AddShardSubtree(pShards, pKey->lpszPath, pKey->cchPath, 1 + (QWORD)pKey->nValues)) {
+			return VISIT_STOP;
+		}
+	}
+	else if (pKey->nDepth > pShards->nShardDepth && pShards->nSubtrees > 0) {
+		pShards->lpSubtrees[pShards->nSubtrees - 1].nRecords += 1 + (QWORD)pKey->nValues;
+	}
+	return VISIT_CONTINUE;
+}
+
+// ----------------------------------------------------------------------
+// qsort comparison for subtrees (largest first)
+// ----------------------------------------------------------------------
+int CompareShardSubtrees(const void *lpFirst, const void *lpSecond)
+{
+	QWORD nFirst;
+	QWORD nSecond;
+
+	nFirst = (*(PSHARDSUBTREE *)lpFirst)->nRecords;
+	nSecond = (*(PSHARDSUBTREE *)lpSecond)->nRecords;
+	if (nFirst != nSecond) {
+		return (nFirst > nSecond) ? -1 : 1;
+	}
+	return 0;
+}
@@ -0,0 +1,94 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#pragma once
+#ifndef __CELLXML_SHARD_H__
+#define __CELLXML_SHARD_H__
+
+#include "CellXML-xml.h"
+
+#define SHARD_TRUNK			0			// Shard of the keys above the shard depth
+#define SHARD_MAX_GROUPS	256			// Most shard files open at once (--shard N)
+
+// ----------------------------------------------------------------------
+// A subtree written to a shard (rooted at a key at the shard depth)
+// ----------------------------------------------------------------------
+typedef struct _SHARDSUBTREE {
+	LPWSTR	lpszPath;				// Path of the subtree root key
+	QWORD	nRecords;				// Estimated key and value cellobjects
+	DWORD	nShard;					// Shard holding the subtree
+	BOOL	bWritten;				// The walk reached the subtree
+} SHARDSUBTREE, *PSHARDSUBTREE;
+
+// ----------------------------------------------------------------------
+// A shard file, a complete CellXML document of its own
+// ----------------------------------------------------------------------
+typedef struct _SHARDFILE {
+	XMLOUTPUT Output;				// Shard document (fp is NULL once closed)
+	WCHAR	szFileName[MAX_PATH];	// Shard file name
+	QWORD	nRecords;				// Estimated key and value cellobjects (--shard N)
+	QWORD	cbFile;					// Size of the shard file (in bytes, once closed)
+} SHARDFILE, *PSHARDFILE;
+
+// ----------------------------------------------------------------------
+// Shard router, used as a hive visitor in front of the XML writer
+// Keys above the shard depth go to the trunk shard (shard 0), every
+// subtree below goes to its own shard (--shard-by-depth D), or to one
+// of N shards balanced by the estimated size of the subtrees (--shard
+// N). Both walkers are depth first, so a value always belongs to the
+// shard of the last key, and with one shard per subtree only the trunk
+// and the current shard are open. Each shard is a document of its own
+// (--dedup data is never referenced across shards), so shards can be
+// written and read independently.
+// ----------------------------------------------------------------------
+typedef struct _SHARDWRITER {
+	PXMLWRITER	pWriter;			// XML writer of every shard
+	CELLXMLVISITOR Writer;			// Visitor of the XML writer
+	LPCWSTR		lpszPrefix;			// Shard file name prefix
+	DWORD		nShardDepth;		// Depth of the subtree root keys (1 = below the root key)
+	DWORD		nGroups;			// Number of balanced shards, or 0 for one shard per subtree
+	PSHARDSUBTREE lpSubtrees;		// Subtrees (in walk order)
+	DWORD		nSubtrees;			// Number of entries in lpSubtrees
+	DWORD		nMaxSubtrees;		// Size of lpSubtrees
+	DWORD		nPlannedSubtrees;	// Subtrees found by PlanShards (--shard N)
+	DWORD		nNextSubtree;		// Subtrees reached by the walk so far
+	DWORD		nCurrentShard;		// Shard of the current subtree
+	PSHARDFILE	lpShards;			// Shard files (the trunk first)
+	DWORD		nShards;			// Number of entries in lpShards
+	DWORD		nMaxShards;			// Size of lpShards
+	DWORD		dwError;			// First error opening a shard file
+} SHARDWRITER, *PSHARDWRITER;
+
+// ----------------------------------------------------------------------
+// CellXML shard functions
+// ----------------------------------------------------------------------
+DWORD InitShardWriter(PSHARDWRITER pShards, PXMLWRITER pWriter, PCELLXMLVISITOR pVisitor, LPCWSTR lpszPrefix,
+	DWORD nShardDepth, DWORD nGroups);
+DWORD PlanShards(PSHARDWRITER pShards, PHIVEFILE pHive, LPCWSTR szRootKeyName, DWORD dwFlags, QWORD qwMaxWork);
+DWORD RouteKeyXml(LPVOID lpContext, PCELLXMLKEY pKey);
+DWORD RouteValueXml(LPVOID lpContext, PCELLXMLKEY pKey, PCELLXMLVALUE pValue);
+VOID CloseShardFiles(PSHARDWRITER pShards, DWORD dwError);
+VOID PrintShardManifest(PSHARDWRITER pShards, FILE *fp, DWORD dwError);
+VOID FreeShardWriter(PSHARDWRITER pShards);
+
+#endif // __CELLXML_SHARD_H__
@@ -0,0 +1,966 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include "CellXML-store.h"
+#include <stdlib.h>
+
+// ----------------------------------------------------------------------
+// A cellpath and its record, sorted to build the path index
+// ----------------------------------------------------------------------
+typedef struct _STORESORTKEY {
+	LPBYTE	lpPath;					// Cellpath text
+	DWORD	cbPath;					// Size of the cellpath text (in bytes)
+	DWORD	nRecord;				// Record number (document order)
+} STORESORTKEY, *PSTORESORTKEY;
+
+// ----------------------------------------------------------------------
+// CellXML store internal functions
+// ----------------------------------------------------------------------
+DWORD ReadCellObjects(PSTOREWRITER pWriter);
+DWORD FillReadBuffer(PSTOREWRITER pWriter, SIZE_T *lpiPos);
+DWORD RemoveCarriageReturns(LPBYTE lpText, DWORD cbText);
+LPBYTE ParseStoreRecord(LPBYTE lpRecord, LPBYTE lpEnd, PSTORERECORD pRecord, LPDWORD lpnDataRef);
+LPBYTE SkipIndentation(LPBYTE lpLine, LPBYTE lpEnd);
+LPBYTE FindText(LPBYTE lpStart, LPBYTE lpEnd, LPCSTR lpszText, SIZE_T cchText);
+BOOL StartsWithText(LPBYTE lpStart, LPBYTE lpEnd, LPCSTR lpszText, SIZE_T cchText);
+DWORD AddStoreRecord(PSTOREWRITER pWriter, LPBYTE lpRecord, DWORD cbRecord);
+DWORD AddStorePath(PSTOREWRITER pWriter, LPBYTE lpPath, DWORD cbPath);
+DWORD WriteStoreHeap(PSTOREWRITER pWriter, LPBYTE lpData, SIZE_T cbData);
+DWORD WriteStoreFile(HANDLE hFile, LPBYTE lpData, QWORD cbData);
+DWORD FinishStore(PSTOREWRITER pWriter);
+VOID FreeStoreWriter(PSTOREWRITER pWriter);
+DWORD ValidateCellXmlStore(PCELLXMLSTORE pStore);
+PSTORERECORD GetIndexedRecord(PCELLXMLSTORE pStore, DWORD nEntry);
+BOOL CheckStoreRecord(PCELLXMLSTORE pStore, DWORD nRecord);
+VOID PrintStoreRecord(PCELLXMLSTORE pStore, PXMLOUTPUT pOutput, DWORD nRecord);
+int ComparePaths(LPBYTE lpFirst, DWORD cbFirst, LPBYTE lpSecond, DWORD cbSecond);
+int CompareSortKeys(const void *lpFirst, const void *lpSecond);
+int CompareRecordNumbers(const void *lpFirst, const void *lpSecond);
+
+#define STORE_TEXT(s)	s, sizeof(s) - 1	// Text and length of a string literal
+
+//-----------------------------------------------------------------
+// Convert a CellXML document to a store file
+// The document is read once, in chunks: each cellobject is copied
+// to the record heap as it is found, so memory use only depends on
+// the number of cellobjects (the record table and the cellpaths
+// are kept for sorting). Only the fixed layout written by CellXML is
+// understood: one element per line inside <cellobject> (the cellpath,
+// basename and data may span lines), with the text exactly as written
+// (CellXML does not escape cellpaths or data).
+// <data_ref> (--dedup) is resolved to the record holding the data,
+// <security> and other elements are kept as part of the cellobject,
+// and a <partial> marker is kept so lookups report it again.
+//-----------------------------------------------------------------
+DWORD IngestCellXml(LPCWSTR lpszXmlFileName, LPCWSTR lpszStoreFileName, PSTOREHEADER pHeader)
+{
+	STOREWRITER Writer;
+	DWORD cbWritten;
+	DWORD dwError;
+
+	if (NULL == hHeap) {
+		hHeap = GetProcessHeap();
+	}
+	ZeroMemory(&Writer, sizeof(STOREWRITER));
+	Writer.hXmlFile = CreateFile(lpszXmlFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (Writer.hXmlFile == INVALID_HANDLE_VALUE) {
+		Writer.hXmlFile = NULL;
+		return GetLastError();
+	}
+	Writer.hStoreFile = CreateFile(lpszStoreFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (Writer.hStoreFile == INVALID_HANDLE_VALUE) {
+		Writer.hStoreFile = NULL;
+		dwError = GetLastError();
+		FreeStoreWriter(&Writer);
+		return dwError;
+	}
+
+	Writer.cbRead = STORE_READ_CHUNK;
+	Writer.lpRead = MYALLOC(Writer.cbRead);
+	Writer.lpWrite = MYALLOC(STORE_WRITE_CHUNK);
+	if (NULL == Writer.lpRead || NULL == Writer.lpWrite) {
+		dwError = ERROR_NOT_ENOUGH_MEMORY;
+	}
+	// The header is written again once the offsets are known
+	else if (!WriteFile(Writer.hStoreFile, &Writer.Header, sizeof(STOREHEADER), &cbWritten, NULL)) {
+		dwError = GetLastError();
+	}
+	else {
+		Writer.Header.qwHeapOffset = sizeof(STOREHEADER);
+		dwError = ReadCellObjects(&Writer);
+	}
+	if (dwError == ERROR_SUCCESS) {
+		dwError = FinishStore(&Writer);
+	}
+
+	CopyMemory(pHeader, &Writer.Header, sizeof(STOREHEADER));
+	FreeStoreWriter(&Writer);
+	if (dwError != ERROR_SUCCESS) {
+		DeleteFile(lpszStoreFileName);
+	}
+	return dwError;
+}
+
+// ----------------------------------------------------------------------
+// Read the document line by line, outside of cellobjects only the
+// <partial> marker is kept. A cellobject is only parsed once it is
+// completely in the read buffer (the buffer grows for very large
+// cellobjects). A cellobject cut short by the end of the document
+// is dropped (the lines after it are still read). Documents written
+// to a text mode stream on Windows end their lines with CR LF (found
+// on the first line): each CR added before a LF is removed again, so
+// the store holds the text exactly as printed.
+// ----------------------------------------------------------------------
+DWORD ReadCellObjects(PSTOREWRITER pWriter)
+{
+	LPBYTE lpLine;
+	LPBYTE lpText;
+	LPBYTE lpNext;
+	LPBYTE lpEnd;
+	LPBYTE lpRecordEnd;
+	STORERECORD Record;
+	SIZE_T iPos;
+	DWORD cbRecord;
+	DWORD nDataRef;
+	BOOL bFirstLine;
+	DWORD dwError;
+
+	iPos = 0;
+	bFirstLine = TRUE;
+	for (;;)
+	{
+		lpLine = pWriter->lpRead + iPos;
+		lpEnd = pWriter->lpRead + pWriter->cbReadUsed;
+		lpNext = memchr(lpLine, '\n', lpEnd - lpLine);
+		if (NULL == lpNext && !pWriter->bEndOfFile) {
+			dwError = FillReadBuffer(pWriter, &iPos);
+			if (dwError != ERROR_SUCCESS) {
+				return dwError;
+			}
+			continue;
+		}
+		if (lpLine == lpEnd) {
+			break;
+		}
+		if (bFirstLine) {
+			pWriter->bCarriageReturns = (NULL != lpNext && lpNext > lpLine && lpNext[-1] == '\r');
+			bFirstLine = FALSE;
+		}
+		lpNext = (NULL == lpNext) ? lpEnd : lpNext + 1;
+
+		lpText = SkipIndentation(lpLine, lpNext);
+		lpRecordEnd = NULL;
+		if (StartsWithText(lpText, lpNext, STORE_TEXT("<cellobject>"))) {
+			ZeroMemory(&Record, sizeof(STORERECORD));
+			lpRecordEnd = ParseStoreRecord(lpLine, lpEnd, &Record, &nDataRef);
+			if (NULL == lpRecordEnd && !pWriter->bEndOfFile) {
+				dwError = FillReadBuffer(pWriter, &iPos);
+				if (dwError != ERROR_SUCCESS) {
+					return dwError;
+				}
+				continue;
+			}
+		}
+		if (NULL != lpRecordEnd) {
+			cbRecord = (DWORD)(lpRecordEnd - lpLine);
+			if (pWriter->bCarriageReturns) {
+				cbRecord = RemoveCarriageReturns(lpLine, cbRecord);
+			}
+			dwError = AddStoreRecord(pWriter, lpLine, cbRecord);
+			if (dwError != ERROR_SUCCESS) {
+				return dwError;
+			}
+			lpNext = lpRecordEnd;
+		}
+		else if (StartsWithText(lpText, lpNext, STORE_TEXT("<partial"))) {
+			cbRecord = (DWORD)(lpNext - lpLine);
+			if (pWriter->bCarriageReturns) {
+				cbRecord = RemoveCarriageReturns(lpLine, cbRecord);
+			}
+			pWriter->Header.qwPartialOffset = pWriter->Header.cbHeap;
+			pWriter->Header.cbPartial = cbRecord;
+			dwError = WriteStoreHeap(pWriter, lpLine, cbRecord);
+			if (dwError != ERROR_SUCCESS) {
+				return dwError;
+			}
+		}
+		iPos = lpNext - pWriter->lpRead;
+	}
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Move the unread text to the start of the read buffer and read the
+// next chunk of the document after it
+// ----------------------------------------------------------------------
+DWORD FillReadBuffer(PSTOREWRITER pWriter, SIZE_T *lpiPos)
+{
+	LPBYTE lpRead;
+	DWORD cbRead;
+
+	pWriter->cbReadUsed -= *lpiPos;
+	MoveMemory(pWriter->lpRead, pWriter->lpRead + *lpiPos, pWriter->cbReadUsed);
+	*lpiPos = 0;
+
+	// A cellobject larger than the buffer: double the buffer
+	if (pWriter->cbReadUsed == pWriter->cbRead) {
+		if (pWriter->cbRead > STORE_MAX_RECORD / 2) {
+			return ERROR_INVALID_DATA;
+		}
+		lpRead = MYREALLOC(pWriter->lpRead, pWriter->cbRead * 2);
+		if (NULL == lpRead) {
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+		pWriter->lpRead = lpRead;
+		pWriter->cbRead *= 2;
+	}
+
+	if (!ReadFile(pWriter->hXmlFile, pWriter->lpRead + pWriter->cbReadUsed,
+		(DWORD)min(pWriter->cbRead - pWriter->cbReadUsed, 0x40000000), &cbRead, NULL))
+	{
+		return GetLastError();
+	}
+	if (cbRead == 0) {
+		pWriter->bEndOfFile = TRUE;
+	}
+	pWriter->cbReadUsed += cbRead;
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Remove the CR of each CR LF pair (in place), returns the new size
+// ----------------------------------------------------------------------
+DWORD RemoveCarriageReturns(LPBYTE lpText, DWORD cbText)
+{
+	DWORD iRead;
+	DWORD iWrite;
+
+	iWrite = 0;
+	for (iRead = 0; iRead < cbText; iRead++) {
+		if (lpText[iRead] != '\r' || iRead + 1 == cbText || lpText[iRead + 1] != '\n') {
+			lpText[iWrite++] = lpText[iRead];
+		}
+	}
+	return iWrite;
+}
+
+// ----------------------------------------------------------------------
+// Parse a cellobject in the layout written by CellXML, from its
+// <cellobject> line. Only the cellpath, the basename and the value
+// data may hold line breaks, and none of them is escaped: the cellpath
+// and the basename end at their closing tag, the <data> text ends at
+// the <raw_data> line and no element is recognised inside it. The
+// <name_type> line is only taken right after the cellpath and the
+// basename, <data> and <data_ref> only right after <data_type>.
+// Fills the offsets of pRecord (from lpRecord) and the <data_ref>
+// number, returns the end of the </cellobject> line, or NULL if the
+// cellobject does not end in the buffer (yet)
+// ----------------------------------------------------------------------
+LPBYTE ParseStoreRecord(LPBYTE lpRecord, LPBYTE lpEnd, PSTORERECORD pRecord, LPDWORD lpnDataRef)
+{
+	LPBYTE lpLine;
+	LPBYTE lpText;
+	LPBYTE lpNext;
+	LPBYTE lpClose;
+	BOOL bDataNext;
+
+	*lpnDataRef = 0;
+	lpLine = memchr(lpRecord, '\n', lpEnd - lpRecord);
+	if (NULL == lpLine) {
+		return NULL;
+	}
+	lpLine++;
+
+	// The cellpath, then the basename of a value
+	lpText = SkipIndentation(lpLine, lpEnd);
+	if (StartsWithText(lpText, lpEnd, STORE_TEXT("<cellpath>"))) {
+		lpText += sizeof("<cellpath>") - 1;
+		lpClose = FindText(lpText, lpEnd, STORE_TEXT("</cellpath>"));
+		lpLine = (NULL == lpClose) ? NULL : memchr(lpClose, '\n', lpEnd - lpClose);
+		if (NULL == lpLine) {
+			return NULL;
+		}
+		pRecord->dwPath = (DWORD)(lpText - lpRecord);
+		pRecord->cbPath = (DWORD)(lpClose - lpText);
+		lpLine++;
+		lpText = SkipIndentation(lpLine, lpEnd);
+	}
+	if (StartsWithText(lpText, lpEnd, STORE_TEXT("<basename>"))) {
+		lpClose = FindText(lpText, lpEnd, STORE_TEXT("</basename>"));
+		lpLine = (NULL == lpClose) ? NULL : memchr(lpClose, '\n', lpEnd - lpClose);
+		if (NULL == lpLine) {
+			return NULL;
+		}
+		lpLine++;
+		lpText = SkipIndentation(lpLine, lpEnd);
+	}
+	if (StartsWithText(lpText, lpEnd, STORE_TEXT("<name_type>v<"))) {
+		pRecord->dwFlags |= STORE_RECORD_VALUE;
+	}
+
+	// One element per line up to </cellobject>
+	bDataNext = FALSE;
+	for (; lpLine < lpEnd; lpLine = lpNext)
+	{
+		lpNext = memchr(lpLine, '\n', lpEnd - lpLine);
+		if (NULL == lpNext) {
+			return NULL;
+		}
+		lpNext++;
+		lpText = SkipIndentation(lpLine, lpNext);
+
+		if (StartsWithText(lpText, lpNext, STORE_TEXT("</cellobject>"))) {
+			return lpNext;
+		}
+		if (bDataNext && StartsWithText(lpText, lpNext, STORE_TEXT("<data>"))) {
+			pRecord->dwData = (DWORD)(lpLine - lpRecord);
+			do {
+				lpLine = lpNext;
+				lpNext = memchr(lpLine, '\n', lpEnd - lpLine);
+				if (NULL == lpNext) {
+					return NULL;
+				}
+				lpNext++;
+				lpText = SkipIndentation(lpLine, lpNext);
+			} while (!StartsWithText(lpText, lpNext, STORE_TEXT("<raw_data>")));
+			pRecord->cbData = (DWORD)(lpNext - lpRecord) - pRecord->dwData;
+		}
+		else if (bDataNext && StartsWithText(lpText, lpNext, STORE_TEXT("<data_ref>"))) {
+			pRecord->dwDataRef = (DWORD)(lpLine - lpRecord);
+			pRecord->cbDataRef = (DWORD)(lpNext - lpLine);
+			*lpnDataRef = strtoul((LPCSTR)lpText + sizeof("<data_ref>") - 1, NULL, 10);
+		}
+		bDataNext = (pRecord->dwFlags & STORE_RECORD_VALUE) && StartsWithText(lpText, lpNext, STORE_TEXT("<data_type>"));
+	}
+	return NULL;
+}
+
+// ----------------------------------------------------------------------
+// Skip the indentation of a line
+// ----------------------------------------------------------------------
+LPBYTE SkipIndentation(LPBYTE lpLine, LPBYTE lpEnd)
+{
+	while (lpLine < lpEnd && (*lpLine == ' ' || *lpLine == '\t')) {
+		lpLine++;
+	}
+	return lpLine;
+}
+
+// ----------------------------------------------------------------------
+// Find text in a buffer
+// memchr finds candidates for the first character (the C runtime
+// implementation compares many bytes per instruction), only those
+// are compared in full
+// ----------------------------------------------------------------------
+LPBYTE FindText(LPBYTE lpStart, LPBYTE lpEnd, LPCSTR lpszText, SIZE_T cchText)
+{
+	LPBYTE lpFound;
+
+	while (lpStart + cchText <= lpEnd)
+	{
+		lpFound = memchr(lpStart, lpszText[0], (lpEnd - lpStart) - cchText + 1);
+		if (NULL == lpFound) {
+			return NULL;
+		}
+		if (memcmp(lpFound, lpszText, cchText) == 0) {
+			return lpFound;
+		}
+		lpStart = lpFound + 1;
+	}
+	return NULL;
+}
+
+// ----------------------------------------------------------------------
+// Check if a buffer starts with text
+// ----------------------------------------------------------------------
+BOOL StartsWithText(LPBYTE lpStart, LPBYTE lpEnd, LPCSTR lpszText, SIZE_T cchText)
+{
+	return (lpStart + cchText <= lpEnd && memcmp(lpStart, lpszText, cchText) == 0);
+}
+
+// ----------------------------------------------------------------------
+// Add a cellobject: parse it, copy it to the record heap and add it
+// to the record table. The <data> and <raw_data> lines of a
+// value are recorded, so a <data_ref> to it can be resolved.
+// ----------------------------------------------------------------------
+DWORD AddStoreRecord(PSTOREWRITER pWriter, LPBYTE lpRecord, DWORD cbRecord)
+{
+	PSTORERECORD pRecord;
+	LPVOID lpGrown;
+	DWORD nMaxRecords;
+	DWORD dwError;
+
+	// Grow the record table (and the data_ref table beside it)
+	if (pWriter->Header.nRecords == pWriter->nMaxRecords) {
+		if (pWriter->nMaxRecords >= STORE_NO_RECORD / 2) {
+			return ERROR_INVALID_DATA;
+		}
+		nMaxRecords = (pWriter->nMaxRecords == 0) ? 65536 : pWriter->nMaxRecords * 2;
+		lpGrown = (NULL == pWriter->lpRecords) ? MYALLOC(nMaxRecords * sizeof(STORERECORD)) :
+			MYREALLOC(pWriter->lpRecords, nMaxRecords * sizeof(STORERECORD));
+		if (NULL == lpGrown) {
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+		pWriter->lpRecords = lpGrown;
+		lpGrown = (NULL == pWriter->lpDataRefs) ? MYALLOC(nMaxRecords * sizeof(DWORD)) :
+			MYREALLOC(pWriter->lpDataRefs, nMaxRecords * sizeof(DWORD));
+		if (NULL == lpGrown) {
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+		pWriter->lpDataRefs = lpGrown;
+		pWriter->nMaxRecords = nMaxRecords;
+	}
+	pRecord = &pWriter->lpRecords[pWriter->Header.nRecords];
+	ZeroMemory(pRecord, sizeof(STORERECORD));
+	pRecord->qwOffset = pWriter->Header.cbHeap;
+	pRecord->cbRecord = cbRecord;
+	pRecord->nDataRecord = STORE_NO_RECORD;
+	pWriter->lpDataRefs[pWriter->Header.nRecords] = 0;
+
+	ParseStoreRecord(lpRecord, lpRecord + cbRecord, pRecord, &pWriter->lpDataRefs[pWriter->Header.nRecords]);
+
+	// Value cellobjects are counted from 1, as in <data_ref>
+	if (pRecord->dwFlags & STORE_RECORD_VALUE) {
+		if (pWriter->Header.nValues == pWriter->nMaxValues) {
+			pWriter->nMaxValues = (pWriter->nMaxValues == 0) ? 65536 : pWriter->nMaxValues * 2;
+			lpGrown = (NULL == pWriter->lpValueRecords) ? MYALLOC(pWriter->nMaxValues * sizeof(DWORD)) :
+				MYREALLOC(pWriter->lpValueRecords, pWriter->nMaxValues * sizeof(DWORD));
+			if (NULL == lpGrown) {
+				return ERROR_NOT_ENOUGH_MEMORY;
+			}
+			pWriter->lpValueRecords = lpGrown;
+		}
+		pWriter->lpValueRecords[pWriter->Header.nValues++] = pWriter->Header.nRecords;
+	}
+
+	dwError = AddStorePath(pWriter, lpRecord + pRecord->dwPath, pRecord->cbPath);
+	if (dwError == ERROR_SUCCESS) {
+		dwError = WriteStoreHeap(pWriter, lpRecord, cbRecord);
+	}
+	if (dwError == ERROR_SUCCESS) {
+		pWriter->Header.nRecords++;
+	}
+	return dwError;
+}
+
+// ----------------------------------------------------------------------
+// Keep a copy of a cellpath (in record order) for sorting
+// ----------------------------------------------------------------------
+DWORD AddStorePath(PSTOREWRITER pWriter, LPBYTE lpPath, DWORD cbPath)
+{
+	LPBYTE lpPaths;
+	QWORD cbMaxPaths;
+
+	if (pWriter->cbPaths + cbPath > pWriter->cbMaxPaths) {
+		cbMaxPaths = (pWriter->cbMaxPaths == 0) ? STORE_WRITE_CHUNK : pWriter->cbMaxPaths;
+		while (cbMaxPaths < pWriter->cbPaths + cbPath) {
+			cbMaxPaths *= 2;
+		}
+		if ((QWORD)(SIZE_T)cbMaxPaths != cbMaxPaths) {
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+		lpPaths = (NULL == pWriter->lpPaths) ? MYALLOC((SIZE_T)cbMaxPaths) :
+			MYREALLOC(pWriter->lpPaths, (SIZE_T)cbMaxPaths);
+		if (NULL == lpPaths) {
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+		pWriter->lpPaths = lpPaths;
+		pWriter->cbMaxPaths = cbMaxPaths;
+	}
+	memcpy(pWriter->lpPaths + pWriter->cbPaths, lpPath, cbPath);
+	pWriter->cbPaths += cbPath;
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Append to the record heap (through the write buffer)
+// ----------------------------------------------------------------------
+DWORD WriteStoreHeap(PSTOREWRITER pWriter, LPBYTE lpData, SIZE_T cbData)
+{
+	DWORD dwError;
+
+	if (pWriter->cbWriteUsed + cbData > STORE_WRITE_CHUNK) {
+		dwError = WriteStoreFile(pWriter->hStoreFile, pWriter->lpWrite, pWriter->cbWriteUsed);
+		if (dwError != ERROR_SUCCESS) {
+			return dwError;
+		}
+		pWriter->cbWriteUsed = 0;
+	}
+	if (cbData > STORE_WRITE_CHUNK) {
+		dwError = WriteStoreFile(pWriter->hStoreFile, lpData, cbData);
+		if (dwError != ERROR_SUCCESS) {
+			return dwError;
+		}
+	}
+	else {
+		memcpy(pWriter->lpWrite + pWriter->cbWriteUsed, lpData, cbData);
+		pWriter->cbWriteUsed += cbData;
+	}
+	pWriter->Header.cbHeap += cbData;
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Write a block of any size to the store file
+// ----------------------------------------------------------------------
+DWORD WriteStoreFile(HANDLE hFile, LPBYTE lpData, QWORD cbData)
+{
+	DWORD cbWritten;
+
+	while (cbData > 0) {
+		if (!WriteFile(hFile, lpData, (DWORD)min(cbData, 0x40000000), &cbWritten, NULL)) {
+			return GetLastError();
+		}
+		lpData += cbWritten;
+		cbData -= cbWritten;
+	}
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Resolve <data_ref> records, write the record table and the sorted
+// path index, then write the header with the final offsets
+// ----------------------------------------------------------------------
+DWORD FinishStore(PSTOREWRITER pWriter)
+{
+	PSTORESORTKEY lpKeys;
+	LPDWORD lpIndex;
+	LPBYTE lpPath;
+	LARGE_INTEGER liOffset;
+	BYTE Padding[sizeof(QWORD)];
+	DWORD cbPadding;
+	DWORD nRecords;
+	DWORD nRef;
+	DWORD dwError;
+	DWORD i;
+
+	dwError = WriteStoreFile(pWriter->hStoreFile, pWriter->lpWrite, pWriter->cbWriteUsed);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+	pWriter->cbWriteUsed = 0;
+	ZeroMemory(Padding, sizeof(Padding));
+
+	// A data_ref names the value cellobject (counted from 1) holding the data
+	nRecords = pWriter->Header.nRecords;
+	for (i = 0; i < nRecords; i++) {
+		nRef = pWriter->lpDataRefs[i];
+		if (nRef > 0 && nRef <= pWriter->Header.nValues &&
+			pWriter->lpRecords[pWriter->lpValueRecords[nRef - 1]].cbData > 0)
+		{
+			pWriter->lpRecords[i].nDataRecord = pWriter->lpValueRecords[nRef - 1];
+		}
+	}
+	// The record table starts on an 8 byte boundary after the heap
+	pWriter->Header.qwRecordsOffset = pWriter->Header.qwHeapOffset + pWriter->Header.cbHeap;
+	cbPadding = (DWORD)((sizeof(QWORD) - pWriter->Header.qwRecordsOffset % sizeof(QWORD)) % sizeof(QWORD));
+	dwError = WriteStoreFile(pWriter->hStoreFile, Padding, cbPadding);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+	pWriter->Header.qwRecordsOffset += cbPadding;
+	dwError = WriteStoreFile(pWriter->hStoreFile, (LPBYTE)pWriter->lpRecords, (QWORD)nRecords * sizeof(STORERECORD));
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+
+	// Sort the cellpaths (same paths stay in document order)
+	lpKeys = MYALLOC(max(nRecords, 1) * sizeof(STORESORTKEY));
+	lpIndex = MYALLOC(max(nRecords, 1) * sizeof(DWORD));
+	if (NULL == lpKeys || NULL == lpIndex) {
+		if (NULL != lpKeys) {
+			MYFREE(lpKeys);
+		}
+		if (NULL != lpIndex) {
+			MYFREE(lpIndex);
+		}
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	lpPath = pWriter->lpPaths;
+	for (i = 0; i < nRecords; i++) {
+		lpKeys[i].lpPath = lpPath;
+		lpKeys[i].cbPath = pWriter->lpRecords[i].cbPath;
+		lpKeys[i].nRecord = i;
+		lpPath += lpKeys[i].cbPath;
+	}
+	qsort(lpKeys, nRecords, sizeof(STORESORTKEY), CompareSortKeys);
+	for (i = 0; i < nRecords; i++) {
+		lpIndex[i] = lpKeys[i].nRecord;
+	}
+	pWriter->Header.qwIndexOffset = pWriter->Header.qwRecordsOffset + (QWORD)nRecords * sizeof(STORERECORD);
+	dwError = WriteStoreFile(pWriter->hStoreFile, (LPBYTE)lpIndex, (QWORD)nRecords * sizeof(DWORD));
+	MYFREE(lpKeys);
+	MYFREE(lpIndex);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+
+	pWriter->Header.dwSignature = STORE_SIGNATURE;
+	pWriter->Header.dwVersion = STORE_VERSION;
+	liOffset.QuadPart = 0;
+	if (!SetFilePointerEx(pWriter->hStoreFile, liOffset, NULL, FILE_BEGIN)) {
+		return GetLastError();
+	}
+	return WriteStoreFile(pWriter->hStoreFile, (LPBYTE)&pWriter->Header, sizeof(STOREHEADER));
+}
+
+// ----------------------------------------------------------------------
+// Close both files and free the ingest buffers and tables
+// ----------------------------------------------------------------------
+VOID FreeStoreWriter(PSTOREWRITER pWriter)
+{
+	if (NULL != pWriter->hXmlFile) {
+		CloseHandle(pWriter->hXmlFile);
+	}
+	if (NULL != pWriter->hStoreFile) {
+		CloseHandle(pWriter->hStoreFile);
+	}
+	if (NULL != pWriter->lpRead) {
+		MYFREE(pWriter->lpRead);
+	}
+	if (NULL != pWriter->lpWrite) {
+		MYFREE(pWriter->lpWrite);
+	}
+	if (NULL != pWriter->lpRecords) {
+		MYFREE(pWriter->lpRecords);
+	}
+	if (NULL != pWriter->lpPaths) {
+		MYFREE(pWriter->lpPaths);
+	}
+	if (NULL != pWriter->lpValueRecords) {
+		MYFREE(pWriter->lpValueRecords);
+	}
+	if (NULL != pWriter->lpDataRefs) {
+		MYFREE(pWriter->lpDataRefs);
+	}
+	ZeroMemory(pWriter, sizeof(STOREWRITER));
+}
+
+//-----------------------------------------------------------------
+// Open and map a store file (read-only), and check its layout
+//-----------------------------------------------------------------
+DWORD OpenCellXmlStore(LPCWSTR lpszStoreFileName, PCELLXMLSTORE pStore)
+{
+	LARGE_INTEGER liFileSize;
+	DWORD dwError;
+
+	if (NULL == hHeap) {
+		hHeap = GetProcessHeap();
+	}
+	ZeroMemory(pStore, sizeof(CELLXMLSTORE));
+	pStore->hFile = CreateFile(lpszStoreFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (pStore->hFile == INVALID_HANDLE_VALUE) {
+		pStore->hFile = NULL;
+		return GetLastError();
+	}
+	if (!GetFileSizeEx(pStore->hFile, &liFileSize)) {
+		dwError = GetLastError();
+		CloseCellXmlStore(pStore);
+		return dwError;
+	}
+	if ((QWORD)liFileSize.QuadPart < sizeof(STOREHEADER) ||
+		(QWORD)(SIZE_T)liFileSize.QuadPart != (QWORD)liFileSize.QuadPart)
+	{
+		CloseCellXmlStore(pStore);
+		return ERROR_BAD_FORMAT;
+	}
+
+	pStore->hMapping = CreateFileMapping(pStore->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (NULL == pStore->hMapping) {
+		dwError = GetLastError();
+		CloseCellXmlStore(pStore);
+		return dwError;
+	}
+	pStore->lpBase = MapViewOfFile(pStore->hMapping, FILE_MAP_READ, 0, 0, (SIZE_T)liFileSize.QuadPart);
+	if (NULL == pStore->lpBase) {
+		dwError = GetLastError();
+		CloseCellXmlStore(pStore);
+		return dwError;
+	}
+	pStore->cbFile = (QWORD)liFileSize.QuadPart;
+
+	dwError = ValidateCellXmlStore(pStore);
+	if (dwError != ERROR_SUCCESS) {
+		CloseCellXmlStore(pStore);
+	}
+	return dwError;
+}
+
+//-----------------------------------------------------------------
+// Unmap and close a store file
+//-----------------------------------------------------------------
+VOID CloseCellXmlStore(PCELLXMLSTORE pStore)
+{
+	if (NULL != pStore->lpBase) {
+		UnmapViewOfFile(pStore->lpBase);
+	}
+	if (NULL != pStore->hMapping) {
+		CloseHandle(pStore->hMapping);
+	}
+	if (NULL != pStore->hFile) {
+		CloseHandle(pStore->hFile);
+	}
+	ZeroMemory(pStore, sizeof(CELLXMLSTORE));
+}
+
+// ----------------------------------------------------------------------
+// Check the header and that the record table and path index lie in
+// the mapped store file (records and index entries are checked when
+// a lookup reads them, so opening a store does not touch all of it)
+// ----------------------------------------------------------------------
+DWORD ValidateCellXmlStore(PCELLXMLSTORE pStore)
+{
+	PSTOREHEADER pHeader;
+
+	pHeader = (PSTOREHEADER)pStore->lpBase;
+	if (pHeader->dwSignature != STORE_SIGNATURE || pHeader->dwVersion != STORE_VERSION) {
+		return ERROR_BAD_FORMAT;
+	}
+	if (pHeader->qwHeapOffset < sizeof(STOREHEADER) || pHeader->qwHeapOffset > pStore->cbFile ||
+		pHeader->cbHeap > pStore->cbFile - pHeader->qwHeapOffset ||
+		pHeader->qwRecordsOffset > pStore->cbFile ||
+		(QWORD)pHeader->nRecords * sizeof(STORERECORD) > pStore->cbFile - pHeader->qwRecordsOffset ||
+		pHeader->qwIndexOffset > pStore->cbFile ||
+		(QWORD)pHeader->nRecords * sizeof(DWORD) > pStore->cbFile - pHeader->qwIndexOffset ||
+		pHeader->qwRecordsOffset % sizeof(QWORD) != 0 || pHeader->qwIndexOffset % sizeof(DWORD) != 0 ||
+		pHeader->qwPartialOffset + pHeader->cbPartial > pHeader->cbHeap)
+	{
+		return ERROR_BAD_FORMAT;
+	}
+	pStore->pHeader = pHeader;
+	pStore->lpHeap = pStore->lpBase + pHeader->qwHeapOffset;
+	pStore->lpRecords = (PSTORERECORD)(pStore->lpBase + pHeader->qwRecordsOffset);
+	pStore->lpIndex = (LPDWORD)(pStore->lpBase + pHeader->qwIndexOffset);
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Get the record an index entry refers to, or NULL if the entry or the
+// record is not valid
+// ----------------------------------------------------------------------
+PSTORERECORD GetIndexedRecord(PCELLXMLSTORE pStore, DWORD nEntry)
+{
+	DWORD nRecord;
+
+	nRecord = pStore->lpIndex[nEntry];
+	if (!CheckStoreRecord(pStore, nRecord)) {
+		return NULL;
+	}
+	return &pStore->lpRecords[nRecord];
+}
+
+// ----------------------------------------------------------------------
+// Check that a record lies in the record heap, with its cellpath, data
+// and data_ref lines inside it and a data record number in the table
+// ----------------------------------------------------------------------
+BOOL CheckStoreRecord(PCELLXMLSTORE pStore, DWORD nRecord)
+{
+	PSTORERECORD pRecord;
+
+	if (nRecord >= pStore->pHeader->nRecords) {
+		return FALSE;
+	}
+	pRecord = &pStore->lpRecords[nRecord];
+	if (pRecord->qwOffset > pStore->pHeader->cbHeap ||
+		pRecord->cbRecord > pStore->pHeader->cbHeap - pRecord->qwOffset ||
+		(QWORD)pRecord->dwPath + pRecord->cbPath > pRecord->cbRecord ||
+		(QWORD)pRecord->dwData + pRecord->cbData > pRecord->cbRecord ||
+		(QWORD)pRecord->dwDataRef + pRecord->cbDataRef > pRecord->cbRecord ||
+		(pRecord->nDataRecord != STORE_NO_RECORD && pRecord->nDataRecord >= pStore->pHeader->nRecords))
+	{
+		return FALSE;
+	}
+	return TRUE;
+}
+
+//-----------------------------------------------------------------
+// Write the cellobjects with a cellpath (or a cellpath prefix) as a
+// CellXML document, in document order
+// The path index is searched for the first path not sorting before
+// lpszPath, matching paths follow it in the index. Only the index
+// entries and records read here are checked, nothing is written if
+// one of them is not valid. A <partial> marker of the ingested
+// document is written again before </hive>.
+//-----------------------------------------------------------------
+DWORD LookupCellXmlStore(PCELLXMLSTORE pStore, PXMLOUTPUT pOutput, LPCSTR lpszPath, BOOL bPrefix)
+{
+	PSTORERECORD pRecord;
+	LPDWORD lpMatches;
+	DWORD cbPath;
+	DWORD nMatches;
+	DWORD nFirst;
+	DWORD nLow;
+	DWORD nHigh;
+	DWORD nMiddle;
+	DWORD i;
+
+	cbPath = (DWORD)strlen(lpszPath);
+	nLow = 0;
+	nHigh = pStore->pHeader->nRecords;
+	while (nLow < nHigh)
+	{
+		nMiddle = nLow + (nHigh - nLow) / 2;
+		pRecord = GetIndexedRecord(pStore, nMiddle);
+		if (NULL == pRecord) {
+			return ERROR_BAD_FORMAT;
+		}
+		if (ComparePaths(pStore->lpHeap + pRecord->qwOffset + pRecord->dwPath, pRecord->cbPath,
+			(LPBYTE)lpszPath, cbPath) < 0)
+		{
+			nLow = nMiddle + 1;
+		}
+		else {
+			nHigh = nMiddle;
+		}
+	}
+
+	// A prefix matches the start of a path, a path must match in full
+	nFirst = nLow;
+	for (nHigh = nFirst; nHigh < pStore->pHeader->nRecords; nHigh++)
+	{
+		pRecord = GetIndexedRecord(pStore, nHigh);
+		if (NULL == pRecord) {
+			return ERROR_BAD_FORMAT;
+		}
+		if (pRecord->cbPath < cbPath || (!bPrefix && pRecord->cbPath != cbPath) ||
+			ComparePaths(pStore->lpHeap + pRecord->qwOffset + pRecord->dwPath, cbPath, (LPBYTE)lpszPath, cbPath) != 0)
+		{
+			break;
+		}
+	}
+	nMatches = nHigh - nFirst;
+	if (nMatches == 0) {
+		return ERROR_FILE_NOT_FOUND;
+	}
+
+	lpMatches = MYALLOC(nMatches * sizeof(DWORD));
+	if (NULL == lpMatches) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	memcpy(lpMatches, &pStore->lpIndex[nFirst], nMatches * sizeof(DWORD));
+	qsort(lpMatches, nMatches, sizeof(DWORD), CompareRecordNumbers);
+
+	// The data records of resolved data_refs are printed too
+	for (i = 0; i < nMatches; i++)
+	{
+		pRecord = &pStore->lpRecords[lpMatches[i]];
+		if (pRecord->cbDataRef != 0 && pRecord->nDataRecord != STORE_NO_RECORD &&
+			!CheckStoreRecord(pStore, pRecord->nDataRecord))
+		{
+			MYFREE(lpMatches);
+			return ERROR_BAD_FORMAT;
+		}
+	}
+
+	PrintHiveHeader(pOutput);
+	for (i = 0; i < nMatches; i++) {
+		PrintStoreRecord(pStore, pOutput, lpMatches[i]);
+	}
+	if (pStore->pHeader->cbPartial > 0) {
+		PrintXml(pOutput, "%.*s", (int)pStore->pHeader->cbPartial, pStore->lpHeap + pStore->pHeader->qwPartialOffset);
+	}
+	PrintHiveFooter(pOutput, ERROR_SUCCESS);
+	MYFREE(lpMatches);
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Write one cellobject as it was ingested, with a resolved <data_ref>
+// replaced by the <data> and <raw_data> lines it refers to
+// ----------------------------------------------------------------------
+VOID PrintStoreRecord(PCELLXMLSTORE pStore, PXMLOUTPUT pOutput, DWORD nRecord)
+{
+	PSTORERECORD pRecord;
+	PSTORERECORD pDataRecord;
+	LPBYTE lpRecord;
+	DWORD dwRest;
+
+	pRecord = &pStore->lpRecords[nRecord];
+	lpRecord = pStore->lpHeap + pRecord->qwOffset;
+	if (pRecord->cbDataRef == 0 || pRecord->nDataRecord == STORE_NO_RECORD) {
+		PrintXml(pOutput, "%.*s", (int)pRecord->cbRecord, lpRecord);
+		return;
+	}
+
+	pDataRecord = &pStore->lpRecords[pRecord->nDataRecord];
+	dwRest = pRecord->dwDataRef + pRecord->cbDataRef;
+	PrintXml(pOutput, "%.*s%.*s%.*s",
+		(int)pRecord->dwDataRef, lpRecord,
+		(int)pDataRecord->cbData, pStore->lpHeap + pDataRecord->qwOffset + pDataRecord->dwData,
+		(int)(pRecord->cbRecord - dwRest), lpRecord + dwRest);
+}
+
+// ----------------------------------------------------------------------
+// Compare two cellpaths, ignoring the case of ASCII letters (Registry
+// names are not case sensitive, other characters are compared as bytes)
+// ----------------------------------------------------------------------
+int ComparePaths(LPBYTE lpFirst, DWORD cbFirst, LPBYTE lpSecond, DWORD cbSecond)
+{
+	BYTE bFirst;
+	BYTE bSecond;
+	DWORD i;
+
+	for (i = 0; i < cbFirst && i < cbSecond; i++)
+	{
+		bFirst = lpFirst[i];
+		bSecond = lpSecond[i];
+		if (bFirst >= 'A' && bFirst <= 'Z') {
+			bFirst += 'a' - 'A';
+		}
+		if (bSecond >= 'A' && bSecond <= 'Z') {
+			bSecond += 'a' - 'A';
+		}
+		if (bFirst != bSecond) {
+			return (bFirst < bSecond) ? -1 : 1;
+		}
+	}
+	return (cbFirst < cbSecond) ? -1 : (cbFirst > cbSecond) ? 1 : 0;
+}
+
+// ----------------------------------------------------------------------
+// qsort comparison for the path index (by path, then document order)
+// ----------------------------------------------------------------------
+int CompareSortKeys(const void *lpFirst, const void *lpSecond)
+{
+	PSTORESORTKEY pFirst = (PSTORESORTKEY)lpFirst;
+	PSTORESORTKEY pSecond = (PSTORESORTKEY)lpSecond;
+	int nCompare;
+
+	nCompare = ComparePaths(pFirst->lpPath, pFirst->cbPath, pSecond->lpPath, pSecond->cbPath);
+	if (nCompare == 0) {
+		nCompare = (pFirst->nRecord < pSecond->nRecord) ? -1 : (pFirst->nRecord > pSecond->nRecord) ? 1 : 0;
+	}
+	return nCompare;
+}
+
+// ----------------------------------------------------------------------
+// qsort comparison for matched records (document order)
+// ----------------------------------------------------------------------
+int CompareRecordNumbers(const void *lpFirst, const void *lpSecond)
+{
+	DWORD dwFirst = *(LPDWORD)lpFirst;
+	DWORD dwSecond = *(LPDWORD)lpSecond;
+	return (dwFirst < dwSecond) ? -1 : (dwFirst > dwSecond) ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#pragma once
+#ifndef __CELLXML_STORE_H__
+#define __CELLXML_STORE_H__
+
+#include "CellXML-xml.h"
+
+#define STORE_SIGNATURE			0x54535843	// "CXST"
+#define STORE_VERSION			1			// Store file format version
+#define STORE_NO_RECORD			0xFFFFFFFF	// No record (a data_ref that was not found)
+#define STORE_READ_CHUNK		(4 * 1024 * 1024)	// XML is read in chunks of this size
+#define STORE_WRITE_CHUNK		(4 * 1024 * 1024)	// Records are written in chunks of this size
+#define STORE_MAX_RECORD		0x7FFFFFFF	// Longest cellobject (in bytes)
+
+#define STORE_RECORD_VALUE		0x00000001	// Record is a value cellobject
+
+// ----------------------------------------------------------------------
+// Store file layout
+// The header is followed by the record heap (each cellobject exactly
+// as found in the XML, in document order), the record table (in the
+// same order) and the path index: record numbers sorted by cellpath,
+// compared without case (ASCII letters only)
+// ----------------------------------------------------------------------
+typedef struct _STOREHEADER {
+	DWORD	dwSignature;			// STORE_SIGNATURE
+	DWORD	dwVersion;				// STORE_VERSION
+	DWORD	nRecords;				// Number of cellobjects
+	DWORD	nValues;				// Number of value cellobjects
+	QWORD	qwHeapOffset;			// File offset of the record heap
+	QWORD	cbHeap;					// Size of the record heap (in bytes)
+	QWORD	qwRecordsOffset;		// File offset of the record table
+	QWORD	qwIndexOffset;			// File offset of the path index
+	QWORD	qwPartialOffset;		// Heap offset of the <partial> marker line
+	DWORD	cbPartial;				// Size of the <partial> marker line (0 = complete export)
+	DWORD	dwReserved;
+} STOREHEADER, *PSTOREHEADER;
+
+// ----------------------------------------------------------------------
+// A cellobject in the record heap
+// Offsets inside the cellobject are relative to its first byte
+// ----------------------------------------------------------------------
+typedef struct _STORERECORD {
+	QWORD	qwOffset;				// Heap offset of the cellobject
+	DWORD	cbRecord;				// Size of the cellobject (in bytes)
+	DWORD	dwPath;					// Offset of the cellpath text
+	DWORD	cbPath;					// Size of the cellpath text (in bytes)
+	DWORD	dwData;					// Offset of the <data> and <raw_data> lines (values)
+	DWORD	cbData;					// Size of the <data> and <raw_data> lines (0 = none)
+	DWORD	dwDataRef;				// Offset of the <data_ref> line (dedup exports)
+	DWORD	cbDataRef;				// Size of the <data_ref> line (0 = none)
+	DWORD	nDataRecord;			// Record holding the referenced data, or STORE_NO_RECORD
+	DWORD	dwFlags;				// STORE_RECORD_ flags
+	DWORD	dwReserved;
+} STORERECORD, *PSTORERECORD;
+
+// ----------------------------------------------------------------------
+// Ingest state: the XML read buffer, the record heap write buffer,
+// and the record table and paths kept in memory for sorting
+// ----------------------------------------------------------------------
+typedef struct _STOREWRITER {
+	HANDLE	hXmlFile;				// CellXML document being read
+	HANDLE	hStoreFile;				// Store file being written
+	LPBYTE	lpRead;					// XML read buffer
+	SIZE_T	cbRead;					// Size of the XML read buffer
+	SIZE_T	cbReadUsed;				// Bytes in the XML read buffer
+	BOOL	bEndOfFile;				// The whole XML document has been read
+	BOOL	bCarriageReturns;		// Lines end with CR LF (text mode output)
+	LPBYTE	lpWrite;				// Record heap write buffer
+	SIZE_T	cbWriteUsed;			// Bytes in the heap write buffer
+	STOREHEADER Header;				// Store header (written last)
+	PSTORERECORD lpRecords;			// Record table
+	DWORD	nMaxRecords;			// Size of the record table (in records)
+	LPBYTE	lpPaths;				// All cellpaths, one after the other
+	QWORD	cbPaths;				// Bytes used in lpPaths
+	QWORD	cbMaxPaths;				// Size of lpPaths (in bytes)
+	LPDWORD	lpValueRecords;			// Record number of each value cellobject
+	DWORD	nMaxValues;				// Size of lpValueRecords (in values)
+	LPDWORD	lpDataRefs;				// data_ref value number of each record (0 = none)
+} STOREWRITER, *PSTOREWRITER;
+
+// ----------------------------------------------------------------------
+// An opened store file, mapped read-only
+// ----------------------------------------------------------------------
+typedef struct _CELLXMLSTORE {
+	HANDLE	hFile;					// Handle to the store file
+	HANDLE	hMapping;				// File mapping object for the store file
+	LPBYTE	lpBase;					// Mapped view of the whole store file
+	QWORD	cbFile;					// Size of the store file (in bytes)
+	PSTOREHEADER pHeader;			// Store header
+	LPBYTE	lpHeap;					// Record heap
+	PSTORERECORD lpRecords;			// Record table
+	LPDWORD	lpIndex;				// Path index (record numbers sorted by path)
+} CELLXMLSTORE, *PCELLXMLSTORE;
+
+// ----------------------------------------------------------------------
+// CellXML store functions
+// ----------------------------------------------------------------------
+DWORD IngestCellXml(LPCWSTR lpszXmlFileName, LPCWSTR lpszStoreFileName, PSTOREHEADER pHeader);
+DWORD OpenCellXmlStore(LPCWSTR lpszStoreFileName, PCELLXMLSTORE pStore);
+VOID CloseCellXmlStore(PCELLXMLSTORE pStore);
+DWORD LookupCellXmlStore(PCELLXMLSTORE pStore, PXMLOUTPUT pOutput, LPCSTR lpszPath, BOOL bPrefix);
+
+#endif // __CELLXML_STORE_H__
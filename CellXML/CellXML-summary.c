@@ -0,0 +1,347 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "CellXML-summary.h"
+#include "CellXML-xml.h"
+
+// ----------------------------------------------------------------------
+// CellXML summary internal functions
+// ----------------------------------------------------------------------
+DWORD InitHiveSummary(PHIVESUMMARY pSummary, LPCWSTR szRootKeyName);
+DWORD SummarizeKey(LPVOID lpContext, PCELLXMLKEY pKey);
+DWORD SummarizeValue(LPVOID lpContext, PCELLXMLKEY pKey, PCELLXMLVALUE pValue);
+VOID CloseSummaryKeys(PHIVESUMMARY pSummary, DWORD nDepth);
+VOID AddKeyToSummary(PHIVESUMMARY pSummary, PFILETIME lpftLastWriteTime, size_t cchPath, DWORD nDepth);
+VOID AddValueToSummary(PHIVESUMMARY pSummary, DWORD dwType, DWORD cbData);
+VOID AddSubtreeToSummary(PHIVESUMMARY pSummary, QWORD nCells, size_t cchPath);
+VOID SaveSummaryPath(PSUMMARYPATH pPath, LPCWSTR szPath, size_t cchPath);
+int CompareSubtrees(const void *lpFirst, const void *lpSecond);
+
+//-----------------------------------------------------------------
+// Collect triage statistics with a visitor that only looks at key
+// and value metadata (it never asks for value data), so any walk
+// of VisitHive can be used: offreg.dll, --sequential, stdin, images
+// The walk is charged like an export: when qwMaxWork is exhausted,
+// the statistics so far are kept and ERROR_NOT_ENOUGH_QUOTA returned
+//-----------------------------------------------------------------
+DWORD SummarizeHive(PHIVEFILE pHive, LPCWSTR szRootKeyName, DWORD dwFlags, QWORD qwMaxWork, PHIVESUMMARY pSummary)
+{
+	CELLXMLVISITOR Visitor;
+	DWORD dwError;
+
+	if (NULL == szRootKeyName) {
+		szRootKeyName = pHive->lpszRootKeyName;
+	}
+	dwError = InitHiveSummary(pSummary, szRootKeyName);
+	if (dwError != ERROR_SUCCESS) {
+		return dwError;
+	}
+	Visitor.OnKey = SummarizeKey;
+	Visitor.OnValue = SummarizeValue;
+	Visitor.lpContext = pSummary;
+	dwError = VisitHive(pHive, szRootKeyName, &Visitor, dwFlags, qwMaxWork);
+	if (dwError != ERROR_SUCCESS && dwError != ERROR_NOT_ENOUGH_QUOTA) {
+		FreeHiveSummary(pSummary);
+		return dwError;
+	}
+	CloseSummaryKeys(pSummary, 0);
+	return dwError;
+}
+
+//-----------------------------------------------------------------
+// Print the triage statistics as a compact XML report
+// The statistics of an unfinished walk (dwError is not ERROR_SUCCESS)
+// get the same partial marker as an export
+//-----------------------------------------------------------------
+VOID PrintHiveSummary(PHIVESUMMARY pSummary, DWORD dwError)
+{
+	XMLOUTPUT Output;
+	DWORD i;
+	QWORD cbBucket;
+	LPTSTR lpszNewestTime;
+	LPTSTR lpszOldestTime;
+
+	printf("<?xml version = '1.0' encoding = 'UTF-8'?>\n");
+	printf("<summary>\n");
+	printf("  <keys>%llu</keys>\n", pSummary->nKeys);
+	printf("  <values>%llu</values>\n", pSummary->nValues);
+	printf("  <data_bytes>%llu</data_bytes>\n", pSummary->cbData);
+	printf("  <max_data_bytes>%u</max_data_bytes>\n", pSummary->cbMaxData);
+	if (pSummary->nKeys > 0) {
+		printf("  <deepest depth=\"%u\">%ws</deepest>\n",
+			pSummary->nMaxDepth, pSummary->DeepestPath.lpszPath);
+		lpszNewestTime = FormatLastWriteTime(&pSummary->ftNewest);
+		lpszOldestTime = FormatLastWriteTime(&pSummary->ftOldest);
+		printf("  <newest mtime=\"%ws\">%ws</newest>\n", lpszNewestTime, pSummary->NewestPath.lpszPath);
+		printf("  <oldest mtime=\"%ws\">%ws</oldest>\n", lpszOldestTime, pSummary->OldestPath.lpszPath);
+		MYFREE(lpszNewestTime);
+		MYFREE(lpszOldestTime);
+	}
+
+	// Value data type histogram (unknown type codes are counted together)
+	printf("  <data_types>\n");
+	for (i = 0; i < SUMMARY_TYPE_CODES; i++) {
+		if (pSummary->nTypes[i] == 0) {
+			continue;
+		}
+		printf("    <data_type name=\"%ws\">%llu</data_type>\n",
+			(i < SUMMARY_TYPE_CODES - 1) ? GetValueDataType(i) : TEXT("OTHER"), pSummary->nTypes[i]);
+	}
+	printf("  </data_types>\n");
+
+	// Value data size distribution, in powers of 4 bytes
+	printf("  <data_sizes>\n");
+	printf("    <data_size bytes=\"0\">%llu</data_size>\n", pSummary->nSizes[0]);
+	for (i = 1, cbBucket = 4; i < SUMMARY_SIZE_BUCKETS - 1; i++, cbBucket *= 4) {
+		printf("    <data_size bytes=\"%llu-%llu\">%llu</data_size>\n",
+			(i == 1) ? 1 : cbBucket / 4 + 1, cbBucket, pSummary->nSizes[i]);
+	}
+	printf("    <data_size bytes=\"%llu+\">%llu</data_size>\n", cbBucket / 4 + 1, pSummary->nSizes[i]);
+	printf("  </data_sizes>\n");
+
+	// Largest subtrees (keys and values) at a fixed depth, largest first
+	qsort(pSummary->Largest, pSummary->nLargest, sizeof(SUMMARYSUBTREE), CompareSubtrees);
+	printf("  <largest_subtrees depth=\"%u\">\n", SUMMARY_SUBTREE_DEPTH);
+	for (i = 0; i < pSummary->nLargest; i++) {
+		printf("    <subtree cells=\"%llu\">%ws</subtree>\n",
+			pSummary->Largest[i].nCells, pSummary->Largest[i].Path.lpszPath);
+	}
+	printf("  </largest_subtrees>\n");
+	ZeroMemory(&Output, sizeof(XMLOUTPUT));
+	Output.fp = stdout;
+	PrintPartialMarker(&Output, dwError);
+	printf("</summary>\n");
+}
+
+//-----------------------------------------------------------------
+// Free the path buffers of the triage statistics
+//-----------------------------------------------------------------
+VOID FreeHiveSummary(PHIVESUMMARY pSummary)
+{
+	DWORD i;
+
+	if (NULL != pSummary->szPath) {
+		MYFREE(pSummary->szPath);
+	}
+	if (NULL != pSummary->DeepestPath.lpszPath) {
+		MYFREE(pSummary->DeepestPath.lpszPath);
+	}
+	if (NULL != pSummary->NewestPath.lpszPath) {
+		MYFREE(pSummary->NewestPath.lpszPath);
+	}
+	if (NULL != pSummary->OldestPath.lpszPath) {
+		MYFREE(pSummary->OldestPath.lpszPath);
+	}
+	for (i = 0; i < pSummary->nLargest; i++) {
+		if (NULL != pSummary->Largest[i].Path.lpszPath) {
+			MYFREE(pSummary->Largest[i].Path.lpszPath);
+		}
+	}
+	ZeroMemory(pSummary, sizeof(HIVESUMMARY));
+}
+
+// ----------------------------------------------------------------------
+// Reset the statistics and set up the shared path buffer
+// ----------------------------------------------------------------------
+DWORD InitHiveSummary(PHIVESUMMARY pSummary, LPCWSTR szRootKeyName)
+{
+	size_t cchRootKey;
+
+	ZeroMemory(pSummary, sizeof(HIVESUMMARY));
+	pSummary->ftOldest.dwLowDateTime = MAXDWORD;
+	pSummary->ftOldest.dwHighDateTime = MAXDWORD;
+
+	cchRootKey = _tcslen(szRootKeyName);
+	pSummary->cchMaxPath = cchRootKey + MAX_KEY_DEPTH * (MAX_KEY_NAME + 1) + 1;
+	pSummary->szPath = MYALLOC(pSummary->cchMaxPath * sizeof(WCHAR));
+	if (NULL == pSummary->szPath) {
+		FreeHiveSummary(pSummary);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	memcpy(pSummary->szPath, szRootKeyName, (cchRootKey + 1) * sizeof(WCHAR));
+	return ERROR_SUCCESS;
+}
+
+// ----------------------------------------------------------------------
+// Visitor callback: count a key
+// Keys arrive in depth-first order, so a key closes the subtrees of
+// the keys visited before it at the same depth or deeper
+// ----------------------------------------------------------------------
+DWORD SummarizeKey(LPVOID lpContext, PCELLXMLKEY pKey)
+{
+	PHIVESUMMARY pSummary;
+
+	pSummary = (PHIVESUMMARY)lpContext;
+	if (pKey->nDepth > pSummary->nOpenKeys || pKey->cchPath >= pSummary->cchMaxPath) {
+		return VISIT_SKIP;
+	}
+	CloseSummaryKeys(pSummary, pKey->nDepth);
+	memcpy(pSummary->szPath, pKey->lpszPath, pKey->cchPath * sizeof(WCHAR));
+	pSummary->szPath[pKey->cchPath] = L'\0';
+
+	AddKeyToSummary(pSummary, &pKey->ftLastWriteTime, pKey->cchPath, pKey->nDepth);
+	pSummary->nOpenCells[pKey->nDepth] = 1;
+	pSummary->cchOpenPath[pKey->nDepth] = pKey->cchPath;
+	pSummary->nOpenKeys = pKey->nDepth + 1;
+	return VISIT_CONTINUE;
+}
+
+// ----------------------------------------------------------------------
+// Visitor callback: count a value (type and size only)
+// ----------------------------------------------------------------------
+DWORD SummarizeValue(LPVOID lpContext, PCELLXMLKEY pKey, PCELLXMLVALUE pValue)
+{
+	PHIVESUMMARY pSummary;
+
+	pSummary = (PHIVESUMMARY)lpContext;
+	AddValueToSummary(pSummary, pValue->dwType, pValue->cbData);
+	pSummary->nOpenCells[pKey->nDepth]++;
+	return VISIT_CONTINUE;
+}
+
+// ----------------------------------------------------------------------
+// Close the subtrees of the open keys at nDepth and deeper (the
+// saved path still starts with the path of each of these keys)
+// Only subtrees at one depth are ranked: none of them is nested in
+// another, so the list is not filled with the ancestors of one key
+// ----------------------------------------------------------------------
+VOID CloseSummaryKeys(PHIVESUMMARY pSummary, DWORD nDepth)
+{
+	DWORD i;
+
+	while (pSummary->nOpenKeys > nDepth)
+	{
+		i = --pSummary->nOpenKeys;
+		if (i == SUMMARY_SUBTREE_DEPTH) {
+			AddSubtreeToSummary(pSummary, pSummary->nOpenCells[i], pSummary->cchOpenPath[i]);
+		}
+		if (i > 0) {
+			pSummary->nOpenCells[i - 1] += pSummary->nOpenCells[i];
+		}
+	}
+}
+
+// ----------------------------------------------------------------------
+// Count a key: depth and last write time statistics
+// ----------------------------------------------------------------------
+VOID AddKeyToSummary(PHIVESUMMARY pSummary, PFILETIME lpftLastWriteTime, size_t cchPath, DWORD nDepth)
+{
+	pSummary->nKeys++;
+	if (nDepth > pSummary->nMaxDepth || NULL == pSummary->DeepestPath.lpszPath) {
+		pSummary->nMaxDepth = nDepth;
+		SaveSummaryPath(&pSummary->DeepestPath, pSummary->szPath, cchPath);
+	}
+	if (CompareFileTime(lpftLastWriteTime, &pSummary->ftNewest) > 0 || NULL == pSummary->NewestPath.lpszPath) {
+		pSummary->ftNewest = *lpftLastWriteTime;
+		SaveSummaryPath(&pSummary->NewestPath, pSummary->szPath, cchPath);
+	}
+	if (CompareFileTime(lpftLastWriteTime, &pSummary->ftOldest) < 0 || NULL == pSummary->OldestPath.lpszPath) {
+		pSummary->ftOldest = *lpftLastWriteTime;
+		SaveSummaryPath(&pSummary->OldestPath, pSummary->szPath, cchPath);
+	}
+}
+
+// ----------------------------------------------------------------------
+// Count a value: data type histogram and data size distribution
+// ----------------------------------------------------------------------
+VOID AddValueToSummary(PHIVESUMMARY pSummary, DWORD dwType, DWORD cbData)
+{
+	DWORD iBucket;
+	QWORD cbBucket;
+
+	pSummary->nValues++;
+	pSummary->cbData += cbData;
+	if (cbData > pSummary->cbMaxData) {
+		pSummary->cbMaxData = cbData;
+	}
+	pSummary->nTypes[min(dwType, SUMMARY_TYPE_CODES - 1)]++;
+
+	// Bucket 0 holds empty values, bucket i holds up to 4^i bytes
+	iBucket = 0;
+	if (cbData > 0) {
+		for (iBucket = 1, cbBucket = 4; cbData > cbBucket && iBucket < SUMMARY_SIZE_BUCKETS - 1; iBucket++) {
+			cbBucket *= 4;
+		}
+	}
+	pSummary->nSizes[iBucket]++;
+}
+
+// ----------------------------------------------------------------------
+// Keep the largest subtrees seen so far (replacing the smallest one)
+// ----------------------------------------------------------------------
+VOID AddSubtreeToSummary(PHIVESUMMARY pSummary, QWORD nCells, size_t cchPath)
+{
+	PSUMMARYSUBTREE pSubtree;
+	DWORD i;
+
+	if (pSummary->nLargest < SUMMARY_LARGEST_SUBTREES) {
+		pSubtree = &pSummary->Largest[pSummary->nLargest++];
+	}
+	else {
+		pSubtree = &pSummary->Largest[0];
+		for (i = 1; i < SUMMARY_LARGEST_SUBTREES; i++) {
+			if (pSummary->Largest[i].nCells < pSubtree->nCells) {
+				pSubtree = &pSummary->Largest[i];
+			}
+		}
+		if (nCells <= pSubtree->nCells) {
+			return;
+		}
+	}
+	pSubtree->nCells = nCells;
+	SaveSummaryPath(&pSubtree->Path, pSummary->szPath, cchPath);
+}
+
+// ----------------------------------------------------------------------
+// Copy the current key path, growing the saved buffer when needed
+// ----------------------------------------------------------------------
+VOID SaveSummaryPath(PSUMMARYPATH pPath, LPCWSTR szPath, size_t cchPath)
+{
+	if (cchPath + 1 > pPath->cchMaxPath) {
+		if (NULL != pPath->lpszPath) {
+			MYFREE(pPath->lpszPath);
+		}
+		pPath->cchMaxPath = max(cchPath + 1, 256);
+		pPath->lpszPath = MYALLOC(pPath->cchMaxPath * sizeof(WCHAR));
+		if (NULL == pPath->lpszPath) {
+			pPath->cchMaxPath = 0;
+			return;
+		}
+	}
+	memcpy(pPath->lpszPath, szPath, cchPath * sizeof(WCHAR));
+	pPath->lpszPath[cchPath] = L'\0';
+}
+
+// ----------------------------------------------------------------------
+// qsort comparison for subtrees (largest first)
+// ----------------------------------------------------------------------
+int CompareSubtrees(const void *lpFirst, const void *lpSecond)
+{
+	QWORD nFirst;
+	QWORD nSecond;
+
+	nFirst = ((PSUMMARYSUBTREE)lpFirst)->nCells;
+	nSecond = ((PSUMMARYSUBTREE)lpSecond)->nCells;
+	if (nFirst != nSecond) {
+		return (nFirst > nSecond) ? -1 : 1;
+	}
+	return 0;
+}
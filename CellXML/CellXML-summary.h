@@ -0,0 +1,84 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#pragma once
+#ifndef __CELLXML_SUMMARY_H__
+#define __CELLXML_SUMMARY_H__
+
+#include "CellXML-api.h"
+
+#define SUMMARY_TYPE_CODES			(REG_QWORD + 2)	// Known value types, plus one for other types
+#define SUMMARY_SIZE_BUCKETS		10				// Value data size buckets (powers of 4)
+#define SUMMARY_LARGEST_SUBTREES	10				// Number of largest subtrees reported
+#define SUMMARY_SUBTREE_DEPTH		2				// Depth of the ranked subtree root keys (root key is 0)
+
+// ----------------------------------------------------------------------
+// A saved key path (only copied when a statistic improves)
+// ----------------------------------------------------------------------
+typedef struct _SUMMARYPATH {
+	LPWSTR	lpszPath;				// Saved key path
+	size_t	cchMaxPath;				// Size of lpszPath (in characters)
+} SUMMARYPATH, *PSUMMARYPATH;
+
+// ----------------------------------------------------------------------
+// A subtree in the largest subtrees list
+// ----------------------------------------------------------------------
+typedef struct _SUMMARYSUBTREE {
+	QWORD	nCells;					// Keys and values below (and including) the key
+	SUMMARYPATH	Path;				// Path of the subtree root key
+} SUMMARYSUBTREE, *PSUMMARYSUBTREE;
+
+// ----------------------------------------------------------------------
+// Triage statistics of a Registry hive, collected by a visitor
+// Only key and value metadata is counted: value data is never read
+// and nothing is formatted until the report is printed
+// ----------------------------------------------------------------------
+typedef struct _HIVESUMMARY {
+	QWORD	nKeys;					// Number of keys
+	QWORD	nValues;				// Number of values
+	QWORD	cbData;					// Total size of all value data (in bytes)
+	DWORD	cbMaxData;				// Largest value data size (in bytes)
+	QWORD	nTypes[SUMMARY_TYPE_CODES];			// Values per data type
+	QWORD	nSizes[SUMMARY_SIZE_BUCKETS];		// Values per data size bucket
+	DWORD	nMaxDepth;				// Depth of the deepest key (root key is 0)
+	SUMMARYPATH	DeepestPath;		// Path of the deepest key
+	FILETIME ftNewest;				// Newest key last write time
+	SUMMARYPATH	NewestPath;			// Path of the newest key
+	FILETIME ftOldest;				// Oldest key last write time
+	SUMMARYPATH	OldestPath;			// Path of the oldest key
+	SUMMARYSUBTREE Largest[SUMMARY_LARGEST_SUBTREES];	// Largest subtrees (rooted at SUMMARY_SUBTREE_DEPTH)
+	DWORD	nLargest;				// Number of entries in Largest
+	LPWSTR	szPath;					// Path of the last visited key
+	size_t	cchMaxPath;				// Size of szPath (in characters)
+	DWORD	nOpenKeys;				// Number of keys on the path of the last visited key
+	QWORD	nOpenCells[MAX_KEY_DEPTH + 1];		// Keys and values counted so far below each of these keys
+	size_t	cchOpenPath[MAX_KEY_DEPTH + 1];		// Length of the path of each of these keys
+} HIVESUMMARY, *PHIVESUMMARY;
+
+// ----------------------------------------------------------------------
+// CellXML summary functions
+// ----------------------------------------------------------------------
+DWORD SummarizeHive(PHIVEFILE pHive, LPCWSTR szRootKeyName, DWORD dwFlags, QWORD qwMaxWork, PHIVESUMMARY pSummary);
+VOID PrintHiveSummary(PHIVESUMMARY pSummary, DWORD dwError);
+VOID FreeHiveSummary(PHIVESUMMARY pSummary);
+
+#endif // __CELLXML_SUMMARY_H__
@@ -0,0 +1,701 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdarg.h>
+#include "CellXML-xml.h"
+
+// ----------------------------------------------------------------------
+// CellXML XML writer internal functions
+// ----------------------------------------------------------------------
+LPTSTR ParseValueData(LPBYTE lpData, PDWORD lpcbData, DWORD nTypeCode);
+LPTSTR TransformValueData(LPBYTE lpData, PDWORD lpcbData, DWORD nConversionType);
+size_t AdjustBuffer(LPVOID *lpBuffer, size_t nCurrentSize, size_t nWantedSize, size_t nAlign);
+
+// ----------------------------------------------------------------------
+// CellXML XML writer global variables
+// ----------------------------------------------------------------------
+LPTSTR lpStringBuffer;
+size_t nStringBufferSize;
+
+//-----------------------------------------------------------------
+// Set up an XML writer and a visitor that uses it
+// pMatcher is the IOC matcher in --match mode, else NULL
+// pDedup is the value data table in --dedup mode, else NULL
+// pSecurity is the descriptor cache in --security mode, else NULL
+//-----------------------------------------------------------------
+VOID InitXmlWriter(PXMLWRITER pWriter, PCELLXMLVISITOR pVisitor, PIOCMATCHER pMatcher, PDATADEDUP pDedup,
+	PSECURITYCACHE pSecurity)
+{
+	ZeroMemory(pWriter, sizeof(XMLWRITER));
+	pWriter->pMatcher = pMatcher;
+	pWriter->pDedup = pDedup;
+	pWriter->pSecurity = pSecurity;
+	pWriter->Output.fp = stdout;
+	pWriter->pOutput = &pWriter->Output;
+	pVisitor->OnKey = WriteKeyXml;
+	pVisitor->OnValue = WriteValueXml;
+	pVisitor->lpContext = pWriter;
+}
+
+//-----------------------------------------------------------------
+// Release the last formatted last write time
+//-----------------------------------------------------------------
+VOID FreeXmlWriter(PXMLWRITER pWriter)
+{
+	if (NULL != pWriter->lpszModifiedTime) {
+		MYFREE(pWriter->lpszModifiedTime);
+		pWriter->lpszModifiedTime = NULL;
+	}
+}
+
+//-----------------------------------------------------------------
+// Prepare the writer for a walk resumed at a key (ResumeVisitHive)
+// The ancestors of the key are never passed to the writer, so in
+// --match mode their matcher states are rebuilt from the key path
+// (key names never hold a backslash, the root key name may)
+//-----------------------------------------------------------------
+VOID ResumeXmlWriter(PXMLWRITER pWriter, PCELLXMLKEY pKey)
+{
+	IOCSTATE PathState = { IOC_ROOT_STATE, IOC_NO_MATCH };
+	size_t cchEnds[MAX_KEY_DEPTH + 1];
+	size_t cchEnd;
+	DWORD nDepth;
+
+	if (NULL == pWriter->pMatcher || pKey->nDepth == 0 || pKey->nDepth > MAX_KEY_DEPTH) {
+		return;
+	}
+
+	// Find where each ancestor path ends, from the key up
+	cchEnd = pKey->cchPath;
+	for (nDepth = pKey->nDepth; nDepth > 0; nDepth--) {
+		while (cchEnd > 0 && pKey->lpszPath[cchEnd - 1] != L'\\') {
+			cchEnd--;
+		}
+		if (cchEnd == 0) {
+			return;
+		}
+		cchEnd--;
+		cchEnds[nDepth - 1] = cchEnd;
+	}
+
+	PathState = ScanIocMatcher(pWriter->pMatcher, PathState, pKey->lpszPath, cchEnds[0]);
+	pWriter->PathStates[0] = PathState;
+	for (nDepth = 1; nDepth < pKey->nDepth; nDepth++) {
+		PathState = ScanIocMatcher(pWriter->pMatcher, PathState, pKey->lpszPath + cchEnds[nDepth - 1],
+			cchEnds[nDepth] - cchEnds[nDepth - 1]);
+		pWriter->PathStates[nDepth] = PathState;
+	}
+}
+
+//-----------------------------------------------------------------
+// Visitor callback: write a key cellobject
+// In match mode only keys with a matching path are written out
+//-----------------------------------------------------------------
+DWORD WriteKeyXml(LPVOID lpContext, PCELLXMLKEY pKey)
+{
+	PXMLWRITER pWriter;
+	IOCSTATE PathState = { IOC_ROOT_STATE, IOC_NO_MATCH };
+
+	pWriter = (PXMLWRITER)lpContext;
+
+	// The last write time is only formatted when a cell is written out
+	FreeXmlWriter(pWriter);
+
+	if (NULL != pWriter->pMatcher)
+	{
+		// Scan the root key path once, then continue with each subkey name
+		if (pKey->nDepth == 0) {
+			PathState = ScanIocMatcher(pWriter->pMatcher, PathState, pKey->lpszPath, pKey->cchPath);
+		}
+		else {
+			PathState = ScanIocMatcher(pWriter->pMatcher, pWriter->PathStates[pKey->nDepth - 1],
+				pKey->lpszName - 1, pKey->cchName + 1);
+		}
+		pWriter->PathStates[pKey->nDepth] = PathState;
+		if (PathState.nMatch == IOC_NO_MATCH) {
+			return VISIT_CONTINUE;
+		}
+	}
+
+	pWriter->lpszModifiedTime = FormatLastWriteTime(&pKey->ftLastWriteTime);
+	pWriter->pOutput->nKeyObjects++;
+	PrintKeyCellObject(pWriter->pOutput, pKey->lpszPath, pWriter->lpszModifiedTime,
+		(NULL == pWriter->pSecurity) ? NULL : GetKeySecuritySddl(pWriter->pSecurity, pKey),
+		(NULL == pWriter->pMatcher) ? NULL : pWriter->pMatcher->lpszIndicators[PathState.nMatch]);
+	return VISIT_CONTINUE;
+}
+
+//-----------------------------------------------------------------
+// Visitor callback: write a value cellobject
+// In match mode, the key path scan continues with the value name.
+// Without a path match only string data can still match, so other
+// data types are skipped before their data is read.
+//-----------------------------------------------------------------
+DWORD WriteValueXml(LPVOID lpContext, PCELLXMLKEY pKey, PCELLXMLVALUE pValue)
+{
+	PXMLWRITER pWriter;
+	IOCSTATE ValueState = { IOC_ROOT_STATE, IOC_NO_MATCH };
+	LPBYTE lpData;
+	DWORD nDataRef;
+
+	pWriter = (PXMLWRITER)lpContext;
+
+	// offreg.dll does not report ERROR_MORE_DATA for empty values,
+	// so they have never been part of the XML output
+	if (pValue->cbData == 0) {
+		return VISIT_CONTINUE;
+	}
+
+	if (NULL != pWriter->pMatcher)
+	{
+		ValueState = ScanIocMatcher(pWriter->pMatcher, pWriter->PathStates[pKey->nDepth],
+			pValue->lpszPath + pKey->cchPath, pValue->cchPath - pKey->cchPath);
+		if (ValueState.nMatch == IOC_NO_MATCH)
+		{
+			IOCSTATE DataState = { IOC_ROOT_STATE, IOC_NO_MATCH };
+			if (pValue->dwType != REG_SZ && pValue->dwType != REG_EXPAND_SZ && pValue->dwType != REG_MULTI_SZ) {
+				return VISIT_CONTINUE;
+			}
+
+			// Scan the string data with a fresh automaton state
+			lpData = GetVisitValueData(pValue);
+			if (NULL == lpData) {
+				return VISIT_CONTINUE;
+			}
+			DataState = ScanIocMatcher(pWriter->pMatcher, DataState, (LPCWSTR)lpData, pValue->cbData / sizeof(WCHAR));
+			if (DataState.nMatch == IOC_NO_MATCH) {
+				return VISIT_CONTINUE;
+			}
+			ValueState.nMatch = DataState.nMatch;
+		}
+	}
+
+	lpData = GetVisitValueData(pValue);
+	if (NULL == lpData) {
+		return VISIT_CONTINUE;
+	}
+	if (NULL == pWriter->lpszModifiedTime) {
+		pWriter->lpszModifiedTime = FormatLastWriteTime(&pKey->ftLastWriteTime);
+	}
+
+	// Data written before (with the same type) is only referenced
+	pWriter->pOutput->nValueObjects++;
+	nDataRef = 0;
+	if (NULL != pWriter->pDedup) {
+		nDataRef = FindOrAddData(pWriter->pDedup, lpData, pValue->cbData, pValue->dwType, pValue->dwCellOffset,
+			pWriter->pOutput->nDocument, pWriter->pOutput->nValueObjects);
+	}
+	PrintValueCellObject(pWriter->pOutput, pValue->lpszPath, (pValue->cchName == 0) ? TEXT("(Default)") : pValue->lpszName,
+		pWriter->lpszModifiedTime, pValue->dwType, lpData, pValue->cbData, nDataRef,
+		(NULL == pWriter->pMatcher) ? NULL : pWriter->pMatcher->lpszIndicators[ValueState.nMatch]);
+	return VISIT_CONTINUE;
+}
+
+// ----------------------------------------------------------------------
+// Write formatted text to an output document: to its stream, or (fp is
+// NULL) to the end of its memory buffer
+// Text that cannot be added to the buffer (a %ws string the C locale
+// cannot convert, or no memory) is left out and recorded in dwError,
+// so the document is known to be incomplete.
+// ----------------------------------------------------------------------
+VOID PrintXml(PXMLOUTPUT pOutput, LPCSTR lpszFormat, ...)
+{
+	va_list Args;
+	int cchText;
+	size_t cbWanted;
+	LPSTR lpBuffer;
+
+	va_start(Args, lpszFormat);
+	if (NULL != pOutput->fp) {
+		vfprintf(pOutput->fp, lpszFormat, Args);
+		va_end(Args);
+		return;
+	}
+	cchText = _vscprintf(lpszFormat, Args);
+	va_end(Args);
+	if (cchText < 0) {
+		if (pOutput->dwError == ERROR_SUCCESS) {
+			pOutput->dwError = ERROR_NO_UNICODE_TRANSLATION;
+		}
+		return;
+	}
+
+	// Grow the buffer by doubling, text is always NULL terminated
+	cbWanted = pOutput->cbBuffer + cchText + 1;
+	if (cbWanted > pOutput->cbMaxBuffer) {
+		size_t cbNew = (pOutput->cbMaxBuffer < 4096) ? 4096 : pOutput->cbMaxBuffer;
+		while (cbNew < cbWanted) {
+			cbNew *= 2;
+		}
+		lpBuffer = (NULL == pOutput->lpBuffer) ? MYALLOC(cbNew) : MYREALLOC(pOutput->lpBuffer, cbNew);
+		if (NULL == lpBuffer) {
+			if (pOutput->dwError == ERROR_SUCCESS) {
+				pOutput->dwError = ERROR_NOT_ENOUGH_MEMORY;
+			}
+			return;
+		}
+		pOutput->lpBuffer = lpBuffer;
+		pOutput->cbMaxBuffer = cbNew;
+	}
+	va_start(Args, lpszFormat);
+	vsprintf_s(pOutput->lpBuffer + pOutput->cbBuffer, pOutput->cbMaxBuffer - pOutput->cbBuffer, lpszFormat, Args);
+	va_end(Args);
+	pOutput->cbBuffer += cchText;
+}
+
+// ----------------------------------------------------------------------
+// Start a CellXML document
+// ----------------------------------------------------------------------
+VOID PrintHiveHeader(PXMLOUTPUT pOutput)
+{
+	PrintXml(pOutput, "<?xml version = '1.0' encoding = 'UTF-8'?>\n");
+	PrintXml(pOutput, "<hive>\n");
+}
+
+// ----------------------------------------------------------------------
+// Close a CellXML document
+// ----------------------------------------------------------------------
+VOID PrintHiveFooter(PXMLOUTPUT pOutput, DWORD dwError)
+{
+	PrintPartialMarker(pOutput, dwError);
+	PrintXml(pOutput, "</hive>\n");
+}
+
+// ----------------------------------------------------------------------
+// Mark the output of an unfinished walk (dwError is not ERROR_SUCCESS),
+// so a partial export is never mistaken for a complete one
+// ----------------------------------------------------------------------
+VOID PrintPartialMarker(PXMLOUTPUT pOutput, DWORD dwError)
+{
+	if (dwError == ERROR_NOT_ENOUGH_QUOTA) {
+		PrintXml(pOutput, "<partial reason=\"work-budget\"/>\n");
+	}
+	else if (dwError != ERROR_SUCCESS) {
+		PrintXml(pOutput, "<partial reason=\"error\" code=\"%d\"/>\n", dwError);
+	}
+}
+
+// ----------------------------------------------------------------------
+// Write a Registry key cellobject using DFXML/RegXML syntax
+// lpszSecurity is the key security descriptor (SDDL), or NULL
+// lpszIocMatch is the matched indicator in --match mode, else NULL
+// ----------------------------------------------------------------------
+VOID PrintKeyCellObject(PXMLOUTPUT pOutput, LPCWSTR szKeyPath, LPCTSTR lpszModifiedTime, LPCWSTR lpszSecurity, LPCWSTR lpszIocMatch)
+{
+	PrintXml(pOutput, "  <cellobject>\n");
+	PrintXml(pOutput, "    <cellpath>%ws</cellpath>\n", szKeyPath);
+	PrintXml(pOutput, "    <name_type>k</name_type>\n");
+	PrintXml(pOutput, "    <mtime>%ws</mtime>\n", lpszModifiedTime);
+	PrintXml(pOutput, "    <alloc>1</alloc>\n");
+	if (NULL != lpszSecurity) {
+		PrintXml(pOutput, "    <security>%ws</security>\n", lpszSecurity);
+	}
+	if (NULL != lpszIocMatch) {
+		PrintXml(pOutput, "    <ioc_match>%ws</ioc_match>\n", lpszIocMatch);
+	}
+	PrintXml(pOutput, "  </cellobject>\n");
+}
+
+// ----------------------------------------------------------------------
+// Write a Registry value cellobject using DFXML/RegXML syntax
+// The value data is converted to printable strings here, unless
+// nDataRef names an earlier value cellobject with the same data
+// ----------------------------------------------------------------------
+VOID PrintValueCellObject(PXMLOUTPUT pOutput, LPCWSTR szValuePath, LPCWSTR szValueName, LPCTSTR lpszModifiedTime,
+	DWORD dwType, LPBYTE pData, DWORD cbData, DWORD nDataRef, LPCWSTR lpszIocMatch)
+{
+	// Determine Registry value data type
+	LPTSTR lpszDataType;
+	lpszDataType = GetValueDataType(dwType);
+
+	// Determine Registry value data
+	LPTSTR lpszValueData = NULL;
+	LPTSTR lpszRawValueData = NULL;
+	if (nDataRef == 0) {
+		lpszValueData = ParseValueData(pData, &cbData, dwType);
+		lpszRawValueData = ParseValueData(pData, &cbData, REG_BINARY);
+	}
+
+	PrintXml(pOutput, "  <cellobject>\n");
+	PrintXml(pOutput, "    <cellpath>%ws</cellpath>\n", szValuePath);
+	PrintXml(pOutput, "    <basename>%ws</basename>\n", szValueName);
+	PrintXml(pOutput, "    <name_type>v</name_type>\n");
+	PrintXml(pOutput, "    <mtime>%ws</mtime>\n", lpszModifiedTime);
+	PrintXml(pOutput, "    <alloc>1</alloc>\n");
+	PrintXml(pOutput, "    <data_type>%ws</data_type>\n", lpszDataType);
+	if (nDataRef == 0) {
+		PrintXml(pOutput, "    <data>%ws</data>\n", lpszValueData);
+		PrintXml(pOutput, "    <raw_data>%ws</raw_data>\n", lpszRawValueData);
+	}
+	else {
+		PrintXml(pOutput, "    <data_ref>%u</data_ref>\n", nDataRef);
+	}
+	if (NULL != lpszIocMatch) {
+		PrintXml(pOutput, "    <ioc_match>%ws</ioc_match>\n", lpszIocMatch);
+	}
+	PrintXml(pOutput, "  </cellobject>\n");
+	if (NULL != lpszValueData) {
+		MYFREE(lpszValueData);
+	}
+	if (NULL != lpszRawValueData) {
+		MYFREE(lpszRawValueData);
+	}
+}
+
+// ----------------------------------------------------------------------
+// Convert a key's last write time to a printable string
+// Output format: "YYYY-MM-DDTHH:MM:SSZ"
+// ----------------------------------------------------------------------
+LPTSTR FormatLastWriteTime(PFILETIME lpftLastWriteTime)
+{
+	SYSTEMTIME st;
+	LPTSTR lpszModifiedTime;
+	FileTimeToSystemTime(lpftLastWriteTime, &st);
+	lpszModifiedTime = MYALLOC0(21 * sizeof(TCHAR));
+	_sntprintf_s(lpszModifiedTime, 21 + 1 * sizeof(TCHAR), 21, TEXT("%i-%02i-%02iT%02i:%02i:%02iZ"),
+		st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
+	return lpszModifiedTime;
+}
+
+// ----------------------------------------------------------------------
+// Determine the Registry value type (e.g., REG_SZ, REG_BINARY) and return 
+// its name (a string literal, an empty string for an unknown type)
+// ----------------------------------------------------------------------
+LPTSTR GetValueDataType(DWORD nTypeCode)
+{
+	LPTSTR lpszDataType;
+	lpszDataType = TEXT("");
+	if (nTypeCode == REG_NONE) { lpszDataType = TEXT("REG_NONE"); }
+	else if (nTypeCode == REG_SZ) { lpszDataType = TEXT("REG_SZ"); }
+	else if (nTypeCode == REG_EXPAND_SZ) { lpszDataType = TEXT("REG_EXPAND_SZ"); }
+	else if (nTypeCode == REG_BINARY) { lpszDataType = TEXT("REG_BINARY"); }
+	else if (nTypeCode == REG_DWORD) { lpszDataType = TEXT("REG_DWORD"); }
+	else if (nTypeCode == REG_DWORD_BIG_ENDIAN) { lpszDataType = TEXT("REG_DWORD_BIG_ENDIAN"); }
+	else if (nTypeCode == REG_LINK) { lpszDataType = TEXT("REG_LINK"); }
+	else if (nTypeCode == REG_MULTI_SZ) { lpszDataType = TEXT("REG_MULTI_SZ"); }
+	else if (nTypeCode == REG_RESOURCE_LIST) { lpszDataType = TEXT("REG_RESOURCE_LIST"); }
+	else if (nTypeCode == REG_FULL_RESOURCE_DESCRIPTOR) { lpszDataType = TEXT("REG_FULL_RESOURCE_DESCRIPTOR"); }
+	else if (nTypeCode == REG_RESOURCE_REQUIREMENTS_LIST) { lpszDataType = TEXT("REG_RESOURCE_REQUIREMENTS_LIST"); }
+	else if (nTypeCode == REG_QWORD) { lpszDataType = TEXT("REG_QWORD"); }
+	return lpszDataType;
+}
+
+// ----------------------------------------------------------------------
+// Parse Registry value data
+// Return a string (based on data type) that can be printed, allocated
+// for the caller to free
+// ----------------------------------------------------------------------
+LPTSTR ParseValueData(LPBYTE lpData, PDWORD lpcbData, DWORD nTypeCode)
+{
+	LPTSTR lpszValueData;
+	lpszValueData = NULL;
+
+	// Check if the Registry value data is NULL, else process the Registry value data
+	if (NULL == lpData)
+	{
+		lpszValueData = TransformValueData(lpData, lpcbData, REG_BINARY);
+	}
+	else
+	{
+		DWORD cbData;
+		size_t cchMax;
+		size_t cchActual;
+		cbData = *lpcbData;
+		switch (nTypeCode) {
+
+			// Process the three different string types (normal, expanded and multi)
+		case REG_SZ:
+		case REG_EXPAND_SZ:
+		case REG_MULTI_SZ:
+			// We need to do a check for hidden bytes after string[s]
+			cchMax = cbData / sizeof(TCHAR);
+			if (REG_MULTI_SZ == nTypeCode)
+			{
+				// Do a search for double NULL chars (REG_MULTI_SZ ends with \0\0)
+				for (cchActual = 0; cchActual < cchMax; cchActual++)
+				{
+					if (0 != ((LPTSTR)lpData)[cchActual]) {
+						continue;
+					}
+					cchActual++;
+					// Special case check for incorrectly terminated string
+					if (cchActual >= cchMax) {
+						break;
+					}
+					if (0 != ((LPTSTR)lpData)[cchActual]) {
+						continue;
+					}
+					// Found a double NULL terminated string
+					cchActual++;
+					break;
+				}
+			}
+			else
+			{
+				// Must be a REG_SZ or REG_EXPAND_SZ
+				cchActual = _tcsnlen((LPTSTR)lpData, cchMax);
+				if (cchActual < cchMax) {
+					cchActual++;  // Account for NULL character
+				}
+			}
+
+			// Do a size check; actual size VS specified size
+			if ((cchActual * sizeof(TCHAR)) == cbData) {
+				// If determined size is the same as specified size
+				// process using the specified Registry value type
+				lpszValueData = TransformValueData(lpData, lpcbData, nTypeCode);
+			}
+			else
+			{
+				// Else process the string as REG_BINARY (binary)
+				lpszValueData = TransformValueData(lpData, lpcbData, REG_BINARY);
+			}
+			break;
+
+			// Process DWORD types
+		case REG_DWORD_LITTLE_ENDIAN:
+		case REG_DWORD_BIG_ENDIAN:
+			// Do a size check; DWORD size VS specified size
+			if (sizeof(DWORD) == cbData)
+			{
+				// If the size of the value data is the same as a DWORD size
+				// process using the specified Registry value type
+				lpszValueData = TransformValueData(lpData, lpcbData, nTypeCode);
+			}
+			else
+			{
+				// Else process the string as REG_BINARY (binary)
+				lpszValueData = TransformValueData(lpData, lpcbData, REG_BINARY);
+			}
+			break;
+
+			// Process QWORD types (currently only little endian)
+		case REG_QWORD_LITTLE_ENDIAN:
+			// If the size if the value data is the same as a QWORD size
+			// process using the specified Registry value type
+			if (sizeof(QWORD) == cbData)
+			{
+				// If the size of the value data is the same as a QWORD size
+				// process using the specified Registry value type
+				lpszValueData = TransformValueData(lpData, lpcbData, nTypeCode);
+			}
+			else
+			{
+				// Else process the string as REG_BINARY (binary)
+				lpszValueData = TransformValueData(lpData, lpcbData, REG_BINARY);
+			}
+			break;
+
+			// Process any other Registry value data type as REG_BINARY (binary)
+		default:
+			lpszValueData = TransformValueData(lpData, lpcbData, REG_BINARY);
+		}
+	}
+	return lpszValueData;
+}
+
+
+// ----------------------------------------------------------------------
+// Transform Registry value data based on data_type
+// ----------------------------------------------------------------------
+LPTSTR TransformValueData(LPBYTE lpData, PDWORD lpcbData, DWORD nConversionType)
+{
+	LPTSTR lpszValueDataIsNULL = TEXT("NULL");
+	LPTSTR lpszValueData;
+	LPDWORD lpDword;
+	LPQWORD lpQword;
+	DWORD nDwordCpu;
+
+	lpszValueData = NULL;
+	lpDword = NULL;
+	lpQword = NULL;
+
+	if (NULL == lpData)
+	{
+		lpszValueData = MYALLOC((_tcslen(lpszValueDataIsNULL) + 1) * sizeof(TCHAR));
+		//_tcscpy(lpszValueData, lpszValueDataIsNULL);
+		_tcscpy_s(lpszValueData, (_tcslen(lpszValueDataIsNULL) + 1) * sizeof(TCHAR), lpszValueDataIsNULL);
+	}
+	else
+	{
+		DWORD cbData;
+		DWORD ibCurrent;
+		size_t cchToGo;
+		size_t cchString;
+		size_t cchActual;
+		LPTSTR lpszSrc;
+		LPTSTR lpszDst;
+
+		cbData = *lpcbData;
+
+		switch (nConversionType) {
+		case REG_SZ:
+			// A normal NULL termination string
+			lpszValueData = MYALLOC0(sizeof(TCHAR) + cbData);
+			if (NULL != lpData) {
+				memcpy(lpszValueData, lpData, cbData);
+			}
+			break;
+
+		case REG_EXPAND_SZ:
+			// A NULL terminated string that contains unexpanded references to environment variables (e.g., "%PATH%")
+			// Process and output in the following format: "<string>"\0
+			lpszValueData = MYALLOC0(sizeof(TCHAR) + cbData);
+			if (NULL != lpData) {
+				memcpy(lpszValueData, lpData, cbData);
+			}
+			break;
+
+		case REG_MULTI_SZ:
+			// A sequence of null-terminated strings, terminated by an empty string (\0).
+			// Process and output in the following format: "<string>", "<string>", "<string>", ...\0
+			nStringBufferSize = AdjustBuffer(&lpStringBuffer, nStringBufferSize, 10 + (2 * cbData), 1024);
+			ZeroMemory(lpStringBuffer, nStringBufferSize);
+			lpszDst = lpStringBuffer;
+
+			cchActual = 0;
+			// Only process if the actual value data is not NULL
+			if (NULL != lpData)
+			{
+				lpszSrc = (LPTSTR)lpData;
+				// Convert the byte count to a char count
+				cchToGo = cbData / sizeof(TCHAR);
+				while ((cchToGo > 0) && (*lpszSrc)) {
+					if (0 != cchActual)
+					{
+						// Add comma (",") to separate strings
+						//_tcscpy(lpszDst, TEXT(","));
+						_tcscpy_s(lpszDst, 2 * sizeof(TCHAR), TEXT(","));
+						// Increase the count by 1 to account for comma
+						lpszDst += 1;
+						cchActual += 1;
+					}
+					cchString = _tcsnlen(lpszSrc, cchToGo);
+					_tcsncpy(lpszDst, lpszSrc, cchString);
+					lpszDst += cchString;
+					cchActual += cchString;
+
+					// Decrease count for processed, if count ToGo is 0 then we are done
+					cchToGo -= cchString;
+					if (cchToGo == 0) {
+						break;
+					}
+
+					// Account for the NULL character
+					lpszSrc += cchString + 1;
+					cchToGo -= 1;
+				}
+			}
+			cchActual += 3 + 1;
+
+			// Allocate memory for the constructed string and copy to value data string
+			lpszValueData = MYALLOC(cchActual * sizeof(TCHAR));
+			_tcscpy(lpszValueData, lpStringBuffer);
+			//_tcscpy_s(lpszValueData, cchActual * sizeof(TCHAR), lpStringBuffer);
+
+			break;
+
+		case REG_DWORD_BIG_ENDIAN:
+			// convert DWORD big endian
+			lpDword = &nDwordCpu;
+			for (ibCurrent = 0; ibCurrent < sizeof(DWORD); ibCurrent++) {
+				((LPBYTE)&nDwordCpu)[ibCurrent] = lpData[sizeof(DWORD) - 1 - ibCurrent];
+			}
+			// Output format: "0xXXXXXXXX\0"
+			lpszValueData = MYALLOC0((3 + 8 + 1) * sizeof(TCHAR));
+			if (NULL != lpData) {
+				//_sntprintf(lpszValueData, (3 + 8 + 1), TEXT("0x%08X\0"), *lpDword);
+				_sntprintf_s(lpszValueData, (3 + 8 + 1) * sizeof(TCHAR), (3 + 8 + 1), TEXT("0x%08X\0"), *lpDword);
+			}
+			break;
+
+		case REG_DWORD:
+			// A native DWORD that can be displayed as DWORD
+			// This includes REG_DWORD_LITTLE_ENDIAN (the same as DWORD)
+			if (NULL == lpDword) {
+				lpDword = (LPDWORD)lpData;
+			}
+			// Output format: "0xXXXXXXXX\0"
+			lpszValueData = MYALLOC0((2 + 8 + 1) * sizeof(TCHAR));
+			if (NULL != lpData) {
+				_sntprintf(lpszValueData, (2 + 8 + 1), TEXT("0x%08X\0"), *lpDword);
+				//_sntprintf_s(lpszValueData, (2 + 8 + 1) * sizeof(TCHAR), (2 + 8 + 1), TEXT("0x%08X\0"), *lpDword);
+			}
+			break;
+
+		case REG_QWORD:
+			// A native QWORD that can be displayed as QWORD
+			// This includes REG_QWORD_LITTLE_ENDIAN (which is the same as QWORD)
+			if (NULL == lpQword) {
+				lpQword = (LPQWORD)lpData;
+			}
+			// Output format: "0xXXXXXXXXXXXXXXXX\0"
+			lpszValueData = MYALLOC0((3 + 16 + 1) * sizeof(TCHAR));
+			if (NULL != lpData) {
+				_sntprintf(lpszValueData, (3 + 16 + 1), TEXT("0x%016I64X\0"), *lpQword);
+			}
+			break;
+
+		default:
+			// Default processing and display method: Present value as hex bytes
+			// Output format: "[XX][XX]...[XX]\0"
+			lpszValueData = MYALLOC0((1 + (cbData * 3) + 1) * sizeof(TCHAR));
+			for (ibCurrent = 0; ibCurrent < cbData; ibCurrent++) {
+				_sntprintf(lpszValueData + (ibCurrent * 3), 4, TEXT(" %02X\0"), *(lpData + ibCurrent));
+			}
+			// Remove the first space character (the string stays at the start of its allocation)
+			memmove(lpszValueData, lpszValueData + 1, cbData * 3 * sizeof(TCHAR));
+		}
+	}
+	return lpszValueData;
+}
+
+
+// ----------------------------------------------------------------------
+// Adjust the buffer 
+// ----------------------------------------------------------------------
+size_t AdjustBuffer(LPVOID *lpBuffer, size_t nCurrentSize, size_t nWantedSize, size_t nAlign)
+{
+	if (NULL == *lpBuffer) {
+		nCurrentSize = 0;
+	}
+
+	if (nWantedSize > nCurrentSize) {
+		if (NULL != *lpBuffer) {
+			MYFREE(*lpBuffer);
+			*lpBuffer = NULL;
+		}
+
+		if (1 >= nAlign) {
+			nCurrentSize = nWantedSize;
+		}
+		else {
+			nCurrentSize = nWantedSize / nAlign;
+			nCurrentSize *= nAlign;
+			if (nWantedSize > nCurrentSize) {
+				nCurrentSize += nAlign;
+			}
+		}
+
+		*lpBuffer = MYALLOC(nCurrentSize);
+	}
+	return nCurrentSize;
+}
@@ -0,0 +1,89 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#pragma once
+#ifndef __CELLXML_XML_H__
+#define __CELLXML_XML_H__
+
+#include "CellXML-api.h"
+#include "CellXML-ioc.h"
+#include "CellXML-dedup.h"
+#include "CellXML-security.h"
+
+// ----------------------------------------------------------------------
+// An XML output document (standard output, one shard file, or a
+// memory buffer when fp is NULL)
+// ----------------------------------------------------------------------
+typedef struct _XMLOUTPUT {
+	FILE	*fp;					// Output stream, or NULL
+	LPSTR	lpBuffer;				// Memory buffer (only used without fp)
+	size_t	cbBuffer;				// Bytes of text in the buffer
+	size_t	cbMaxBuffer;			// Allocated buffer size
+	DWORD	nDocument;				// Document number (--dedup never references another document)
+	DWORD	nKeyObjects;			// Key cellobjects written
+	DWORD	nValueObjects;			// Value cellobjects written
+	DWORD	dwError;				// First text lost from the buffer, or ERROR_SUCCESS
+} XMLOUTPUT, *PXMLOUTPUT;
+
+// ----------------------------------------------------------------------
+// The CellXML (DFXML/RegXML) writer, used as a hive visitor
+// In --match mode, the IOC matcher state of each key path element is
+// kept so every name is only scanned once. In --dedup mode, repeated
+// value data is replaced by the number of the value cellobject that
+// first held it (value cellobjects are counted from 1). In --security
+// mode, key cellobjects hold the key security descriptor as SDDL.
+// Cellobjects go to pOutput, which can be switched between callbacks.
+// ----------------------------------------------------------------------
+typedef struct _XMLWRITER {
+	PIOCMATCHER	pMatcher;			// IOC matcher (only set with --match)
+	PDATADEDUP	pDedup;				// Data table (only set with --dedup)
+	PSECURITYCACHE pSecurity;		// Security descriptor cache (only set with --security)
+	XMLOUTPUT	Output;				// Standard output
+	PXMLOUTPUT	pOutput;			// Current output document
+	IOCSTATE	PathStates[MAX_KEY_DEPTH + 1];	// Matcher state after each key of the current path
+	LPTSTR		lpszModifiedTime;	// Current key last write time (formatted on first use)
+} XMLWRITER, *PXMLWRITER;
+
+// ----------------------------------------------------------------------
+// CellXML XML writer functions
+// ----------------------------------------------------------------------
+VOID InitXmlWriter(PXMLWRITER pWriter, PCELLXMLVISITOR pVisitor, PIOCMATCHER pMatcher, PDATADEDUP pDedup,
+	PSECURITYCACHE pSecurity);
+VOID FreeXmlWriter(PXMLWRITER pWriter);
+VOID ResumeXmlWriter(PXMLWRITER pWriter, PCELLXMLKEY pKey);
+DWORD WriteKeyXml(LPVOID lpContext, PCELLXMLKEY pKey);
+DWORD WriteValueXml(LPVOID lpContext, PCELLXMLKEY pKey, PCELLXMLVALUE pValue);
+
+// ----------------------------------------------------------------------
+// CellXML output functions
+// ----------------------------------------------------------------------
+LPTSTR FormatLastWriteTime(PFILETIME lpftLastWriteTime);
+LPTSTR GetValueDataType(DWORD nTypeCode);
+VOID PrintXml(PXMLOUTPUT pOutput, LPCSTR lpszFormat, ...);
+VOID PrintHiveHeader(PXMLOUTPUT pOutput);
+VOID PrintHiveFooter(PXMLOUTPUT pOutput, DWORD dwError);
+VOID PrintPartialMarker(PXMLOUTPUT pOutput, DWORD dwError);
+VOID PrintKeyCellObject(PXMLOUTPUT pOutput, LPCWSTR szKeyPath, LPCTSTR lpszModifiedTime, LPCWSTR lpszSecurity, LPCWSTR lpszIocMatch);
+VOID PrintValueCellObject(PXMLOUTPUT pOutput, LPCWSTR szValuePath, LPCWSTR szValueName, LPCTSTR lpszModifiedTime,
+	DWORD dwType, LPBYTE pData, DWORD cbData, DWORD nDataRef, LPCWSTR lpszIocMatch);
+
+#endif // __CELLXML_XML_H__
@@ -0,0 +1,62 @@
+/*
+Copyright 2015 Thomas Laurenson
+thomaslaurenson.com
+
+This file is part of HiveXML.
+
+HiveXML is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+HiveXML is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with HiveXML.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#ifndef __CELLXML_H__
+#define __CELLXML_H__
+
+#include <windows.h>
+#include <stdio.h>
+#include <tchar.h>
+#include "offreg.h"
+
+// ----------------------------------------------------------------------
+// Definition for QWORD (not yet defined globally in WinDef.h)
+// ----------------------------------------------------------------------
+#ifndef QWORD
+typedef unsigned __int64 QWORD, NEAR *PQWORD, FAR *LPQWORD;
+#endif
+
+// ----------------------------------------------------------------------
+// Set up program heap
+// ----------------------------------------------------------------------
+#define USEHEAPALLOC_DANGER
+#ifdef USEHEAPALLOC_DANGER
+extern HANDLE hHeap;
+#define MYALLOC(x)  HeapAlloc(hHeap,0,x)
+#define MYALLOC0(x) HeapAlloc(hHeap,8,x)
+#define MYFREE(x)   HeapFree(hHeap,0,x)
+#define MYREALLOC(x,y) HeapReAlloc(hHeap,0,x,y)
+#else
+#define MYALLOC(x)  GlobalAlloc(GMEM_FIXED,x)
+#define MYALLOC0(x) GlobalAlloc(GPTR,x)
+#define MYFREE(x)   GlobalFree(x)
+#define MYREALLOC(x,y) GlobalReAlloc(x,y,GMEM_MOVEABLE)
+#endif
+
+// ----------------------------------------------------------------------
+// CellXML global definitions
+// ----------------------------------------------------------------------
+#define MAX_KEY_NAME 255		// Maximum length for Registry key name
+#define MAX_VALUE_NAME 16383	// Maximum length for Registry value name
+#define MAX_DATA 1024000		// Maximum length for Registry value data
+
+#endif // __CELLXML_H__